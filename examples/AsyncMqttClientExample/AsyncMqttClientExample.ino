@@ -61,6 +61,8 @@ void setup() {
 }
 
 void loop() {
+  ha.tick();  // handles connects and commands reported by the AsyncTCP task
+
   static unsigned long lastMsg = 0;
   if (millis() - lastMsg > 5000) {
     lastMsg = millis();
@@ -45,7 +45,7 @@ void setup() {
   });
 
   transport.setServer(mqtt_server, 1883, mqtt_user, mqtt_pass);
-  mqtt.connect(nodeId.c_str(), mqtt_user, mqtt_pass);
+  transport.connect(nodeId.c_str());   // sends the Last Will set by setDevice()
 
   HaSwitchConfig sw{
     .common = { .object_id="relay1", .name="Desk Relay" }
@@ -0,0 +1,129 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+namespace ha_fields {
+
+/** @brief How a config member is written to the discovery payload. */
+enum class FieldType : uint8_t {
+  String,        // optional string, omitted when nullptr
+  Payload,       // string with a Home Assistant default, which is used when nullptr
+  StateTopic,    // the entity's state topic; the field is its override
+  CommandTopic,  // the entity's command topic; the field is its override
+  Topic,         // optional extra topic, used as given
+  Availability,  // availability topic and payloads (no field)
+  Float,         // number, `def` is the Home Assistant default as written
+  Temperature,   // Float in the climate's temperature_unit, `def` is the default in °C (Home
+                 // Assistant converts it for °F, so it is only left out for °C)
+  Uint16,        // number, `def` is the Home Assistant default as written
+  StringList,    // nullptr-terminated string array, omitted when nullptr
+  Constant       // `def` as a string (no field)
+};
+
+}  // namespace ha_fields
+
+// The members of each component's config payload, in order, after name and uniq_id. Both the
+// runtime serializer (HaDiscovery.cpp) and the compile-time one (HaStaticEntity.h) expand these,
+// so a component is described only here.
+//
+// F(Config, FieldType, key, Home Assistant default, member); entries without a field name
+// `common` as their member.
+
+#define HA_SENSOR_FIELDS(F)                                                          \
+  F(HaSensorConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)      \
+  F(HaSensorConfig, Availability, nullptr, nullptr, common)                          \
+  F(HaSensorConfig, String, "icon", nullptr, common.icon)                            \
+  F(HaSensorConfig, String, "unit_of_meas", nullptr, unit_of_measurement)            \
+  F(HaSensorConfig, String, "dev_cla", nullptr, device_class)                        \
+  F(HaSensorConfig, String, "stat_cla", nullptr, state_class)                        \
+  F(HaSensorConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_SWITCH_FIELDS(F)                                                          \
+  F(HaSwitchConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)      \
+  F(HaSwitchConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)          \
+  F(HaSwitchConfig, Payload, "pl_on", "ON", payload_on)                              \
+  F(HaSwitchConfig, Payload, "pl_off", "OFF", payload_off)                           \
+  F(HaSwitchConfig, Availability, nullptr, nullptr, common)                          \
+  F(HaSwitchConfig, String, "icon", nullptr, common.icon)                            \
+  F(HaSwitchConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_BINARY_SENSOR_FIELDS(F)                                                   \
+  F(HaBinarySensorConfig, StateTopic, "stat_t", nullptr, common.state_topic_override) \
+  F(HaBinarySensorConfig, Availability, nullptr, nullptr, common)                    \
+  F(HaBinarySensorConfig, Payload, "pl_on", "ON", payload_on)                        \
+  F(HaBinarySensorConfig, Payload, "pl_off", "OFF", payload_off)                     \
+  F(HaBinarySensorConfig, String, "icon", nullptr, common.icon)                      \
+  F(HaBinarySensorConfig, String, "dev_cla", nullptr, device_class)                  \
+  F(HaBinarySensorConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_BUTTON_FIELDS(F)                                                          \
+  F(HaButtonConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)          \
+  F(HaButtonConfig, Payload, "pl_prs", "PRESS", payload_press)                       \
+  F(HaButtonConfig, Availability, nullptr, nullptr, common)                          \
+  F(HaButtonConfig, String, "icon", nullptr, common.icon)                            \
+  F(HaButtonConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_NUMBER_FIELDS(F)                                                          \
+  F(HaNumberConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)      \
+  F(HaNumberConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)          \
+  F(HaNumberConfig, Availability, nullptr, nullptr, common)                          \
+  F(HaNumberConfig, Float, "min", "1", min)                                          \
+  F(HaNumberConfig, Float, "max", "100", max)                                        \
+  F(HaNumberConfig, Float, "step", "1", step)                                        \
+  F(HaNumberConfig, String, "mode", nullptr, mode)                                   \
+  F(HaNumberConfig, String, "icon", nullptr, common.icon)                            \
+  F(HaNumberConfig, String, "unit_of_meas", nullptr, unit_of_measurement)            \
+  F(HaNumberConfig, String, "dev_cla", nullptr, device_class)                        \
+  F(HaNumberConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_SELECT_FIELDS(F)                                                          \
+  F(HaSelectConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)      \
+  F(HaSelectConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)          \
+  F(HaSelectConfig, Availability, nullptr, nullptr, common)                          \
+  F(HaSelectConfig, StringList, "ops", nullptr, options)                             \
+  F(HaSelectConfig, String, "icon", nullptr, common.icon)                            \
+  F(HaSelectConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_LIGHT_FIELDS(F)                                                           \
+  F(HaLightConfig, Constant, "schema", "json", common)                               \
+  F(HaLightConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)       \
+  F(HaLightConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)           \
+  F(HaLightConfig, Availability, nullptr, nullptr, common)                           \
+  F(HaLightConfig, StringList, "sup_clrm", nullptr, supported_color_modes)           \
+  F(HaLightConfig, Uint16, "bri_scl", "255", brightness_scale)                       \
+  F(HaLightConfig, String, "icon", nullptr, common.icon)                             \
+  F(HaLightConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_COVER_FIELDS(F)                                                           \
+  F(HaCoverConfig, StateTopic, "stat_t", nullptr, common.state_topic_override)       \
+  F(HaCoverConfig, CommandTopic, "cmd_t", nullptr, command_topic_override)           \
+  F(HaCoverConfig, Payload, "pl_open", "OPEN", payload_open)                         \
+  F(HaCoverConfig, Payload, "pl_cls", "CLOSE", payload_close)                        \
+  F(HaCoverConfig, Payload, "pl_stop", "STOP", payload_stop)                         \
+  F(HaCoverConfig, Payload, "stat_open", "open", state_open)                         \
+  F(HaCoverConfig, Payload, "stat_clsd", "closed", state_closed)                     \
+  F(HaCoverConfig, Availability, nullptr, nullptr, common)                           \
+  F(HaCoverConfig, String, "icon", nullptr, common.icon)                             \
+  F(HaCoverConfig, String, "dev_cla", nullptr, device_class)                         \
+  F(HaCoverConfig, String, "ent_cat", nullptr, common.entity_category)
+
+#define HA_CLIMATE_FIELDS(F)                                                         \
+  F(HaClimateConfig, StateTopic, "mode_stat_t", nullptr, common.state_topic_override) \
+  F(HaClimateConfig, CommandTopic, "mode_cmd_t", nullptr, command_topic_override)    \
+  F(HaClimateConfig, StringList, "modes", nullptr, modes)                            \
+  F(HaClimateConfig, Topic, "temp_cmd_t", nullptr, temperature_command_topic)        \
+  F(HaClimateConfig, Topic, "temp_stat_t", nullptr, temperature_state_topic)         \
+  F(HaClimateConfig, Topic, "curr_temp_t", nullptr, current_temperature_topic)       \
+  F(HaClimateConfig, Availability, nullptr, nullptr, common)                         \
+  F(HaClimateConfig, String, "temp_unit", nullptr, temperature_unit)                 \
+  F(HaClimateConfig, Temperature, "min_temp", "7", min_temp)                         \
+  F(HaClimateConfig, Temperature, "max_temp", "35", max_temp)                        \
+  F(HaClimateConfig, Float, "temp_step", "1", temp_step)                             \
+  F(HaClimateConfig, String, "icon", nullptr, common.icon)                           \
+  F(HaClimateConfig, String, "ent_cat", nullptr, common.entity_category)
+
+/** @} */
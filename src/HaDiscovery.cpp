@@ -1,18 +1,185 @@
 #include "HaDiscovery.h"
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <ArduinoJson.h>
+#include "HaComponentFields.h"
+#include "HaJsonWriter.h"
+#include "HaManifestStorage.h"
+#include <algorithm>
+
+// FNV-1a, used to compare payloads without storing them and to index topics.
+static const uint32_t kHashSeed = 2166136261u;
+
+static uint32_t hashBytes(uint32_t h, const char* s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<uint8_t>(s[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t hashString(const char* s) {
+  return hashBytes(kHashSeed, s, strlen(s));
+}
+
+static bool hashSink(void* ctx, const char* data, size_t len) {
+  uint32_t* h = static_cast<uint32_t*>(ctx);
+  *h = hashBytes(*h, data, len);
+  return true;
+}
+
+static const char kManifestMagic[4] = {'H', 'A', 'M', '1'};
 
-#if __has_include(<jblogger.h>)
-#include <jblogger.h>
-#define HAS_LOG
-#endif
+static size_t histogramBucket(const uint32_t* bounds, uint32_t value, bool inclusive) {
+  size_t i = 0;
+  while (i < HA_METRIC_BUCKETS - 1 && (inclusive ? value > bounds[i] : value >= bounds[i])) {
+    i++;
+  }
+  return i;
+}
+
+static MqttPriority messagePriority(HaMetricCategory category) {
+  switch (category) {
+    case HaMetricCategory::Availability:
+    case HaMetricCategory::Command:
+      return MqttPriority::High;
+    case HaMetricCategory::Config:
+      return MqttPriority::Low;
+    default:
+      return MqttPriority::Normal;
+  }
+}
+
+// Diagnostic sensors registered by enableMetricsSensors(), in the order of their values.
+struct MetricSensor {
+  const char* object_id;
+  const char* name;
+  const char* unit;
+  const char* device_class;
+  const char* state_class;
+};
+static const MetricSensor kMetricSensors[] = {
+  { "ha_messages", "MQTT messages", nullptr, nullptr, "total_increasing" },
+  { "ha_bytes", "MQTT bytes", "B", "data_size", "total_increasing" },
+  { "ha_failures", "MQTT publish failures", nullptr, nullptr, "total_increasing" },
+  { "ha_publish_time", "MQTT publish time", "µs", "duration", "measurement" },
+  { "ha_largest_config", "Largest discovery config", "B", "data_size", "measurement" },
+};
+
+static bool parseNumber(const char* s, float& out) {
+  char* end = nullptr;
+  double v = strtod(s, &end);
+  if (end == s || *end != '\0') {
+    return false;
+  }
+  out = static_cast<float>(v);
+  return true;
+}
 
 static const char* kAvailOnline = "online";
 static const char* kAvailOffline = "offline";
 static const char* kOn = "ON";
 static const char* kOff = "OFF";
 static const char* kPress = "PRESS";
+static const char* kOriginName = "JBHaMqttDiscovery";
+static const char* kOriginVersion = "1.0.0";
+static const char* kOriginUrl = "https://github.com/jonnybergdahl/Arduino_JBHaMqttDiscovery";
+
+// Component descriptors, expanded from the field lists in HaComponentFields.h.
+// Every config struct starts with HaEntityCommon, so common fields share their offsets.
+using ha_fields::FieldType;
+
+struct FieldSpec {
+  const char* key;
+  const char* def;
+  FieldType type;
+  uint8_t offset;
+};
+
+struct ComponentSpec {
+  const char* name;
+  const FieldSpec* fields;
+  uint8_t count;
+};
+
+#define HA_FIELD_SPEC(cfg, type, key, def, member) \
+  { key, def, FieldType::type, static_cast<uint8_t>(offsetof(cfg, member)) },
+
+static const FieldSpec kSensorFields[] = { HA_SENSOR_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kSwitchFields[] = { HA_SWITCH_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kBinarySensorFields[] = { HA_BINARY_SENSOR_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kButtonFields[] = { HA_BUTTON_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kNumberFields[] = { HA_NUMBER_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kSelectFields[] = { HA_SELECT_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kLightFields[] = { HA_LIGHT_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kCoverFields[] = { HA_COVER_FIELDS(HA_FIELD_SPEC) };
+static const FieldSpec kClimateFields[] = { HA_CLIMATE_FIELDS(HA_FIELD_SPEC) };
+
+#undef HA_FIELD_SPEC
+
+#define HA_COMPONENT(name, fields) { name, fields, sizeof(fields) / sizeof(fields[0]) }
+
+// Indexed by HaComponent.
+static const ComponentSpec kComponents[] = {
+  HA_COMPONENT("sensor", kSensorFields),
+  HA_COMPONENT("switch", kSwitchFields),
+  HA_COMPONENT("binary_sensor", kBinarySensorFields),
+  HA_COMPONENT("button", kButtonFields),
+  HA_COMPONENT("number", kNumberFields),
+  HA_COMPONENT("select", kSelectFields),
+  HA_COMPONENT("light", kLightFields),
+  HA_COMPONENT("cover", kCoverFields),
+  HA_COMPONENT("climate", kClimateFields),
+};
+
+#undef HA_COMPONENT
+
+static const size_t kComponentCount = sizeof(kComponents) / sizeof(kComponents[0]);
+static_assert(kComponentCount == static_cast<size_t>(HaComponent::Climate) + 1, "one descriptor per HaComponent");
+static_assert(offsetof(HaSensorConfig, common) == 0 && offsetof(HaSwitchConfig, common) == 0 &&
+              offsetof(HaBinarySensorConfig, common) == 0 && offsetof(HaButtonConfig, common) == 0 &&
+              offsetof(HaNumberConfig, common) == 0 && offsetof(HaSelectConfig, common) == 0 &&
+              offsetof(HaLightConfig, common) == 0 && offsetof(HaCoverConfig, common) == 0 &&
+              offsetof(HaClimateConfig, common) == 0,
+              "configs start with HaEntityCommon");
+static_assert(sizeof(HaClimateConfig) <= 256, "field offsets fit in uint8_t");
+
+static const ComponentSpec& componentSpec(HaComponent component) {
+  size_t i = static_cast<size_t>(component);
+  return kComponents[i < kComponentCount ? i : 0];
+}
+
+static const FieldSpec* findField(const ComponentSpec& spec, FieldType type) {
+  for (uint8_t i = 0; i < spec.count; i++) {
+    if (spec.fields[i].type == type) {
+      return &spec.fields[i];
+    }
+  }
+  return nullptr;
+}
+
+static const char* stringField(const void* cfg, uint8_t offset) {
+  const char* p;
+  memcpy(&p, static_cast<const uint8_t*>(cfg) + offset, sizeof(p));
+  return p;
+}
+
+// Shortest decimal form with up to 3 decimals ("0.5", "100"), or "" if out of range.
+static void formatDecimal(char* out, size_t outLen, float value) {
+  size_t n = haFormatFloat(out, outLen, value, 3);
+  if (n == 0) {
+    return;
+  }
+  if (strchr(out, '.')) {
+    while (out[n - 1] == '0') {
+      out[--n] = '\0';
+    }
+    if (out[n - 1] == '.') {
+      out[--n] = '\0';
+    }
+  }
+}
 
 HaDiscovery::HaDiscovery(MqttTransport& transport,
                          const char* discovery_prefix,
@@ -21,9 +188,44 @@ HaDiscovery::HaDiscovery(MqttTransport& transport,
   : _transport(transport),
     _discoveryPrefix(discovery_prefix ? discovery_prefix : "homeassistant"),
     _baseTopicPrefix(base_topic_prefix ? base_topic_prefix : "devices"),
-    _log(new JBLogger("HaDiscovery", log_level)) {
+    _log(new JBLogger("HaDiscovery", log_level)),
+    _ownsLog(true),
+    _devices(1),
+    _millis(&mqttMillis) {
+  attachTransport();
+}
+
+HaDiscovery::HaDiscovery(MqttTransport& transport,
+                         JBLogger& logger,
+                         const char* discovery_prefix,
+                         const char* base_topic_prefix)
+  : _transport(transport),
+    _discoveryPrefix(discovery_prefix ? discovery_prefix : "homeassistant"),
+    _baseTopicPrefix(base_topic_prefix ? base_topic_prefix : "devices"),
+    _log(&logger),
+    _ownsLog(false),
+    _devices(1),
+    _millis(&mqttMillis) {
+  attachTransport();
+}
+
+HaDiscovery::~HaDiscovery() {
+  _transport.setOnConnect(nullptr, nullptr);
+  _transport.setOnMessage(nullptr, nullptr);
+  _transport.setLogger(nullptr);
+  if (_ownsLog) {
+    delete _log;
+  }
+}
+
+void HaDiscovery::attachTransport() {
+  static_assert(sizeof(kMetricSensors) / sizeof(kMetricSensors[0]) == sizeof(_metricsSensors) / sizeof(_metricsSensors[0]),
+                "one handle per metrics sensor");
+  static_assert(HA_CONFIG_SIZE_BOUNDS[5] == JSON_BUF - 1, "config size histogram splits at the stack buffer");
+  _metrics.config_buffer = JSON_BUF;
   _transport.setLogger(_log);
   _transport.setOnConnect(&HaDiscovery::onTransportConnectThunk, this);
+  _transport.setOnMessage(&HaDiscovery::onTransportMessageThunk, this);
 }
 
 void HaDiscovery::setLogLevel(LogLevel level) {
@@ -31,415 +233,2322 @@ void HaDiscovery::setLogLevel(LogLevel level) {
 }
 
 void HaDiscovery::setDevice(const HaDeviceInfo& dev) {
-  _device = dev;
+  applyDeviceInfo(0, dev);
 }
 
-void HaDiscovery::tick() {
-  _transport.tick();
+HaDeviceHandle HaDiscovery::addDevice(const HaDeviceInfo& dev) {
+  if (!dev.node_id) {
+    return HaDeviceHandle{};
+  }
+  HaDeviceHandle handle = deviceHandle(dev.node_id);
+  if (!handle.valid()) {
+    if (_devices.size() >= 0xFFFF) {
+      return HaDeviceHandle{};
+    }
+    if (_deviceLists && _devices.size() >= _deviceListCount) {
+      HA_LOGE(_log, "Entity table has no room for device %s (%u devices)", dev.node_id,
+              (unsigned)_deviceListCount);
+      return HaDeviceHandle{};
+    }
+    _devices.emplace_back();
+    handle = HaDeviceHandle(static_cast<uint16_t>(_devices.size() - 1));
+    bindDeviceList(handle.index);
+  }
+  applyDeviceInfo(handle.index, dev);
+  if (handle.index > 0 && _transport.connected()) {
+    publishAvailabilityOnline(handle);
+  }
+  return handle;
 }
 
-void HaDiscovery::onTransportConnectThunk(void* ctx) {
-  static_cast<HaDiscovery*>(ctx)->onTransportConnect();
+HaDeviceHandle HaDiscovery::deviceHandle(const char* node_id) const {
+  if (!node_id) {
+    return HaDeviceHandle{};
+  }
+  for (size_t i = 0; i < _devices.size(); i++) {
+    if (_devices[i].info.node_id && strcmp(_devices[i].info.node_id, node_id) == 0) {
+      return HaDeviceHandle(static_cast<uint16_t>(i));
+    }
+  }
+  return HaDeviceHandle{};
 }
 
-void HaDiscovery::onTransportConnect() {
-#ifdef HAS_LOG
-  _log->info("MQTT Transport connected");
-#endif
-  // Default behavior: publish availability online on connect.
-  // Optional enhancement: re-publish all registered discovery configs.
-  publishAvailabilityOnline(true, 1);
+size_t HaDiscovery::deviceCount() const {
+  return _devices.size();
 }
 
-void HaDiscovery::publishAvailabilityOnline(bool retained, uint8_t qos) {
-  std::string topic = buildDefaultAvailabilityTopic();
-  _transport.publish(topic.c_str(), reinterpret_cast<const uint8_t*>(kAvailOnline), strlen(kAvailOnline), retained, qos);
+void HaDiscovery::applyDeviceInfo(uint16_t index, const HaDeviceInfo& dev) {
+  Device& d = _devices[index];
+  d.info = dev;
+  if (d.info.node_id) {
+    d.availabilityTopic = buildDefaultAvailabilityTopic(d);
+  } else {
+    d.availabilityTopic.clear();
+  }
+  if (index == 0) {
+    // The broker publishes "offline" for us on a crash or power loss.
+    MqttWill will;
+    will.topic = d.availabilityTopic.empty() ? nullptr : d.availabilityTopic.c_str();
+    will.payload = kAvailOffline;
+    _transport.setWill(will);
+  }
+  for (uint16_t i : d.entities) {
+    if (_entities[i].active && !resolveTopics(_entities[i])) {
+      HA_LOGE(_log, "No topic space left for %s", _entities[i].common().object_id);
+    }
+  }
+  rebuildCommandIndex();
+  _transportReserved = false;
 }
 
-void HaDiscovery::publishAvailabilityOffline(bool retained, uint8_t qos) {
-  std::string topic = buildDefaultAvailabilityTopic();
-#ifdef HAS_LOG
-  _log->info("Publishing availability offline to %s", topic.c_str());
-#endif
-  _transport.publish(topic.c_str(), reinterpret_cast<const uint8_t*>(kAvailOffline), strlen(kAvailOffline), retained, qos);
+const HaDiscovery::Device* HaDiscovery::deviceFor(HaDeviceHandle device) const {
+  if (!device.valid() || device.index >= _devices.size()) {
+    return nullptr;
+  }
+  return &_devices[device.index];
 }
 
-bool HaDiscovery::publishSensorDiscovery(const HaSensorConfig& cfg, bool retained, uint8_t qos) {
-  if (!_device.node_id || !cfg.common.object_id) {
-    return false;
+bool HaDiscovery::isBridged(const Device& dev) const {
+  return &dev != &_devices[0] && _devices[0].info.node_id;
+}
+
+void HaDiscovery::markDirty(Device& dev) {
+  if (!dev.dirty) {
+    dev.dirty = true;
+    _dirtyDevices++;
+  }
+}
+
+void HaDiscovery::tick() {
+  _transport.tick();
+  if (_connectPending) {
+    _connectPending = false;
+    resumeAfterConnect();
   }
+  dispatchMessages();
+  serviceRepublish();
+  serviceMetricsSensors();
+}
 
-  std::string topic = buildConfigTopic("sensor", cfg.common.object_id);
+void HaDiscovery::setClock(uint32_t (*millis_fn)()) {
+  _millis = millis_fn ? millis_fn : &mqttMillis;
+}
 
-  char json[JSON_BUF];
-  if (!buildSensorConfigJson(json, sizeof(json), cfg)) {
-    return false;
+void HaDiscovery::setRepublishPace(size_t configs_per_tick) {
+  _republishPerTick = configs_per_tick ? configs_per_tick : 1;
+}
+
+void HaDiscovery::setRepublishBudget(uint32_t max_ms, size_t max_bytes) {
+  _republishMaxMs = max_ms;
+  _republishMaxBytes = max_bytes;
+}
+
+HaDiscoveryProgress HaDiscovery::discoveryProgress() const {
+  HaDiscoveryProgress p = _progress;
+  if (p.done > p.total) {
+    // Entities registered while the re-publish runs are picked up too.
+    p.total = p.done;
   }
+  return p;
+}
 
-  return publishConfigJson(topic.c_str(), json, retained, qos);
+void HaDiscovery::setOnDiscoveryComplete(void (*cb)(void*), void* ctx) {
+  _discoveryCompleteCb = cb;
+  _discoveryCompleteCtx = ctx;
 }
 
-bool HaDiscovery::publishSwitchDiscovery(const HaSwitchConfig& cfg, bool retained, uint8_t qos) {
-  if (!_device.node_id || !cfg.common.object_id) {
-    return false;
+void HaDiscovery::republishDiscovery() {
+  startRepublish(false, false);
+}
+
+void HaDiscovery::startRepublish(bool dirty_only, bool availability) {
+  if (!_transportReserved && _transport.connected()) {
+    // Measured again after registrations changed; publishConfigJson() still checks each config.
+    reserveTransportBuffer();
+  }
+  _republishDevice = 0;
+  _republishCursor = 0;
+  _republishChunk = 0;
+  _republishDeviceOpen = false;
+  _republishDirtyOnly = dirty_only;
+  _republishAvailability = availability;
+  _republishPending = !_entities.empty() || _devices.size() > 1 || _devices[0].chunkCount > 0 ||
+                      !_manifest.empty() || (availability && _devices[0].info.node_id);
+  for (ManifestEntry& m : _manifest) {
+    m.seen = false;
+  }
+
+  _progress = HaDiscoveryProgress();
+  _progress.active = _republishPending;
+  for (const Device& d : _devices) {
+    if (dirty_only && !d.dirty) {
+      continue;
+    }
+    if (_mode == HaDiscoveryMode::Device && !d.info.node_id) {
+      continue;
+    }
+    for (uint16_t i : d.entities) {
+      if (_entities[i].active) {
+        _progress.total++;
+      }
+    }
   }
+}
 
-  std::string topic = buildConfigTopic("switch", cfg.common.object_id);
+void HaDiscovery::setDiscoveryMode(HaDiscoveryMode mode) {
+  _mode = mode;
+}
 
-  char json[JSON_BUF];
-  if (!buildSwitchConfigJson(json, sizeof(json), cfg)) {
+HaDiscoveryMode HaDiscovery::discoveryMode() const {
+  return _mode;
+}
+
+void HaDiscovery::setConfigFormat(HaConfigFormat format) {
+  _format = format;
+}
+
+HaConfigFormat HaDiscovery::configFormat() const {
+  return _format;
+}
+
+void HaDiscovery::setDeviceChunkSize(size_t max_bytes) {
+  _deviceChunkSize = max_bytes;
+}
+
+bool HaDiscovery::publishDeviceDiscovery() {
+  if (_devices.size() == 1 && !_devices[0].info.node_id) {
     return false;
   }
+  republishDiscovery();
+  _republishBudgeted = false;
+  _republishTickBytes = _metrics.totalBytes();
+  return advanceDeviceDiscovery(SIZE_MAX);
+}
 
-  return publishConfigJson(topic.c_str(), json, retained, qos);
+bool HaDiscovery::isDiscoveryDelivered() const {
+  return !_republishPending && _dirtyDevices == 0 && _transport.pendingPublishes() == 0;
 }
 
-bool HaDiscovery::publishBinarySensorDiscovery(const HaBinarySensorConfig& cfg, bool retained, uint8_t qos) {
-  if (!_device.node_id || !cfg.common.object_id) {
-    return false;
+bool HaDiscovery::isRepublishing() const {
+  // A connect not yet handled by tick() starts one.
+  return _republishPending || _connectPending;
+}
+
+size_t HaDiscovery::entityCount() const {
+  size_t n = 0;
+  for (const Entity& e : _entities) {
+    if (e.active) {
+      n++;
+    }
   }
+  return n;
+}
 
-  std::string topic = buildConfigTopic("binary_sensor", cfg.common.object_id);
+size_t HaDiscovery::largestConfigMessage(size_t& topic_len, size_t& payload_len) const {
+  topic_len = 0;
+  payload_len = 0;
+  char topic[TOPIC_BUF];
+  auto consider = [&](size_t len) {
+    // Configs that do not fit the stack buffer are streamed and need room for the topic only.
+    size_t payload = len < JSON_BUF ? len : 0;
+    size_t t = strlen(topic);
+    if (t + payload > topic_len + payload_len) {
+      topic_len = t;
+      payload_len = payload;
+    }
+  };
+
+  if (_mode == HaDiscoveryMode::Device) {
+    for (const Device& d : _devices) {
+      if (!d.info.node_id) {
+        continue;
+      }
+      size_t chunk = 0;
+      for (size_t first = 0; first < d.entities.size(); chunk++) {
+        size_t last = nextDeviceChunk(d, first);
+        HaJsonWriter w(nullptr, 0);
+        writeDeviceConfig(w, d, first, last);
+        if (buildDeviceConfigTopic(topic, sizeof(topic), d, chunk)) {
+          consider(w.length());
+        }
+        first = last;
+      }
+    }
+    return topic_len + payload_len;
+  }
 
-  char json[JSON_BUF];
-  if (!buildBinarySensorConfigJson(json, sizeof(json), cfg)) {
+  for (const Entity& e : _entities) {
+    if (!e.active) {
+      continue;
+    }
+    const Device& dev = _devices[e.device];
+    if (!buildConfigTopic(topic, sizeof(topic), componentName(e.component), dev.info.node_id,
+                          e.common().object_id)) {
+      continue;
+    }
+    HaJsonWriter w(nullptr, 0);
+    w.beginObject();
+    writeEntityConfig(w, e, false);
+    writeDevice(w, dev);
+    w.endObject();
+    consider(w.length());
+  }
+  return topic_len + payload_len;
+}
+
+bool HaDiscovery::reserveTransportBuffer() {
+  size_t topic_len = 0;
+  size_t payload_len = 0;
+  if (!largestConfigMessage(topic_len, payload_len)) {
+    return true;
+  }
+  if (!_transport.reservePublishSize(topic_len, payload_len)) {
+    HA_LOGE(_log, "Transport cannot send the largest discovery config (%u-byte topic, %u-byte payload)",
+            (unsigned)topic_len, (unsigned)payload_len);
     return false;
   }
+  _transportReserved = true;
+  return true;
+}
 
-  return publishConfigJson(topic.c_str(), json, retained, qos);
+void HaDiscovery::onTransportConnectThunk(void* ctx) {
+  static_cast<HaDiscovery*>(ctx)->onTransportConnect();
 }
 
-bool HaDiscovery::publishButtonDiscovery(const HaButtonConfig& cfg, bool retained, uint8_t qos) {
-  if (!_device.node_id || !cfg.common.object_id) {
-    return false;
+void HaDiscovery::onTransportConnect() {
+  // Runs on the client's task for async transports; the registry is only touched from tick().
+  _connectPending = true;
+}
+
+void HaDiscovery::resumeAfterConnect() {
+  HA_LOGI(_log, "MQTT Transport connected");
+  // Replay registered discovery configs from tick(); availability follows once they are in place.
+  for (Entity& e : _entities) {
+    // Non-retained states published before the reconnect may be gone; send the next one regardless.
+    e.hasLast = false;
+  }
+  for (Device& d : _devices) {
+    d.commandWildcardSubscribed = false;
   }
+  subscribeCommands();
+  // Each added device goes online after its own configs and the gateway after all of them, so
+  // Home Assistant never sees an available entity without its config.
+  startRepublish(false, true);
+}
 
-  std::string topic = buildConfigTopic("button", cfg.common.object_id);
+bool HaDiscovery::republishAvailabilityDue() const {
+  return _republishAvailability && _republishDevice > 0 && _devices[_republishDevice].info.node_id;
+}
 
-  char json[JSON_BUF];
-  if (!buildButtonConfigJson(json, sizeof(json), cfg)) {
+bool HaDiscovery::republishBudgetLeft(size_t published, size_t max_messages) const {
+  if (published >= max_messages) {
+    return false;
+  }
+  if (published == 0 || !_republishBudgeted) {
+    return true;
+  }
+  if (_republishMaxMs && _millis() - _republishTickMs >= _republishMaxMs) {
     return false;
   }
+  return !_republishMaxBytes || _metrics.totalBytes() - _republishTickBytes < _republishMaxBytes;
+}
 
-  return publishConfigJson(topic.c_str(), json, retained, qos);
+void HaDiscovery::nextRepublishDevice() {
+  _republishDevice++;
+  _republishCursor = 0;
+  _republishChunk = 0;
+  _republishDeviceOpen = false;
 }
 
-bool HaDiscovery::removeEntity(const char* component, const char* object_id, uint8_t qos) {
-  if (!_device.node_id || !component || !object_id) {
-    return false;
+void HaDiscovery::serviceRepublish() {
+  if (_dirtyDevices && !_republishPending && _transport.connected()) {
+    startRepublish(true, false);
+  }
+  if (!_republishPending) {
+    return;
+  }
+  if (!_transport.connected()) {
+    // Connection dropped mid-replay; the next connect restarts it from the beginning.
+    _republishPending = false;
+    _progress.active = false;
+    return;
   }
 
-  std::string topic = buildConfigTopic(component, object_id);
+  // With an ack-tracking transport, keep its in-flight window full instead of using the fixed pace.
+  size_t budget = _transport.publishWindow();
+  if (budget == SIZE_MAX) {
+    budget = _republishPerTick;
+  }
+  _republishBudgeted = true;
+  _republishTickMs = _millis();
+  _republishTickBytes = _metrics.totalBytes();
+  _progress.ticks++;
+
+  if (_mode == HaDiscoveryMode::Device) {
+    advanceDeviceDiscovery(budget);
+    return;
+  }
 
-  // Empty retained config payload removes entity in Home Assistant
-  return _transport.publish(topic.c_str(), nullptr, 0, true, qos);
+  // Devices are replayed one after the other: the configs of its entities, then availability.
+  size_t published = 0;
+  while (_republishDevice < _devices.size()) {
+    const Device& d = _devices[_republishDevice];
+    if (_republishCursor < d.entities.size()) {
+      if (!republishBudgetLeft(published, budget)) {
+        break;
+      }
+      const Entity& e = _entities[d.entities[_republishCursor++]];
+      if (e.active) {
+        publishEntity(e);
+        published++;
+        _progress.done++;
+      }
+      continue;
+    }
+    if (republishAvailabilityDue()) {
+      if (!republishBudgetLeft(published, budget)) {
+        break;
+      }
+      publishAvailabilityOnline(HaDeviceHandle(static_cast<uint16_t>(_republishDevice)));
+      published++;
+    }
+    nextRepublishDevice();
+  }
+
+  if (_republishDevice >= _devices.size()) {
+    finishRepublish(published, budget);
+  }
+  _progress.bytes += _metrics.totalBytes() - _republishTickBytes;
 }
 
-bool HaDiscovery::publishState(const char* object_id, const char* payload, bool retained, uint8_t qos) {
-  if (!_device.node_id || !object_id || !payload) {
+bool HaDiscovery::finishRepublish(size_t& published, size_t max_messages) {
+  bool availability = _republishAvailability && _devices[0].info.node_id;
+  if (availability && !republishBudgetLeft(published, max_messages)) {
     return false;
   }
+  if (_mode == HaDiscoveryMode::Entity) {
+    HA_LOGI(_log, "Re-published %u discovery configs in %u ticks", (unsigned)_progress.done,
+            (unsigned)_progress.ticks);
+    if (_manifestStorage) {
+      removeStaleEntities();
+      saveManifest();
+      // Later replays follow a reconnect, possibly to a broker that lost its retained configs.
+      _manifestSkip = false;
+    }
+  }
+  if (availability) {
+    publishAvailabilityOnline(true, 1);
+    published++;
+  }
+  _republishPending = false;
+  _progress.active = false;
+  if (_discoveryCompleteCb) {
+    _discoveryCompleteCb(_discoveryCompleteCtx);
+  }
+  return true;
+}
 
-  std::string topic = buildDefaultStateTopic(object_id);
+bool HaDiscovery::advanceDeviceDiscovery(size_t max_messages) {
+  bool ok = true;
+  size_t published = 0;
+  while (_republishDevice < _devices.size()) {
+    Device& d = _devices[_republishDevice];
+    if (!_republishDeviceOpen) {
+      if (!d.info.node_id || (_republishDirtyOnly && !d.dirty)) {
+        nextRepublishDevice();
+        continue;
+      }
+      if (!republishBudgetLeft(published, max_messages)) {
+        break;
+      }
+      _republishDeviceOpen = true;
+      if (d.dirty) {
+        // Changes made while this device is being published mark it dirty again.
+        d.dirty = false;
+        _dirtyDevices--;
+      }
+    }
+    if (_republishCursor < d.entities.size()) {
+      if (!republishBudgetLeft(published, max_messages)) {
+        break;
+      }
+      size_t end = nextDeviceChunk(d, _republishCursor);
+      ok = publishDeviceChunk(d, _republishCursor, end, _republishChunk++) && ok;
+      published++;
+      for (size_t i = _republishCursor; i < end; i++) {
+        if (_entities[d.entities[i]].active) {
+          _progress.done++;
+        }
+      }
+      _republishCursor = end;
+      continue;
+    }
+    finishDeviceDiscovery(d);
+    if (republishAvailabilityDue()) {
+      publishAvailabilityOnline(HaDeviceHandle(static_cast<uint16_t>(_republishDevice)));
+      published++;
+    }
+    nextRepublishDevice();
+  }
 
-#ifdef HAS_LOG
-  _log->debug("Publishing state to %s: %s", topic.c_str(), payload);
-#endif
-  bool ok = _transport.publish(topic.c_str(),
-                      reinterpret_cast<const uint8_t*>(payload),
-                      strlen(payload),
-                      retained,
-                      qos);
-#ifdef HAS_LOG
-  if (!ok) {
-    _log->error("Failed to publish state to %s", topic.c_str());
+  if (_republishDevice >= _devices.size()) {
+    finishRepublish(published, max_messages);
   }
-#endif
+  _progress.bytes += _metrics.totalBytes() - _republishTickBytes;
   return ok;
 }
 
-bool HaDiscovery::publishStateSwitch(const char* object_id, bool on, bool retained, uint8_t qos) {
-  return publishState(object_id, on ? kOn : kOff, retained, qos);
+void HaDiscovery::finishDeviceDiscovery(Device& dev) {
+  // Clear chunks left over from a previous, larger layout.
+  char topic[TOPIC_BUF];
+  for (size_t chunk = _republishChunk; chunk < dev.chunkCount; chunk++) {
+    if (buildDeviceConfigTopic(topic, sizeof(topic), dev, chunk)) {
+      sendMessage(HaMetricCategory::Config, topic, nullptr, 0, true, 1);
+    }
+  }
+  dev.chunkCount = _republishChunk;
+
+  // Entities removed through this config are gone for good.
+  size_t kept = 0;
+  for (uint16_t i : dev.entities) {
+    Entity& e = _entities[i];
+    if (e.active || e.removePending) {
+      dev.entities[kept++] = i;
+    } else {
+      dropTopics(e);
+      _freeEntities.push_back(i);
+    }
+  }
+  dev.entities.truncate(kept);
+  HA_LOGI(_log, "Published device discovery config of %s for %u entities in %u message(s)",
+          dev.info.node_id, (unsigned)kept, (unsigned)dev.chunkCount);
 }
 
-std::string HaDiscovery::buildConfigTopic(const char* component, const char* object_id) const {
-  // homeassistant/<component>/<node_id>/<object_id>/config
-  return _discoveryPrefix + "/" + component + "/" + _device.node_id + "/" + object_id + "/config";
+const HaEntityCommon& HaDiscovery::Entity::common() const {
+  // Every union member starts with HaEntityCommon (their common initial sequence).
+  return cfg.sensor.common;
 }
 
-std::string HaDiscovery::buildDefaultStateTopic(const char* object_id) const {
-  // <base>/<node_id>/<object_id>/state
-  return _baseTopicPrefix + "/" + _device.node_id + "/" + object_id + "/state";
+const char* HaDiscovery::componentName(HaComponent component) {
+  return componentSpec(component).name;
 }
 
-std::string HaDiscovery::buildDefaultCommandTopic(const char* object_id) const {
-  // <base>/<node_id>/<object_id>/set
-  return _baseTopicPrefix + "/" + _device.node_id + "/" + object_id + "/set";
+bool HaDiscovery::componentFromName(const char* name, HaComponent& out) {
+  for (size_t c = 0; c < kComponentCount; c++) {
+    if (strcmp(kComponents[c].name, name) == 0) {
+      out = static_cast<HaComponent>(c);
+      return true;
+    }
+  }
+  return false;
 }
 
-std::string HaDiscovery::buildDefaultAvailabilityTopic() const {
-  // <base>/<node_id>/status
-  return _baseTopicPrefix + "/" + _device.node_id + "/status";
+uint32_t HaDiscovery::entityKey(uint16_t device, const char* object_id) {
+  uint8_t d[2] = { static_cast<uint8_t>(device & 0xFF), static_cast<uint8_t>(device >> 8) };
+  return hashBytes(hashBytes(kHashSeed, reinterpret_cast<const char*>(d), 2), object_id, strlen(object_id));
 }
 
-bool HaDiscovery::publishConfigJson(const char* topic, const char* json, bool retained, uint8_t qos) {
-#ifdef HAS_LOG
-  _log->debug("Publishing discovery config to %s", topic);
-#endif
-  bool ok = _transport.publish(topic,
-                      reinterpret_cast<const uint8_t*>(json),
-                      strlen(json),
-                      retained,
-                      qos);
-#ifdef HAS_LOG
-  if (!ok) {
-    _log->error("Failed to publish discovery config to %s", topic);
+HaEntityHandle HaDiscovery::findEntity(uint16_t device, const char* object_id, const HaComponent* component) const {
+  if (_entityIndex.empty()) {
+    return HaEntityHandle{};
   }
-#endif
-  return ok;
+  size_t mask = _entityIndex.size() - 1;
+  uint32_t hash = entityKey(device, object_id);
+  for (size_t slot = hash & mask; _entityIndex[slot]; slot = (slot + 1) & mask) {
+    const Entity& e = _entities[_entityIndex[slot] - 1];
+    if (e.idHash == hash && e.device == device && (e.active || e.removePending) &&
+        (!component || e.component == *component) && strcmp(e.common().object_id, object_id) == 0) {
+      return HaEntityHandle(static_cast<uint16_t>(_entityIndex[slot] - 1));
+    }
+  }
+  return HaEntityHandle{};
 }
 
-bool HaDiscovery::buildSensorConfigJson(char* out, size_t outLen, const HaSensorConfig& cfg) const {
-  if (!out || outLen == 0) {
-    return false;
+void HaDiscovery::indexEntity(uint16_t index) {
+  // Power-of-two table at most half full keeps probe sequences short.
+  if ((_entityIndexUsed + 1) * 2 > _entityIndex.size()) {
+    rebuildEntityIndex();
   }
+  size_t mask = _entityIndex.size() - 1;
+  size_t slot = _entities[index].idHash & mask;
+  while (_entityIndex[slot]) {
+    slot = (slot + 1) & mask;
+  }
+  _entityIndex[slot] = static_cast<uint16_t>(index + 1);
+  _entityIndexUsed++;
+}
 
-  // Topics
-  std::string stateTopic = cfg.common.state_topic_override
-    ? cfg.common.state_topic_override
-    : buildDefaultStateTopic(cfg.common.object_id);
-
-  std::string availTopic = cfg.common.availability_topic_override
-    ? cfg.common.availability_topic_override
-    : buildDefaultAvailabilityTopic();
-
-  JsonDocument doc;
-  doc["name"] = cfg.common.name ? cfg.common.name : cfg.common.object_id;
-  std::string uniq = std::string(_device.node_id) + "_" + cfg.common.object_id;
-  doc["uniq_id"] = uniq;
-
-  doc["stat_t"] = stateTopic;
-  doc["avty_t"] = availTopic;
-  doc["pl_avail"] = kAvailOnline;
-  doc["pl_not_avail"] = kAvailOffline;
-
-  if (cfg.common.icon) {
-    doc["icon"] = cfg.common.icon;
+void HaDiscovery::rebuildEntityIndex() {
+  // Room for four times the live entities, so a rebuild is followed by many cheap inserts.
+  size_t live = 0;
+  for (const Entity& e : _entities) {
+    if (e.active || e.removePending) {
+      live++;
+    }
   }
-  if (cfg.unit_of_measurement) {
-    doc["unit_of_meas"] = cfg.unit_of_measurement;
+  size_t size = 8;
+  while (size < (live + 1) * 4) {
+    size <<= 1;
   }
-  if (cfg.device_class) {
-    doc["dev_cla"] = cfg.device_class;
+  if (_entityIndex.fixed()) {
+    size = _entityIndex.capacity();  // sized by HaEntityTable for a full table
   }
-  if (cfg.state_class) {
-    doc["stat_cla"] = cfg.state_class;
+  _entityIndex.assign(size, 0);
+  _entityIndexUsed = 0;
+  for (size_t i = 0; i < _entities.size(); i++) {
+    const Entity& e = _entities[i];
+    if (!e.active && !e.removePending) {
+      continue;
+    }
+    size_t slot = e.idHash & (size - 1);
+    while (_entityIndex[slot]) {
+      slot = (slot + 1) & (size - 1);
+    }
+    _entityIndex[slot] = static_cast<uint16_t>(i + 1);
+    _entityIndexUsed++;
   }
+}
 
-  // Device object
-  JsonObject dev = doc["dev"].to<JsonObject>();
-  JsonArray ids = dev["ids"].to<JsonArray>();
-  ids.add(_device.identifiers ? _device.identifiers : _device.node_id);
-  if (_device.name) {
-    dev["name"] = _device.name;
+void HaDiscovery::releaseEntity(uint16_t index) {
+  uint16_t device = _entities[index].device;
+  HaSlotVector<uint16_t>& list = _devices[device].entities;
+  uint16_t* it = std::find(list.begin(), list.end(), index);
+  if (it != list.end()) {
+    size_t pos = static_cast<size_t>(it - list.begin());
+    list.erase(it);
+    if (_republishPending && _republishDevice == device && pos < _republishCursor) {
+      _republishCursor--;  // keep the paced re-publish on the same next entity
+    }
   }
-  if (_device.manufacturer) {
-    dev["mf"] = _device.manufacturer;
-  }
-  if (_device.model) {
-    dev["mdl"] = _device.model;
+  dropTopics(_entities[index]);
+  _freeEntities.push_back(index);
+}
+
+void HaDiscovery::discardEntity(uint16_t index) {
+  Entity& e = _entities[index];
+  e.active = false;
+  e.removePending = false;
+  if (e.filtered) {
+    e.filtered = false;
+    _filteredCount--;
   }
-  if (_device.sw_version) {
-    dev["sw"] = _device.sw_version;
+  if (e.commandHandler) {
+    e.commandHandler = nullptr;
+    rebuildCommandIndex();
   }
+  releaseEntity(index);
+}
 
-  size_t n = serializeJson(doc, out, outLen);
-  if (n == 0 || n >= outLen) {
+bool HaDiscovery::useEntityStorage(const EntityStorage& storage) {
+  if (!_entities.empty()) {
+    HA_LOGE(_log, "Entity table must be set before registering entities");
     return false;
   }
+  if (_devices.size() > storage.devices) {
+    HA_LOGE(_log, "Entity table holds %u devices, %u exist", (unsigned)storage.devices, (unsigned)_devices.size());
+    return false;
+  }
+  _entities.setBuffer(storage.entities, storage.capacity);
+  _freeEntities.setBuffer(storage.freeList, storage.capacity);
+  _entityIndex.setBuffer(storage.index, storage.indexSize);
+  _entityIndexUsed = 0;
+  _commandIndex.setBuffer(storage.commandIndex, storage.indexSize);
+  _commandIndexUsed = 0;
+  _topics.setBuffer(storage.topics, storage.topicBytes);
+  _topicGarbage = 0;
+  _deviceLists = storage.deviceLists;
+  _deviceListCount = storage.devices;
+  _deviceListCapacity = storage.capacity;
+  for (size_t i = 0; i < _devices.size(); i++) {
+    bindDeviceList(static_cast<uint16_t>(i));
+  }
   return true;
 }
 
-bool HaDiscovery::buildSwitchConfigJson(char* out, size_t outLen, const HaSwitchConfig& cfg) const {
-  if (!out || outLen == 0) {
+bool HaDiscovery::bindDeviceList(uint16_t index) {
+  if (!_deviceLists || index >= _deviceListCount) {
     return false;
   }
+  _devices[index].entities.setBuffer(_deviceLists + index * _deviceListCapacity, _deviceListCapacity);
+  return true;
+}
 
-  // Topics
-  std::string stateTopic = cfg.common.state_topic_override
-    ? cfg.common.state_topic_override
-    : buildDefaultStateTopic(cfg.common.object_id);
-
-  std::string cmdTopic = cfg.command_topic_override
-    ? cfg.command_topic_override
-    : buildDefaultCommandTopic(cfg.common.object_id);
+HaDiscovery::Entity* HaDiscovery::registerEntity(HaComponent component, HaDeviceHandle device, const char* object_id,
+                                                 bool retained, uint8_t qos) {
+  const Device* d = deviceFor(device);
+  if (!d || !d->info.node_id || !object_id) {
+    return nullptr;
+  }
 
-  std::string availTopic = cfg.common.availability_topic_override
-    ? cfg.common.availability_topic_override
-    : buildDefaultAvailabilityTopic();
+  Entity* slot = nullptr;
+  HaEntityHandle existing = findEntity(device.index, object_id, &component);
+  if (existing.valid()) {
+    slot = &_entities[existing.index];
+  } else {
+    uint16_t index;
+    if (!_freeEntities.empty()) {
+      index = _freeEntities.back();
+      _freeEntities.pop_back();
+    } else {
+      if (_entities.size() >= 0xFFFF) {
+        return nullptr;
+      }
+      if (!_entities.push_back(Entity())) {
+        HA_LOGE(_log, "Entity table full (%u entities), %s not registered", (unsigned)_entities.capacity(),
+                object_id);
+        return nullptr;
+      }
+      _freeEntities.reserve(_entities.capacity());  // removing an entity later never allocates
+      index = static_cast<uint16_t>(_entities.size() - 1);
+    }
+    slot = &_entities[index];
+    slot->device = device.index;
+    slot->idHash = entityKey(device.index, object_id);
+    _devices[device.index].entities.push_back(index);
+    indexEntity(index);
+  }
 
-  const char* pOn = cfg.payload_on ? cfg.payload_on : kOn;
-  const char* pOff = cfg.payload_off ? cfg.payload_off : kOff;
+  slot->component = component;
+  slot->active = true;
+  slot->removePending = false;
+  slot->fixedJson = nullptr;
+  slot->hasLast = false;
+  slot->retained = retained;
+  slot->qos = qos;
+  return slot;
+}
 
-  JsonDocument doc;
-  doc["name"] = cfg.common.name ? cfg.common.name : cfg.common.object_id;
-  std::string uniq = std::string(_device.node_id) + "_" + cfg.common.object_id;
-  doc["uniq_id"] = uniq;
-  doc["stat_t"] = stateTopic;
-  doc["cmd_t"] = cmdTopic;
-  doc["pl_on"] = pOn;
-  doc["pl_off"] = pOff;
-  doc["avty_t"] = availTopic;
-  doc["pl_avail"] = kAvailOnline;
-  doc["pl_not_avail"] = kAvailOffline;
-  if (cfg.common.icon) {
-    doc["icon"] = cfg.common.icon;
+bool HaDiscovery::resolveTopics(Entity& entity) {
+  if (storeTopics(entity)) {
+    // On the heap the pool may grow, so only rewrite it once it is mostly garbage.
+    if (!_topics.fixed() && _topicGarbage > 256 && _topicGarbage > _topics.size() / 2) {
+      compactTopics(nullptr);
+    }
+    return true;
   }
+  dropTopics(entity);
+  return compactTopics(&entity);
+}
 
-  JsonObject dev = doc["dev"].to<JsonObject>();
-  JsonArray ids = dev["ids"].to<JsonArray>();
-  ids.add(_device.identifiers ? _device.identifiers : _device.node_id);
-  if (_device.name) {
-    dev["name"] = _device.name;
+bool HaDiscovery::storeTopic(const char* topic, uint32_t& offset) {
+  size_t len = topic ? strlen(topic) : 0;
+  if (offset != NO_TOPIC) {
+    char* old = &_topics[offset];
+    size_t old_len = strlen(old);
+    if (len && len <= old_len) {
+      // The same or a shorter topic (re-registration) is rewritten in place.
+      memcpy(old, topic, len + 1);
+      _topicGarbage += old_len - len;
+      return true;
+    }
+    _topicGarbage += old_len + 1;
+    offset = NO_TOPIC;
   }
-  if (_device.manufacturer) {
-    dev["mf"] = _device.manufacturer;
+  if (!len) {
+    return true;
   }
-  if (_device.model) {
-    dev["mdl"] = _device.model;
-  }
-  if (_device.sw_version) {
-    dev["sw"] = _device.sw_version;
+  size_t start = _topics.size();
+  for (const char* p = topic;; p++) {
+    if (!_topics.push_back(*p)) {
+      _topics.truncate(start);
+      return false;
+    }
+    if (!*p) {
+      break;
+    }
   }
+  offset = static_cast<uint32_t>(start);
+  return true;
+}
 
-  size_t n = serializeJson(doc, out, outLen);
-  if (n == 0 || n >= outLen) {
-    return false;
+bool HaDiscovery::storeTopics(Entity& entity) {
+  const Device& dev = _devices[entity.device];
+  const HaEntityCommon& c = entity.common();
+  const ComponentSpec& spec = componentSpec(entity.component);
+  const FieldSpec* state = findField(spec, FieldType::StateTopic);
+  const FieldSpec* command = findField(spec, FieldType::CommandTopic);
+
+  char topic[TOPIC_BUF];
+  if (!state) {
+    storeTopic(nullptr, entity.stateTopic);
+  } else {
+    const char* override_topic = stringField(&entity.cfg, state->offset);
+    if (!override_topic && !buildDefaultTopic(topic, sizeof(topic), dev, c.object_id, "state")) {
+      return false;
+    }
+    if (!storeTopic(override_topic ? override_topic : topic, entity.stateTopic)) {
+      return false;
+    }
+  }
+  if (!command) {
+    storeTopic(nullptr, entity.commandTopic);
+  } else {
+    const char* override_topic = stringField(&entity.cfg, command->offset);
+    if (!override_topic && !buildDefaultTopic(topic, sizeof(topic), dev, c.object_id, "set")) {
+      return false;
+    }
+    if (!storeTopic(override_topic ? override_topic : topic, entity.commandTopic)) {
+      return false;
+    }
   }
   return true;
 }
 
-bool HaDiscovery::buildButtonConfigJson(char* out, size_t outLen, const HaButtonConfig& cfg) const {
-  if (!out || outLen == 0) {
-    return false;
+void HaDiscovery::dropTopics(Entity& entity) {
+  if (entity.stateTopic != NO_TOPIC) {
+    _topicGarbage += strlen(topicAt(entity.stateTopic)) + 1;
+    entity.stateTopic = NO_TOPIC;
   }
+  if (entity.commandTopic != NO_TOPIC) {
+    _topicGarbage += strlen(topicAt(entity.commandTopic)) + 1;
+    entity.commandTopic = NO_TOPIC;
+  }
+}
 
-  // command topic
-  std::string cmdTopic = cfg.command_topic_override
-    ? cfg.command_topic_override
-    : buildDefaultCommandTopic(cfg.common.object_id);
+bool HaDiscovery::compactTopics(const Entity* last) {
+  // Topics are rebuilt from the configs, so the pool can be rewritten from scratch. `last` goes
+  // in after the others: if the pool is too small, only that entity is left without topics.
+  _topics.clear();
+  _topicGarbage = 0;
+  bool ok = true;
+  for (Entity& e : _entities) {
+    e.stateTopic = NO_TOPIC;
+    e.commandTopic = NO_TOPIC;
+    if (&e != last && (e.active || e.removePending) && !storeTopics(e)) {
+      dropTopics(e);
+      ok = false;
+    }
+  }
+  if (last) {
+    Entity& e = _entities[handleOf(*last).index];
+    if (!storeTopics(e)) {
+      dropTopics(e);
+      ok = false;
+    }
+  }
+  return ok;
+}
 
-  // availability topic
-  std::string availTopic = cfg.common.availability_topic_override
-    ? cfg.common.availability_topic_override
-    : buildDefaultAvailabilityTopic();
+const HaDiscovery::Entity* HaDiscovery::entityFor(HaEntityHandle handle) const {
+  if (!handle.valid() || handle.index >= _entities.size() || !_entities[handle.index].active) {
+    return nullptr;
+  }
+  return &_entities[handle.index];
+}
 
-  const char* pPress = cfg.payload_press ? cfg.payload_press : kPress;
+HaEntityHandle HaDiscovery::entityHandle(const char* object_id) const {
+  return entityHandle(primaryDevice(), object_id);
+}
 
-  JsonDocument doc;
-  doc["name"] = cfg.common.name ? cfg.common.name : cfg.common.object_id;
-  std::string uniq = std::string(_device.node_id) + "_" + cfg.common.object_id;
-  doc["uniq_id"] = uniq;
-  doc["cmd_t"] = cmdTopic;
-  doc["pl_prs"] = pPress;
-  doc["avty_t"] = availTopic;
-  doc["pl_avail"] = kAvailOnline;
-  doc["pl_not_avail"] = kAvailOffline;
-  if (cfg.common.icon) {
-    doc["icon"] = cfg.common.icon;
+HaEntityHandle HaDiscovery::entityHandle(HaDeviceHandle device, const char* object_id) const {
+  if (!deviceFor(device) || !object_id) {
+    return HaEntityHandle{};
   }
+  HaEntityHandle handle = findEntity(device.index, object_id, nullptr);
+  return entityFor(handle) ? handle : HaEntityHandle{};
+}
+
+const char* HaDiscovery::stateTopic(HaEntityHandle handle) const {
+  const Entity* e = entityFor(handle);
+  return (e && e->stateTopic != NO_TOPIC) ? topicAt(e->stateTopic) : nullptr;
+}
 
-  JsonObject dev = doc["dev"].to<JsonObject>();
-  JsonArray ids = dev["ids"].to<JsonArray>();
-  ids.add(_device.identifiers ? _device.identifiers : _device.node_id);
-  if (_device.name) {
-    dev["name"] = _device.name;
+const char* HaDiscovery::commandTopic(HaEntityHandle handle) const {
+  const Entity* e = entityFor(handle);
+  return (e && e->commandTopic != NO_TOPIC) ? topicAt(e->commandTopic) : nullptr;
+}
+
+bool HaDiscovery::publishEntity(const Entity& entity) {
+  const Device& dev = _devices[entity.device];
+  const char* object_id = entity.common().object_id;
+  char topic[TOPIC_BUF];
+  if (!buildConfigTopic(topic, sizeof(topic), componentName(entity.component), dev.info.node_id, object_id)) {
+    return false;
+  }
+  auto write = [&](HaJsonWriter& w) {
+    w.beginObject();
+    writeEntityConfig(w, entity, false);
+    writeDevice(w, dev);
+    w.endObject();
+  };
+
+  uint32_t hash = 0;
+  const char* node = manifestNode(entity.device);
+  ManifestEntry* m = nullptr;
+  if (_manifestStorage && loadManifest()) {
+    hash = hashJson(write);
+    m = manifestFind(entity.component, node, object_id);
+    if (m) {
+      // Still registered: never removed as stale, even if the new config fails to publish below.
+      m->seen = true;
+      if (_manifestSkip && entity.retained && m->hash == hash) {
+        // Published with the same content before this boot; the broker still holds it retained.
+        return true;
+      }
+    }
   }
-  if (_device.manufacturer) {
-    dev["mf"] = _device.manufacturer;
+
+  bool ok = publishJson(topic, entity.retained, entity.qos, write);
+  if (ok && _manifestStorage && _manifestLoaded) {
+    manifestSet(entity.component, node, object_id, hash);
   }
-  if (_device.model) {
-    dev["mdl"] = _device.model;
+  // On failure the old hash stays, so the next replay tries again.
+  return ok;
+}
+
+template <typename WriteFn>
+uint32_t HaDiscovery::hashJson(WriteFn write) {
+  uint32_t h = kHashSeed;
+  char chunk[STREAM_BUF];
+  HaJsonWriter w(chunk, sizeof(chunk), &hashSink, &h);
+  write(w);
+  w.flush();
+  countFormatted(w.length());
+  return h;
+}
+
+void HaDiscovery::setManifestStorage(HaManifestStorage* storage) {
+  _manifestStorage = storage;
+  _manifest.clear();
+  _manifestLoaded = false;
+  _manifestDirty = false;
+  _manifestSkip = false;
+}
+
+void HaDiscovery::clearManifest() {
+  _manifest.clear();
+  _manifestDirty = true;
+}
+
+uint32_t HaDiscovery::manifestKey(HaComponent component, const char* node_id, const char* object_id) {
+  // Same hash as the stored id: "<object_id>" or "<node_id>/<object_id>".
+  uint8_t c = static_cast<uint8_t>(component);
+  uint32_t h = hashBytes(kHashSeed, reinterpret_cast<const char*>(&c), 1);
+  if (node_id) {
+    h = hashBytes(hashBytes(h, node_id, strlen(node_id)), "/", 1);
   }
-  if (_device.sw_version) {
-    dev["sw"] = _device.sw_version;
+  return hashBytes(h, object_id, strlen(object_id));
+}
+
+const char* HaDiscovery::manifestNode(uint16_t device) const {
+  // Entities of the primary device are stored by object_id alone, other devices' prefixed with their node_id.
+  return device == 0 ? nullptr : _devices[device].info.node_id;
+}
+
+static bool manifestIdEquals(const std::string& id, const char* node_id, const char* object_id) {
+  if (!node_id) {
+    return id == object_id;
   }
+  size_t nodeLen = strlen(node_id);
+  return id.size() > nodeLen && id.compare(0, nodeLen, node_id) == 0 && id[nodeLen] == '/' &&
+         id.compare(nodeLen + 1, std::string::npos, object_id) == 0;
+}
+
+uint32_t HaDiscovery::manifestScope() const {
+  // Entries are only valid for the topics they were published under.
+  const char* node = _devices[0].info.node_id;
+  uint32_t h = hashString(_discoveryPrefix.c_str());
+  h = hashBytes(h, "/", 1);
+  return hashBytes(h, node, strlen(node));
+}
 
-  size_t n = serializeJson(doc, out, outLen);
-  if (n == 0 || n >= outLen) {
+bool HaDiscovery::loadManifest() {
+  if (_manifestLoaded) {
+    return true;
+  }
+  if (!_devices[0].info.node_id) {
     return false;
   }
+  _manifestLoaded = true;
+  _manifestSkip = true;
+  _manifest.clear();
+
+  // Layout: "HAM1", scope u32, count u16, then per entry: component u8, hash u32, id length u8, id.
+  std::string data;
+  if (!_manifestStorage->load(data)) {
+    return true;
+  }
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+  const uint8_t* end = p + data.size();
+  auto readU32 = [&](uint32_t& v) {
+    if (end - p < 4) {
+      return false;
+    }
+    v = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+        static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+    p += 4;
+    return true;
+  };
+
+  uint32_t scope = 0;
+  if (data.size() < 10 || memcmp(p, kManifestMagic, 4) != 0) {
+    return true;
+  }
+  p += 4;
+  readU32(scope);
+  if (scope != manifestScope()) {
+    HA_LOGI(_log, "Discovery manifest belongs to another node or prefix, ignoring it");
+    return true;
+  }
+  size_t count = static_cast<size_t>(p[0]) | static_cast<size_t>(p[1]) << 8;
+  p += 2;
+
+  _manifest.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    ManifestEntry m;
+    if (end - p < 1) {
+      break;
+    }
+    m.component = static_cast<HaComponent>(*p++);
+    if (!readU32(m.hash) || end - p < 1) {
+      break;
+    }
+    size_t idLen = *p++;
+    if (static_cast<size_t>(end - p) < idLen) {
+      break;
+    }
+    m.objectId.assign(reinterpret_cast<const char*>(p), idLen);
+    p += idLen;
+    m.key = manifestKey(m.component, nullptr, m.objectId.c_str());
+    _manifest.push_back(m);
+  }
+  std::sort(_manifest.begin(), _manifest.end(),
+            [](const ManifestEntry& a, const ManifestEntry& b) { return a.key < b.key; });
+  HA_LOGD(_log, "Loaded discovery manifest with %u entries", (unsigned)_manifest.size());
   return true;
 }
 
-bool HaDiscovery::buildBinarySensorConfigJson(char* out, size_t outLen, const HaBinarySensorConfig& cfg) const {
-  if (!out || outLen == 0) {
-    return false;
+bool HaDiscovery::saveManifest() {
+  if (!_manifestStorage || !_manifestLoaded || !_manifestDirty) {
+    return true;
   }
 
-  // Topics
-  std::string stateTopic = cfg.common.state_topic_override
-    ? cfg.common.state_topic_override
-    : buildDefaultStateTopic(cfg.common.object_id);
+  std::string data(kManifestMagic, sizeof(kManifestMagic));
+  auto putU32 = [&](uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      data.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+  };
+  putU32(manifestScope());
+  size_t count = 0;
+  for (const ManifestEntry& m : _manifest) {
+    if (m.objectId.size() <= 0xFF) {
+      count++;
+    }
+  }
+  count = std::min<size_t>(count, 0xFFFF);
+  data.push_back(static_cast<char>(count & 0xFF));
+  data.push_back(static_cast<char>(count >> 8));
+  size_t written = 0;
+  for (const ManifestEntry& m : _manifest) {
+    if (m.objectId.size() > 0xFF || written == count) {
+      continue;  // not stored; such a config is simply published again next boot
+    }
+    data.push_back(static_cast<char>(m.component));
+    putU32(m.hash);
+    data.push_back(static_cast<char>(m.objectId.size()));
+    data.append(m.objectId);
+    written++;
+  }
 
-  std::string availTopic = cfg.common.availability_topic_override
-    ? cfg.common.availability_topic_override
-    : buildDefaultAvailabilityTopic();
+  bool ok = _manifestStorage->save(data);
+  if (ok) {
+    _manifestDirty = false;
+  }
+  if (!ok) {
+    HA_LOGE(_log, "Failed to save discovery manifest");
+  }
+  return ok;
+}
 
-  const char* pOn = cfg.payload_on ? cfg.payload_on : kOn;
-  const char* pOff = cfg.payload_off ? cfg.payload_off : kOff;
+HaDiscovery::ManifestEntry* HaDiscovery::manifestFind(HaComponent component, const char* node_id,
+                                                     const char* object_id) {
+  uint32_t key = manifestKey(component, node_id, object_id);
+  auto it = std::lower_bound(_manifest.begin(), _manifest.end(), key,
+                             [](const ManifestEntry& m, uint32_t k) { return m.key < k; });
+  for (; it != _manifest.end() && it->key == key; ++it) {
+    if (it->component == component && manifestIdEquals(it->objectId, node_id, object_id)) {
+      return &*it;
+    }
+  }
+  return nullptr;
+}
 
-  JsonDocument doc;
-  doc["name"] = cfg.common.name ? cfg.common.name : cfg.common.object_id;
-  std::string uniq = std::string(_device.node_id) + "_" + cfg.common.object_id;
-  doc["uniq_id"] = uniq;
-  doc["stat_t"] = stateTopic;
-  doc["avty_t"] = availTopic;
-  doc["pl_avail"] = kAvailOnline;
-  doc["pl_not_avail"] = kAvailOffline;
-  doc["pl_on"] = pOn;
-  doc["pl_off"] = pOff;
-  if (cfg.common.icon) {
-    doc["icon"] = cfg.common.icon;
+void HaDiscovery::manifestSet(HaComponent component, const char* node_id, const char* object_id, uint32_t hash) {
+  ManifestEntry* m = manifestFind(component, node_id, object_id);
+  if (!m) {
+    ManifestEntry entry;
+    entry.key = manifestKey(component, node_id, object_id);
+    entry.component = component;
+    if (node_id) {
+      entry.objectId = node_id;
+      entry.objectId += '/';
+    }
+    entry.objectId += object_id;
+    auto it = std::upper_bound(_manifest.begin(), _manifest.end(), entry.key,
+                               [](uint32_t k, const ManifestEntry& e) { return k < e.key; });
+    m = &*_manifest.insert(it, entry);
   }
-  if (cfg.device_class) {
-    doc["dev_cla"] = cfg.device_class;
+  m->seen = true;
+  if (m->hash != hash) {
+    m->hash = hash;
+    _manifestDirty = true;
   }
+}
 
-  JsonObject dev = doc["dev"].to<JsonObject>();
-  JsonArray ids = dev["ids"].to<JsonArray>();
-  ids.add(_device.identifiers ? _device.identifiers : _device.node_id);
-  if (_device.name) {
-    dev["name"] = _device.name;
+void HaDiscovery::manifestErase(HaComponent component, const char* node_id, const char* object_id) {
+  ManifestEntry* m = manifestFind(component, node_id, object_id);
+  if (m) {
+    _manifest.erase(_manifest.begin() + (m - _manifest.data()));
+    _manifestDirty = true;
   }
-  if (_device.manufacturer) {
-    dev["mf"] = _device.manufacturer;
+}
+
+void HaDiscovery::removeStaleEntities() {
+  char topic[TOPIC_BUF];
+  size_t removed = 0;
+  for (size_t i = 0; i < _manifest.size();) {
+    const ManifestEntry& m = _manifest[i];
+    if (m.seen) {
+      i++;
+      continue;
+    }
+    // In the manifest from an earlier run, but not registered by this firmware.
+    size_t slash = m.objectId.find('/');
+    bool built = slash == std::string::npos
+      ? buildConfigTopic(topic, sizeof(topic), componentName(m.component), _devices[0].info.node_id, m.objectId.c_str())
+      : buildConfigTopic(topic, sizeof(topic), componentName(m.component), m.objectId.substr(0, slash).c_str(),
+                         m.objectId.c_str() + slash + 1);
+    if (built &&
+        !sendMessage(HaMetricCategory::Config, topic, nullptr, 0, true, 1)) {
+      i++;  // keep it and try again on the next replay
+      continue;
+    }
+    _manifest.erase(_manifest.begin() + i);
+    _manifestDirty = true;
+    removed++;
   }
-  if (_device.model) {
-    dev["mdl"] = _device.model;
+  if (removed) {
+    HA_LOGI(_log, "Removed %u stale entities", (unsigned)removed);
   }
-  if (_device.sw_version) {
-    dev["sw"] = _device.sw_version;
+}
+
+template <typename WriteFn>
+bool HaDiscovery::publishJson(const char* topic, bool retained, uint8_t qos, WriteFn write) {
+  char json[JSON_BUF];
+  HaJsonWriter w(json, sizeof(json));
+  write(w);
+  countFormatted(w.length());
+  recordConfigSize(w.length());
+  if (w.ok()) {
+    return publishConfigJson(topic, json, retained, qos);
   }
 
-  size_t n = serializeJson(doc, out, outLen);
-  if (n == 0 || n >= outLen) {
+  // Too large for the stack buffer: stream it to the transport in small pieces.
+  HA_LOGD(_log, "Streaming discovery config to %s (%u bytes)", topic, (unsigned)w.length());
+  uint32_t start = mqttMicros();
+  _transport.setPublishPriority(messagePriority(HaMetricCategory::Config));
+  if (!_transport.beginPublish(topic, w.length(), retained, qos)) {
+    recordPublish(HaMetricCategory::Config, w.length(), false, mqttMicros() - start);
+    HA_LOGE(_log, "Failed to publish discovery config to %s", topic);
     return false;
   }
-  return true;
+  char chunk[STREAM_BUF];
+  HaJsonWriter stream(chunk, sizeof(chunk), &HaDiscovery::transportSink, &_transport);
+  write(stream);
+  bool ok = stream.flush();
+  ok = _transport.endPublish() && ok;
+  countFormatted(stream.length());
+  recordPublish(HaMetricCategory::Config, w.length(), ok, mqttMicros() - start);
+  if (!ok) {
+    HA_LOGE(_log, "Failed to publish discovery config to %s", topic);
+  }
+  return ok;
 }
 
-bool HaDiscovery::pressButton(const char* object_id, const char* payload, bool retained, uint8_t qos) {
-  if (!_device.node_id || !object_id) {
+bool HaDiscovery::transportSink(void* ctx, const char* data, size_t len) {
+  MqttTransport* transport = static_cast<MqttTransport*>(ctx);
+  return transport->write(reinterpret_cast<const uint8_t*>(data), len) == len;
+}
+
+void HaDiscovery::attachFixedJson(HaEntityHandle handle, const char* json) {
+  if (handle.valid()) {
+    _entities[handle.index].fixedJson = json;
+  }
+}
+
+bool HaDiscovery::publishRegistered(HaEntityHandle handle) {
+  if (!handle.valid()) {
     return false;
   }
+  if (_mode == HaDiscoveryMode::Device) {
+    // Coalesce registrations into one device config, published from tick().
+    markDirty(_devices[_entities[handle.index].device]);
+    return true;
+  }
+  return publishEntity(_entities[handle.index]);
+}
 
-  std::string cmdTopic = buildDefaultCommandTopic(object_id);
+void HaDiscovery::publishAvailabilityOnline(bool retained, uint8_t qos) {
+  publishAvailabilityOnline(primaryDevice(), retained, qos);
+}
+
+void HaDiscovery::publishAvailabilityOffline(bool retained, uint8_t qos) {
+  publishAvailabilityOffline(primaryDevice(), retained, qos);
+}
+
+void HaDiscovery::publishAvailabilityOnline(HaDeviceHandle device, bool retained, uint8_t qos) {
+  const Device* d = deviceFor(device);
+  if (!d || d->availabilityTopic.empty()) {
+    return;
+  }
+  sendMessage(HaMetricCategory::Availability, d->availabilityTopic.c_str(),
+              reinterpret_cast<const uint8_t*>(kAvailOnline), strlen(kAvailOnline), retained, qos);
+}
+
+void HaDiscovery::publishAvailabilityOffline(HaDeviceHandle device, bool retained, uint8_t qos) {
+  const Device* d = deviceFor(device);
+  if (!d || d->availabilityTopic.empty()) {
+    return;
+  }
+  HA_LOGI(_log, "Publishing availability offline to %s", d->availabilityTopic.c_str());
+  sendMessage(HaMetricCategory::Availability, d->availabilityTopic.c_str(),
+              reinterpret_cast<const uint8_t*>(kAvailOffline), strlen(kAvailOffline), retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerComponent(HaComponent component, HaDeviceHandle device, const void* cfg,
+                                              size_t size, bool retained, uint8_t qos) {
+  const HaEntityCommon& common = *static_cast<const HaEntityCommon*>(cfg);
+  Entity* e = registerEntity(component, device, common.object_id, retained, qos);
+  if (!e) {
+    return HaEntityHandle{};
+  }
+  memcpy(&e->cfg, cfg, size);
+  if (!resolveTopics(*e)) {
+    HA_LOGE(_log, "No topic space left for %s, not registered", common.object_id);
+    discardEntity(handleOf(*e).index);
+    return HaEntityHandle{};
+  }
+  if (e->commandHandler) {
+    rebuildCommandIndex();  // the command topic may have changed
+  }
+  _transportReserved = false;
+  return handleOf(*e);
+}
+
+HaEntityHandle HaDiscovery::registerSensor(const HaSensorConfig& cfg, bool retained, uint8_t qos) {
+  return registerSensor(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerSensor(HaDeviceHandle device, const HaSensorConfig& cfg, bool retained,
+                                           uint8_t qos) {
+  return registerComponent(HaComponent::Sensor, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishSensorDiscovery(const HaSensorConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSensor(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishSensorDiscovery(HaDeviceHandle device, const HaSensorConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSensor(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerSwitch(const HaSwitchConfig& cfg, bool retained, uint8_t qos) {
+  return registerSwitch(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerSwitch(HaDeviceHandle device, const HaSwitchConfig& cfg, bool retained,
+                                           uint8_t qos) {
+  return registerComponent(HaComponent::Switch, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishSwitchDiscovery(const HaSwitchConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSwitch(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishSwitchDiscovery(HaDeviceHandle device, const HaSwitchConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSwitch(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerBinarySensor(const HaBinarySensorConfig& cfg, bool retained, uint8_t qos) {
+  return registerBinarySensor(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerBinarySensor(HaDeviceHandle device, const HaBinarySensorConfig& cfg, bool retained,
+                                                 uint8_t qos) {
+  return registerComponent(HaComponent::BinarySensor, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishBinarySensorDiscovery(const HaBinarySensorConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerBinarySensor(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishBinarySensorDiscovery(HaDeviceHandle device, const HaBinarySensorConfig& cfg, bool retained,
+                                               uint8_t qos) {
+  return publishRegistered(registerBinarySensor(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerButton(const HaButtonConfig& cfg, bool retained, uint8_t qos) {
+  return registerButton(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerButton(HaDeviceHandle device, const HaButtonConfig& cfg, bool retained,
+                                           uint8_t qos) {
+  return registerComponent(HaComponent::Button, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishButtonDiscovery(const HaButtonConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerButton(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishButtonDiscovery(HaDeviceHandle device, const HaButtonConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerButton(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerNumber(const HaNumberConfig& cfg, bool retained, uint8_t qos) {
+  return registerNumber(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerNumber(HaDeviceHandle device, const HaNumberConfig& cfg, bool retained,
+                                           uint8_t qos) {
+  return registerComponent(HaComponent::Number, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishNumberDiscovery(const HaNumberConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerNumber(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishNumberDiscovery(HaDeviceHandle device, const HaNumberConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerNumber(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerSelect(const HaSelectConfig& cfg, bool retained, uint8_t qos) {
+  return registerSelect(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerSelect(HaDeviceHandle device, const HaSelectConfig& cfg, bool retained,
+                                           uint8_t qos) {
+  return registerComponent(HaComponent::Select, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishSelectDiscovery(const HaSelectConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSelect(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishSelectDiscovery(HaDeviceHandle device, const HaSelectConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerSelect(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerLight(const HaLightConfig& cfg, bool retained, uint8_t qos) {
+  return registerLight(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerLight(HaDeviceHandle device, const HaLightConfig& cfg, bool retained, uint8_t qos) {
+  return registerComponent(HaComponent::Light, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishLightDiscovery(const HaLightConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerLight(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishLightDiscovery(HaDeviceHandle device, const HaLightConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerLight(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerCover(const HaCoverConfig& cfg, bool retained, uint8_t qos) {
+  return registerCover(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerCover(HaDeviceHandle device, const HaCoverConfig& cfg, bool retained, uint8_t qos) {
+  return registerComponent(HaComponent::Cover, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishCoverDiscovery(const HaCoverConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerCover(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishCoverDiscovery(HaDeviceHandle device, const HaCoverConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerCover(device, cfg, retained, qos));
+}
+
+HaEntityHandle HaDiscovery::registerClimate(const HaClimateConfig& cfg, bool retained, uint8_t qos) {
+  return registerClimate(primaryDevice(), cfg, retained, qos);
+}
+
+HaEntityHandle HaDiscovery::registerClimate(HaDeviceHandle device, const HaClimateConfig& cfg, bool retained,
+                                            uint8_t qos) {
+  return registerComponent(HaComponent::Climate, device, &cfg, sizeof(cfg), retained, qos);
+}
+
+bool HaDiscovery::publishClimateDiscovery(const HaClimateConfig& cfg, bool retained, uint8_t qos) {
+  return publishRegistered(registerClimate(cfg, retained, qos));
+}
+
+bool HaDiscovery::publishClimateDiscovery(HaDeviceHandle device, const HaClimateConfig& cfg, bool retained,
+                                          uint8_t qos) {
+  return publishRegistered(registerClimate(device, cfg, retained, qos));
+}
+
+bool HaDiscovery::removeEntity(const char* component, const char* object_id, uint8_t qos) {
+  return removeEntity(primaryDevice(), component, object_id, qos);
+}
+
+bool HaDiscovery::removeEntity(HaDeviceHandle device, const char* component, const char* object_id, uint8_t qos) {
+  const Device* d = deviceFor(device);
+  if (!d || !d->info.node_id || !component || !object_id) {
+    return false;
+  }
+
+  HaComponent c = HaComponent::Sensor;
+  bool known = componentFromName(component, c);
+  HaEntityHandle handle = known ? findEntity(device.index, object_id, &c) : HaEntityHandle{};
+  if (entityFor(handle)) {
+    Entity& e = _entities[handle.index];
+    e.active = false;
+    if (e.commandHandler) {
+      e.commandHandler = nullptr;
+      rebuildCommandIndex();
+    }
+    if (e.filtered) {
+      e.filtered = false;
+      _filteredCount--;
+    }
+    if (_mode == HaDiscoveryMode::Device) {
+      // Removed by the next device config, which lists it with only its platform key.
+      e.removePending = true;
+      markDirty(_devices[device.index]);
+      return true;
+    }
+    releaseEntity(handle.index);
+  }
+
+  char topic[TOPIC_BUF];
+  if (!buildConfigTopic(topic, sizeof(topic), component, d->info.node_id, object_id)) {
+    return false;
+  }
+
+  // Empty retained config payload removes entity in Home Assistant
+  bool ok = sendMessage(HaMetricCategory::Config, topic, nullptr, 0, true, qos);
+  if (ok && _manifestLoaded && known) {
+    manifestErase(c, manifestNode(device.index), object_id);
+  }
+  return ok;
+}
+
+bool HaDiscovery::publishState(const char* object_id, const char* payload, bool retained, uint8_t qos) {
+  const char* node = _devices[0].info.node_id;
+  if (!node || !object_id || !payload) {
+    return false;
+  }
+
+  if (_filteredCount) {
+    HaEntityHandle handle = entityHandle(object_id);
+    if (handle.valid() && _entities[handle.index].filtered) {
+      return publishState(handle, payload, retained, qos);
+    }
+  }
+
+  char topic[TOPIC_BUF];
+  int n = snprintf(topic, sizeof(topic), "%s/%s/%s/state", _baseTopicPrefix.c_str(), node, object_id);
+  if (n < 0 || static_cast<size_t>(n) >= sizeof(topic)) {
+    return false;
+  }
+
+  HA_LOGD(_log, "Publishing state to %s: %s", topic, payload);
+  bool ok = sendMessage(HaMetricCategory::State, topic,
+                        reinterpret_cast<const uint8_t*>(payload),
+                        strlen(payload),
+                        retained,
+                        qos);
+  if (!ok) {
+    HA_LOGE(_log, "Failed to publish state to %s", topic);
+  }
+  return ok;
+}
+
+bool HaDiscovery::publishState(HaEntityHandle handle, const char* payload, bool retained, uint8_t qos) {
+  if (!entityFor(handle) || !payload) {
+    return false;
+  }
+  Entity& e = _entities[handle.index];
+  if (e.stateTopic == NO_TOPIC) {
+    return false;
+  }
+
+  uint32_t now = 0;
+  uint32_t hash = 0;
+  if (e.filtered) {
+    now = _millis();
+    hash = hashString(payload);
+    if (shouldSuppressState(e, payload, hash, now)) {
+      e.stats.suppressed++;
+      _stateTotals.suppressed++;
+      return true;
+    }
+  }
+
+  const char* topic = topicAt(e.stateTopic);
+  HA_LOGD(_log, "Publishing state to %s: %s", topic, payload);
+  bool ok = sendMessage(HaMetricCategory::State, topic,
+                        reinterpret_cast<const uint8_t*>(payload),
+                        strlen(payload),
+                        retained,
+                        qos);
+  if (!ok) {
+    HA_LOGE(_log, "Failed to publish state to %s", topic);
+    return false;
+  }
+
+  e.stats.sent++;
+  _stateTotals.sent++;
+  if (e.filtered) {
+    e.hasLast = true;
+    e.lastHash = hash;
+    e.lastNumeric = parseNumber(payload, e.lastValue);
+    e.lastSentMs = now;
+  }
+  return true;
+}
+
+bool HaDiscovery::publishState(const char* object_id, float value, uint8_t precision, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatFloat(buf, sizeof(buf), value, precision)) && publishState(object_id, buf, retained, qos);
+}
+
+bool HaDiscovery::publishState(const char* object_id, int32_t value, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatInt(buf, sizeof(buf), value)) && publishState(object_id, buf, retained, qos);
+}
+
+bool HaDiscovery::publishState(const char* object_id, uint32_t value, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatUint(buf, sizeof(buf), value)) && publishState(object_id, buf, retained, qos);
+}
+
+bool HaDiscovery::publishState(HaEntityHandle handle, float value, uint8_t precision, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatFloat(buf, sizeof(buf), value, precision)) && publishState(handle, buf, retained, qos);
+}
+
+bool HaDiscovery::publishState(HaEntityHandle handle, int32_t value, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatInt(buf, sizeof(buf), value)) && publishState(handle, buf, retained, qos);
+}
+
+bool HaDiscovery::publishState(HaEntityHandle handle, uint32_t value, bool retained, uint8_t qos) {
+  char buf[HA_NUMBER_BUF];
+  return countFormatted(haFormatUint(buf, sizeof(buf), value)) && publishState(handle, buf, retained, qos);
+}
+
+bool HaDiscovery::shouldSuppressState(const Entity& entity, const char* payload, uint32_t hash, uint32_t now) const {
+  if (!entity.hasLast) {
+    return false;
+  }
+  const HaStateFilter& f = entity.filter;
+  if (f.heartbeat_ms && static_cast<uint32_t>(now - entity.lastSentMs) >= f.heartbeat_ms) {
+    return false;
+  }
+
+  float value = 0.0f;
+  if ((f.abs_deadband > 0.0f || f.rel_deadband > 0.0f) && entity.lastNumeric && parseNumber(payload, value)) {
+    float band = f.abs_deadband;
+    float rel = f.rel_deadband * fabsf(entity.lastValue);
+    if (rel > band) {
+      band = rel;
+    }
+    return fabsf(value - entity.lastValue) < band;
+  }
+
+  return f.suppress_unchanged && hash == entity.lastHash;
+}
+
+bool HaDiscovery::setStateFilter(HaEntityHandle handle, const HaStateFilter& filter) {
+  if (!entityFor(handle)) {
+    return false;
+  }
+  Entity& e = _entities[handle.index];
+  if (!e.filtered) {
+    _filteredCount++;
+  }
+  e.filter = filter;
+  e.filtered = true;
+  e.hasLast = false;
+  return true;
+}
+
+void HaDiscovery::clearStateFilter(HaEntityHandle handle) {
+  if (!entityFor(handle)) {
+    return;
+  }
+  Entity& e = _entities[handle.index];
+  if (e.filtered) {
+    _filteredCount--;
+  }
+  e.filtered = false;
+}
+
+bool HaDiscovery::setCommandHandler(HaEntityHandle handle, HaCommandHandler handler, void* ctx) {
+  const Entity* found = entityFor(handle);
+  if (!found || found->commandTopic == NO_TOPIC) {
+    return false;
+  }
+  Entity& e = _entities[handle.index];
+  bool added = handler && !e.commandHandler;
+  bool cleared = !handler && e.commandHandler;
+  e.commandHandler = handler;
+  e.commandCtx = ctx;
+  if (added) {
+    indexCommand(handle.index);
+  } else if (cleared) {
+    rebuildCommandIndex();
+  }
+  if (added && _transport.connected()) {
+    subscribeCommand(e);
+  }
+  return true;
+}
+
+void HaDiscovery::setOnUnhandledMessage(MqttTransport::MessageFn cb, void* ctx) {
+  _unhandledCb = cb;
+  _unhandledCtx = ctx;
+}
+
+bool HaDiscovery::isDefaultCommandTopic(const Entity& entity) const {
+  const FieldSpec* command = findField(componentSpec(entity.component), FieldType::CommandTopic);
+  return command && !stringField(&entity.cfg, command->offset);
+}
+
+void HaDiscovery::subscribeCommands() {
+  for (const Entity& e : _entities) {
+    if (e.active && e.commandHandler) {
+      subscribeCommand(e);
+    }
+  }
+}
+
+void HaDiscovery::subscribeCommand(const Entity& entity) {
+  Device& d = _devices[entity.device];
+  if (!d.info.node_id) {
+    return;
+  }
+  if (!isDefaultCommandTopic(entity)) {
+    _transport.subscribe(topicAt(entity.commandTopic), 1);
+  } else if (!d.commandWildcardSubscribed) {
+    // <base>/<node_id>/+/set covers the default command topic of every entity on this node.
+    char topic[TOPIC_BUF];
+    int n = snprintf(topic, sizeof(topic), "%s/%s/+/set", _baseTopicPrefix.c_str(), d.info.node_id);
+    if (n > 0 && static_cast<size_t>(n) < sizeof(topic) && _transport.subscribe(topic, 1)) {
+      d.commandWildcardSubscribed = true;
+      HA_LOGD(_log, "Subscribed to %s", topic);
+    }
+  }
+}
+
+void HaDiscovery::indexCommand(uint16_t index) {
+  // Power-of-two table at most half full keeps probe sequences short.
+  if ((_commandIndexUsed + 1) * 2 > _commandIndex.size()) {
+    rebuildCommandIndex();  // also indexes this entity, whose handler is already set
+    return;
+  }
+  Entity& e = _entities[index];
+  e.commandHash = hashString(topicAt(e.commandTopic));
+  size_t mask = _commandIndex.size() - 1;
+  size_t slot = e.commandHash & mask;
+  while (_commandIndex[slot]) {
+    slot = (slot + 1) & mask;
+  }
+  _commandIndex[slot] = static_cast<uint16_t>(index + 1);
+  _commandIndexUsed++;
+}
+
+void HaDiscovery::rebuildCommandIndex() {
+  // Room for four times the handlers, so a rebuild is followed by many cheap inserts.
+  size_t count = 0;
+  for (const Entity& e : _entities) {
+    if (e.active && e.commandHandler) {
+      count++;
+    }
+  }
+  _commandIndexUsed = 0;
+  if (count == 0) {
+    _commandIndex.clear();
+    return;
+  }
+
+  size_t size = 8;
+  while (size < (count + 1) * 4) {
+    size <<= 1;
+  }
+  if (_commandIndex.fixed()) {
+    size = _commandIndex.capacity();  // sized by HaEntityTable for a full table
+  }
+  _commandIndex.assign(size, 0);
+  for (size_t i = 0; i < _entities.size(); i++) {
+    Entity& e = _entities[i];
+    if (!e.active || !e.commandHandler) {
+      continue;
+    }
+    e.commandHash = hashString(topicAt(e.commandTopic));
+    size_t slot = e.commandHash & (size - 1);
+    while (_commandIndex[slot]) {
+      slot = (slot + 1) & (size - 1);
+    }
+    _commandIndex[slot] = static_cast<uint16_t>(i + 1);
+    _commandIndexUsed++;
+  }
+}
+
+void HaDiscovery::onTransportMessageThunk(void* ctx, const char* topic, const uint8_t* payload, size_t len) {
+  static_cast<HaDiscovery*>(ctx)->onTransportMessage(topic, payload, len);
+}
+
+void HaDiscovery::onTransportMessage(const char* topic, const uint8_t* payload, size_t len) {
+  // Runs on the client's task for async transports: only copy the message for tick().
+  size_t topicLen = topic ? strlen(topic) : 0;
+  if (!topic || topicLen >= TOPIC_BUF || len >= COMMAND_BUF) {
+    // Too large for any command, so it is one of the application's own subscriptions.
+    if (_unhandledCb) {
+      _unhandledCb(_unhandledCtx, topic, payload, len);
+    }
+    return;
+  }
+  MqttLock lock(_messageMutex);
+  if (_messageCount == COMMAND_QUEUE) {
+    HA_LOGW(_log, "Message queue full, dropping message on %s", topic);
+    return;
+  }
+  QueuedMessage& m = _messageQueue[(_messageHead + _messageCount) % COMMAND_QUEUE];
+  memcpy(m.topic, topic, topicLen + 1);
+  if (len) {
+    memcpy(m.payload, payload, len);
+  }
+  m.payload[len] = '\0';
+  m.len = len;
+  _messageCount++;
+}
+
+void HaDiscovery::dispatchMessages() {
+  // At most one queue's worth per tick, so a handler that triggers more messages cannot stall loop().
+  for (size_t n = 0; n < COMMAND_QUEUE; n++) {
+    QueuedMessage m;
+    {
+      MqttLock lock(_messageMutex);
+      if (!_messageCount) {
+        return;
+      }
+      const QueuedMessage& q = _messageQueue[_messageHead];
+      strcpy(m.topic, q.topic);
+      memcpy(m.payload, q.payload, q.len + 1);
+      m.len = q.len;
+      _messageHead = (_messageHead + 1) % COMMAND_QUEUE;
+      _messageCount--;
+    }
+    dispatchMessage(m.topic, m.payload, m.len);
+  }
+}
+
+void HaDiscovery::dispatchMessage(const char* topic, const char* payload, size_t len) {
+  const Entity* match = nullptr;
+  size_t index = 0;
+  if (!_commandIndex.empty()) {
+    size_t mask = _commandIndex.size() - 1;
+    uint32_t hash = hashString(topic);
+    for (size_t slot = hash & mask; _commandIndex[slot]; slot = (slot + 1) & mask) {
+      const Entity& e = _entities[_commandIndex[slot] - 1];
+      if (e.commandHash == hash && strcmp(topicAt(e.commandTopic), topic) == 0) {
+        match = &e;
+        index = _commandIndex[slot] - 1;
+        break;
+      }
+    }
+  }
+
+  if (!match) {
+    if (_unhandledCb) {
+      _unhandledCb(_unhandledCtx, topic, reinterpret_cast<const uint8_t*>(payload), len);
+    }
+    return;
+  }
+
+  _metrics.commands_received++;
+  _metrics.command_bytes_received += static_cast<uint32_t>(len);
+  match->commandHandler(match->commandCtx, HaEntityHandle(static_cast<uint16_t>(index)), payload, len);
+}
+
+HaStateStats HaDiscovery::stateStats(HaEntityHandle handle) const {
+  const Entity* e = entityFor(handle);
+  return e ? e->stats : HaStateStats();
+}
+
+HaStateStats HaDiscovery::stateStats() const {
+  return _stateTotals;
+}
+
+uint32_t HaMetrics::totalMessages() const {
+  uint32_t n = 0;
+  for (const HaMessageCounters& c : category) {
+    n += c.messages;
+  }
+  return n;
+}
+
+uint32_t HaMetrics::totalBytes() const {
+  uint32_t n = 0;
+  for (const HaMessageCounters& c : category) {
+    n += c.bytes;
+  }
+  return n;
+}
+
+uint32_t HaMetrics::totalFailures() const {
+  uint32_t n = 0;
+  for (const HaMessageCounters& c : category) {
+    n += c.failures;
+  }
+  return n;
+}
+
+HaMetrics HaDiscovery::metrics() const {
+  HaMetrics m = _metrics;
+  m.ack = _transport.ackStats();
+  m.pending_publishes = _transport.pendingPublishes();
+  return m;
+}
+
+void HaDiscovery::resetMetrics() {
+  _metrics = HaMetrics();
+  _metrics.config_buffer = JSON_BUF;
+}
+
+bool HaDiscovery::enableMetricsSensors(uint32_t interval_ms) {
+  const size_t count = sizeof(kMetricSensors) / sizeof(kMetricSensors[0]);
+  if (interval_ms == 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (_metricsSensors[i].valid()) {
+        removeEntity(componentName(HaComponent::Sensor), kMetricSensors[i].object_id);
+        _metricsSensors[i] = HaEntityHandle();
+      }
+    }
+    _metricsIntervalMs = 0;
+    return true;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (_metricsSensors[i].valid()) {
+      continue;
+    }
+    HaSensorConfig cfg;
+    cfg.common.object_id = kMetricSensors[i].object_id;
+    cfg.common.name = kMetricSensors[i].name;
+    cfg.common.entity_category = "diagnostic";
+    cfg.unit_of_measurement = kMetricSensors[i].unit;
+    cfg.device_class = kMetricSensors[i].device_class;
+    cfg.state_class = kMetricSensors[i].state_class;
+    _metricsSensors[i] = registerSensor(cfg);
+    if (!_metricsSensors[i].valid()) {
+      return false;
+    }
+    publishRegistered(_metricsSensors[i]);
+  }
+  _metricsIntervalMs = interval_ms;
+  _metricsPublished = false;
+  return true;
+}
+
+void HaDiscovery::serviceMetricsSensors() {
+  if (!_metricsIntervalMs || !_transport.connected()) {
+    return;
+  }
+  uint32_t now = _millis();
+  if (_metricsPublished && now - _metricsLastMs < _metricsIntervalMs) {
+    return;
+  }
+  _metricsPublished = true;
+  _metricsLastMs = now;
+
+  HaMetrics m = metrics();
+  uint32_t calls = m.totalMessages() + m.totalFailures();
+  const uint32_t values[] = {
+    m.totalMessages(),
+    m.totalBytes(),
+    m.totalFailures(),
+    calls ? m.publish_time_us / calls : 0,
+    m.largest_config
+  };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    publishState(_metricsSensors[i], values[i]);
+  }
+}
+
+bool HaDiscovery::sendMessage(HaMetricCategory category, const char* topic, const uint8_t* payload, size_t len,
+                              bool retained, uint8_t qos) {
+  uint32_t start = mqttMicros();
+  _transport.setPublishPriority(messagePriority(category));
+  bool ok = _transport.publish(topic, payload, len, retained, qos);
+  recordPublish(category, len, ok, mqttMicros() - start);
+  return ok;
+}
+
+void HaDiscovery::recordPublish(HaMetricCategory category, size_t len, bool ok, uint32_t elapsed_us) {
+  HaMessageCounters& c = _metrics.category[static_cast<size_t>(category)];
+  if (ok) {
+    c.messages++;
+    c.bytes += static_cast<uint32_t>(len);
+  } else {
+    c.failures++;
+  }
+  _metrics.publish_time_us += elapsed_us;
+  if (elapsed_us > _metrics.publish_time_max_us) {
+    _metrics.publish_time_max_us = elapsed_us;
+  }
+  _metrics.publish_time_histogram[histogramBucket(HA_PUBLISH_TIME_BOUNDS_US, elapsed_us, false)]++;
+}
+
+void HaDiscovery::recordConfigSize(size_t len) {
+  uint32_t n = static_cast<uint32_t>(len);
+  if (n > _metrics.largest_config) {
+    _metrics.largest_config = n;
+  }
+  if (len >= JSON_BUF) {
+    _metrics.streamed_configs++;
+  }
+  _metrics.config_size_histogram[histogramBucket(HA_CONFIG_SIZE_BOUNDS, n, true)]++;
+}
+
+size_t HaDiscovery::countFormatted(size_t len) {
+  _metrics.formatted_bytes += static_cast<uint32_t>(len);
+  return len;
+}
+
+bool HaDiscovery::publishStateSwitch(const char* object_id, bool on, bool retained, uint8_t qos) {
+  return publishState(object_id, on ? kOn : kOff, retained, qos);
+}
+
+bool HaDiscovery::publishStateSwitch(HaEntityHandle handle, bool on, bool retained, uint8_t qos) {
+  return publishState(handle, on ? kOn : kOff, retained, qos);
+}
+
+bool HaDiscovery::buildConfigTopic(char* out, size_t outLen, const char* component, const char* node_id,
+                                   const char* object_id) const {
+  // homeassistant/<component>/<node_id>/<object_id>/config
+  int n = snprintf(out, outLen, "%s/%s/%s/%s/config",
+                   _discoveryPrefix.c_str(), component, node_id, object_id);
+  return n > 0 && static_cast<size_t>(n) < outLen;
+}
+
+bool HaDiscovery::buildDefaultTopic(char* out, size_t outLen, const Device& dev, const char* object_id,
+                                    const char* suffix) const {
+  // <base>/<node_id>/<object_id>/state or .../set
+  int n = snprintf(out, outLen, "%s/%s/%s/%s", _baseTopicPrefix.c_str(), dev.info.node_id, object_id, suffix);
+  return n > 0 && static_cast<size_t>(n) < outLen;
+}
+
+std::string HaDiscovery::buildDefaultAvailabilityTopic(const Device& dev) const {
+  // <base>/<node_id>/status
+  return _baseTopicPrefix + "/" + dev.info.node_id + "/status";
+}
+
+bool HaDiscovery::publishConfigJson(const char* topic, const char* json, bool retained, uint8_t qos) {
+  HA_LOGD(_log, "Publishing discovery config to %s", topic);
+  size_t len = strlen(json);
+  if (!_transport.reservePublishSize(strlen(topic), len)) {
+    HA_LOGE(_log, "Transport cannot send a %u-byte discovery config to %s", (unsigned)len, topic);
+    recordPublish(HaMetricCategory::Config, len, false, 0);
+    return false;
+  }
+  bool ok = sendMessage(HaMetricCategory::Config, topic,
+                        reinterpret_cast<const uint8_t*>(json),
+                        len,
+                        retained,
+                        qos);
+  if (!ok) {
+    HA_LOGE(_log, "Failed to publish discovery config to %s", topic);
+  }
+  return ok;
+}
+
+bool HaDiscovery::useTopicBase(bool shared_availability) const {
+  // Device configs have about one topic per component, so a `~` per component would not pay off.
+  return _format == HaConfigFormat::Compact && !shared_availability;
+}
+
+void HaDiscovery::writeTopic(HaJsonWriter& w, const Device& dev, const char* key, const char* override_topic,
+                             const char* object_id, const char* suffix, bool topic_base) const {
+  if (override_topic) {
+    writeTopicValue(w, dev, key, override_topic, topic_base);
+    return;
+  }
+  // <base>/<node_id>[/<object_id>]/<suffix>, or ~[/<object_id>]/<suffix>
+  w.key(key);
+  w.beginString();
+  if (topic_base) {
+    w.appendString("~");
+  } else {
+    w.appendString(_baseTopicPrefix.c_str());
+    w.appendString("/");
+    w.appendString(dev.info.node_id);
+  }
+  if (object_id) {
+    w.appendString("/");
+    w.appendString(object_id);
+  }
+  w.appendString("/");
+  w.appendString(suffix);
+  w.endString();
+}
+
+void HaDiscovery::writeTopicValue(HaJsonWriter& w, const Device& dev, const char* key, const char* topic,
+                                  bool topic_base) const {
+  w.key(key);
+  if (topic_base) {
+    // Abbreviate topics below <base>/<node_id>/, e.g. overrides that follow the default layout.
+    size_t baseLen = _baseTopicPrefix.size();
+    size_t nodeLen = strlen(dev.info.node_id);
+    if (strncmp(topic, _baseTopicPrefix.c_str(), baseLen) == 0 && topic[baseLen] == '/' &&
+        strncmp(topic + baseLen + 1, dev.info.node_id, nodeLen) == 0 && topic[baseLen + 1 + nodeLen] == '/') {
+      w.beginString();
+      w.appendString("~");
+      w.appendString(topic + baseLen + 1 + nodeLen);
+      w.endString();
+      return;
+    }
+  }
+  w.value(topic);
+}
+
+void HaDiscovery::writeTopicBase(HaJsonWriter& w, const Device& dev) const {
+  w.key("~");
+  w.beginString();
+  w.appendString(_baseTopicPrefix.c_str());
+  w.appendString("/");
+  w.appendString(dev.info.node_id);
+  w.endString();
+}
+
+void HaDiscovery::writePayload(HaJsonWriter& w, const char* key, const char* payload, const char* ha_default) const {
+  if (_format == HaConfigFormat::Compact && strcmp(payload, ha_default) == 0) {
+    return;
+  }
+  w.member(key, payload);
+}
+
+void HaDiscovery::writeEntityHeader(HaJsonWriter& w, const Device& dev, const HaEntityCommon& common,
+                                    bool topic_base, bool name) const {
+  if (topic_base) {
+    writeTopicBase(w, dev);
+  }
+  if (name) {
+    w.member("name", common.name ? common.name : common.object_id);
+  }
+  w.key("uniq_id");
+  w.beginString();
+  w.appendString(dev.info.node_id);
+  w.appendString("_");
+  w.appendString(common.object_id);
+  w.endString();
+}
+
+void HaDiscovery::writeAvailability(HaJsonWriter& w, const Device& dev, const HaEntityCommon& common,
+                                    bool shared_availability) const {
+  if (shared_availability && !common.availability_topic_override) {
+    return;
+  }
+  bool topic_base = useTopicBase(shared_availability);
+  if (!common.availability_topic_override && isBridged(dev)) {
+    writeBridgedAvailability(w, dev, topic_base);
+    return;
+  }
+  writeTopic(w, dev, "avty_t", common.availability_topic_override, nullptr, "status", topic_base);
+  writePayload(w, "pl_avail", kAvailOnline, kAvailOnline);
+  writePayload(w, "pl_not_avail", kAvailOffline, kAvailOffline);
+}
+
+void HaDiscovery::writeBridgedAvailability(HaJsonWriter& w, const Device& dev, bool topic_base) const {
+  // Available only while both the gateway and the device behind it report "online" (the default payloads).
+  w.key("avty");
+  w.beginArray();
+  w.beginObject();
+  w.member("t", _devices[0].availabilityTopic.c_str());
+  w.endObject();
+  w.beginObject();
+  writeTopicValue(w, dev, "t", dev.availabilityTopic.c_str(), topic_base);
+  w.endObject();
+  w.endArray();
+  w.member("avty_mode", "all");
+}
+
+void HaDiscovery::writeDevice(HaJsonWriter& w, const Device& dev) const {
+  w.key("dev");
+  w.beginObject();
+  w.key("ids");
+  w.beginArray();
+  w.value(dev.info.identifiers ? dev.info.identifiers : dev.info.node_id);
+  w.endArray();
+  w.optionalMember("name", dev.info.name);
+  w.optionalMember("mf", dev.info.manufacturer);
+  w.optionalMember("mdl", dev.info.model);
+  w.optionalMember("sw", dev.info.sw_version);
+  if (isBridged(dev)) {
+    w.key("via_device");
+    w.value(_devices[0].info.identifiers ? _devices[0].info.identifiers : _devices[0].info.node_id);
+  }
+  w.endObject();
+}
+
+void HaDiscovery::writeConfig(HaJsonWriter& w, const Device& dev, HaComponent component, const void* cfg,
+                              bool shared_availability, const char* fixed_json) const {
+  const ComponentSpec& spec = componentSpec(component);
+  const HaEntityCommon& common = *static_cast<const HaEntityCommon*>(cfg);
+  bool topic_base = useTopicBase(shared_availability);
+  // fixed_json (see HaStaticEntity.h) already holds the name, strings, lists, constants and the
+  // payloads that differ from the default; everything else is written here.
+  writeEntityHeader(w, dev, common, topic_base, !fixed_json);
+  for (uint8_t i = 0; i < spec.count; i++) {
+    const FieldSpec& f = spec.fields[i];
+    switch (f.type) {
+      case FieldType::String:
+        if (!fixed_json) {
+          w.optionalMember(f.key, stringField(cfg, f.offset));
+        }
+        break;
+      case FieldType::Payload: {
+        const char* payload = stringField(cfg, f.offset);
+        if (!payload) {
+          payload = f.def;
+        }
+        if (!fixed_json || strcmp(payload, f.def) == 0) {
+          writePayload(w, f.key, payload, f.def);
+        }
+        break;
+      }
+      case FieldType::StateTopic:
+        writeTopic(w, dev, f.key, stringField(cfg, f.offset), common.object_id, "state", topic_base);
+        break;
+      case FieldType::CommandTopic:
+        writeTopic(w, dev, f.key, stringField(cfg, f.offset), common.object_id, "set", topic_base);
+        break;
+      case FieldType::Topic: {
+        const char* topic = stringField(cfg, f.offset);
+        if (topic) {
+          writeTopicValue(w, dev, f.key, topic, topic_base);
+        }
+        break;
+      }
+      case FieldType::Availability:
+        writeAvailability(w, dev, common, shared_availability);
+        break;
+      case FieldType::Float:
+      case FieldType::Temperature:
+      case FieldType::Uint16: {
+        char num[HA_NUMBER_BUF];
+        const uint8_t* p = static_cast<const uint8_t*>(cfg) + f.offset;
+        if (f.type != FieldType::Uint16) {
+          float value;
+          memcpy(&value, p, sizeof(value));
+          formatDecimal(num, sizeof(num), value);
+        } else {
+          uint16_t value;
+          memcpy(&value, p, sizeof(value));
+          haFormatUint(num, sizeof(num), value);
+        }
+        bool is_default = strcmp(num, f.def) == 0;
+        if (f.type == FieldType::Temperature) {
+          const char* unit = static_cast<const HaClimateConfig*>(cfg)->temperature_unit;
+          is_default = is_default && (!unit || strcmp(unit, "C") == 0);
+        }
+        if (num[0] && (_format != HaConfigFormat::Compact || !is_default)) {
+          w.key(f.key);
+          w.rawValue(num);
+        }
+        break;
+      }
+      case FieldType::StringList: {
+        const char* const* items;
+        memcpy(&items, static_cast<const uint8_t*>(cfg) + f.offset, sizeof(items));
+        if (items && !fixed_json) {
+          w.key(f.key);
+          w.beginArray();
+          for (; *items; items++) {
+            w.value(*items);
+          }
+          w.endArray();
+        }
+        break;
+      }
+      case FieldType::Constant:
+        if (!fixed_json) {
+          w.member(f.key, f.def);
+        }
+        break;
+    }
+  }
+  w.rawMembers(fixed_json);
+}
+
+void HaDiscovery::writeEntityConfig(HaJsonWriter& w, const Entity& entity, bool shared_availability) const {
+  writeConfig(w, _devices[entity.device], entity.component, &entity.cfg, shared_availability, entity.fixedJson);
+}
+
+bool HaDiscovery::buildConfigJson(char* out, size_t outLen, HaComponent component, const void* cfg) const {
+  if (!out || outLen == 0) {
+    return false;
+  }
+
+  HaJsonWriter w(out, outLen);
+  w.beginObject();
+  writeConfig(w, _devices[0], component, cfg, false);
+  writeDevice(w, _devices[0]);
+  w.endObject();
+  return w.ok();
+}
+
+bool HaDiscovery::buildSensorConfigJson(char* out, size_t outLen, const HaSensorConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Sensor, &cfg);
+}
+
+bool HaDiscovery::buildSwitchConfigJson(char* out, size_t outLen, const HaSwitchConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Switch, &cfg);
+}
+
+bool HaDiscovery::buildBinarySensorConfigJson(char* out, size_t outLen, const HaBinarySensorConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::BinarySensor, &cfg);
+}
+
+bool HaDiscovery::buildButtonConfigJson(char* out, size_t outLen, const HaButtonConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Button, &cfg);
+}
+
+bool HaDiscovery::buildNumberConfigJson(char* out, size_t outLen, const HaNumberConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Number, &cfg);
+}
+
+bool HaDiscovery::buildSelectConfigJson(char* out, size_t outLen, const HaSelectConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Select, &cfg);
+}
+
+bool HaDiscovery::buildLightConfigJson(char* out, size_t outLen, const HaLightConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Light, &cfg);
+}
+
+bool HaDiscovery::buildCoverConfigJson(char* out, size_t outLen, const HaCoverConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Cover, &cfg);
+}
+
+bool HaDiscovery::buildClimateConfigJson(char* out, size_t outLen, const HaClimateConfig& cfg) const {
+  return buildConfigJson(out, outLen, HaComponent::Climate, &cfg);
+}
+
+bool HaDiscovery::isDeviceComponent(const Entity& entity) {
+  return entity.active || entity.removePending;
+}
+
+void HaDiscovery::writeDeviceConfig(HaJsonWriter& w, const Device& dev, size_t first, size_t last) const {
+  w.beginObject();
+  writeDevice(w, dev);
+  w.key("o");
+  w.beginObject();
+  w.member("name", kOriginName);
+  w.member("sw", kOriginVersion);
+  w.member("url", kOriginUrl);
+  w.endObject();
+  if (isBridged(dev)) {
+    writeBridgedAvailability(w, dev, false);
+  } else {
+    writeTopic(w, dev, "avty_t", nullptr, nullptr, "status", false);
+    writePayload(w, "pl_avail", kAvailOnline, kAvailOnline);
+    writePayload(w, "pl_not_avail", kAvailOffline, kAvailOffline);
+  }
+  w.key("cmps");
+  w.beginObject();
+  for (size_t i = first; i < last; i++) {
+    const Entity& e = _entities[dev.entities[i]];
+    if (!isDeviceComponent(e)) {
+      continue;
+    }
+    w.key(e.common().object_id);
+    w.beginObject();
+    w.member("p", componentName(e.component));
+    // A component holding only its platform key is removed by Home Assistant.
+    if (e.active) {
+      writeEntityConfig(w, e, true);
+    }
+    w.endObject();
+  }
+  w.endObject();
+  w.endObject();
+}
+
+size_t HaDiscovery::nextDeviceChunk(const Device& dev, size_t first) const {
+  if (_deviceChunkSize == 0) {
+    return dev.entities.size();
+  }
+
+  // Size of a chunk with an empty cmps object, then add components while they fit.
+  HaJsonWriter empty(nullptr, 0);
+  writeDeviceConfig(empty, dev, first, first);
+  size_t total = empty.length();
+
+  size_t count = 0;
+  size_t i = first;
+  for (; i < dev.entities.size(); i++) {
+    if (!isDeviceComponent(_entities[dev.entities[i]])) {
+      continue;
+    }
+    HaJsonWriter one(nullptr, 0);
+    writeDeviceConfig(one, dev, i, i + 1);
+    size_t componentLen = one.length() - empty.length() + (count ? 1 : 0);
+    if (count > 0 && total + componentLen > _deviceChunkSize) {
+      break;
+    }
+    total += componentLen;
+    count++;
+  }
+  return i;
+}
+
+bool HaDiscovery::buildDeviceConfigTopic(char* out, size_t outLen, const Device& dev, size_t chunk) const {
+  // homeassistant/device/<node_id>[_<chunk>]/config
+  int n = chunk == 0
+    ? snprintf(out, outLen, "%s/device/%s/config", _discoveryPrefix.c_str(), dev.info.node_id)
+    : snprintf(out, outLen, "%s/device/%s_%u/config", _discoveryPrefix.c_str(), dev.info.node_id, (unsigned)chunk);
+  return n > 0 && static_cast<size_t>(n) < outLen;
+}
+
+bool HaDiscovery::publishDeviceChunk(const Device& dev, size_t first, size_t last, size_t chunk) {
+  char topic[TOPIC_BUF];
+  if (!buildDeviceConfigTopic(topic, sizeof(topic), dev, chunk)) {
+    return false;
+  }
+
+  bool ok = publishJson(topic, true, 1, [&](HaJsonWriter& w) {
+    writeDeviceConfig(w, dev, first, last);
+  });
+  if (!ok) {
+    return false;
+  }
+
+  for (size_t i = first; i < last; i++) {
+    _entities[dev.entities[i]].removePending = false;
+  }
+  return true;
+}
+
+bool HaDiscovery::pressButton(const char* object_id, const char* payload, bool retained, uint8_t qos) {
+  const char* node = _devices[0].info.node_id;
+  if (!node || !object_id) {
+    return false;
+  }
+
+  char topic[TOPIC_BUF];
+  int n = snprintf(topic, sizeof(topic), "%s/%s/%s/set", _baseTopicPrefix.c_str(), node, object_id);
+  if (n < 0 || static_cast<size_t>(n) >= sizeof(topic)) {
+    return false;
+  }
 
   const char* p = payload ? payload : kPress;
-  return _transport.publish(cmdTopic.c_str(),
-                   reinterpret_cast<const uint8_t*>(p),
-                   strlen(p),
-                   retained,
-                   qos);
+  return sendMessage(HaMetricCategory::Command, topic,
+                     reinterpret_cast<const uint8_t*>(p),
+                     strlen(p),
+                     retained,
+                     qos);
 }
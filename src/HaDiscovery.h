@@ -2,8 +2,18 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
+#include <vector>
+#include "HaNumberFormat.h"
+#include "HaSlotVector.h"
+#include "transport/MqttMutex.h"
 #include "transport/MqttTransport.h"
 
+class HaJsonWriter;
+class HaManifestStorage;
+template <typename Cfg, size_t N> struct HaStaticEntity;
+template <size_t N, size_t Devices, size_t TopicBytes> class HaEntityTable;
+
 /**
  * @defgroup hadiscovery Home Assistant MQTT Discovery
  * @brief Publish Home Assistant MQTT Discovery config payloads via an abstract MQTT transport.
@@ -16,10 +26,49 @@
  * - Publishes availability ("online"/"offline")
  * - Provides default topic conventions with per-entity overrides
  * - Supports removal of entities by publishing an empty retained config payload
+ * - Remembers published entities and re-publishes their configs after a reconnect
+ * - Optional device-based discovery: one config message per device instead of one per entity
+ * - Bridge mode: one instance publishes entities for any number of devices over one transport
+ * - Optional compact configs: `~` topic abbreviation and no keys equal to Home Assistant defaults
  *
  * @{
  */
 
+/**
+ * @brief Home Assistant component types supported by HaDiscovery.
+ */
+enum class HaComponent : uint8_t {
+  Sensor,        /**< "sensor" */
+  Switch,        /**< "switch" */
+  BinarySensor,  /**< "binary_sensor" */
+  Button,        /**< "button" */
+  Number,        /**< "number" */
+  Select,        /**< "select" */
+  Light,         /**< "light" (JSON schema) */
+  Cover,         /**< "cover" */
+  Climate        /**< "climate" */
+};
+
+/**
+ * @brief How Discovery configs are published.
+ */
+enum class HaDiscoveryMode : uint8_t {
+  /** One retained config per entity on `<prefix>/<component>/<node_id>/<object_id>/config`. */
+  Entity,
+  /** One retained device config with a `cmps` map on `<prefix>/device/<node_id>/config`. */
+  Device
+};
+
+/**
+ * @brief How Discovery config payloads are written.
+ */
+enum class HaConfigFormat : uint8_t {
+  /** Every topic spelled out and every payload key present. */
+  Full,
+  /** `~` base topic abbreviation and no keys whose value equals the Home Assistant default. */
+  Compact
+};
+
 /**
  * @brief Home Assistant device information for the "dev" block in MQTT Discovery payloads.
  */
@@ -76,6 +125,9 @@ struct HaEntityCommon {
    * `<baseTopicPrefix>/<node_id>/status`.
    */
   const char* availability_topic_override = nullptr;
+
+  /** @brief Optional entity category ("config" or "diagnostic"). */
+  const char* entity_category = nullptr;
 };
 
 /**
@@ -154,6 +206,342 @@ struct HaButtonConfig {
   const char* payload_press = nullptr;
 };
 
+/**
+ * @brief Configuration for a Home Assistant MQTT Discovery number.
+ *
+ * Home Assistant publishes the new value as text to the command topic.
+ */
+struct HaNumberConfig {
+  HaEntityCommon common;
+
+  /** @brief Optional override for command_topic (default `<baseTopicPrefix>/<node_id>/<object_id>/set`). */
+  const char* command_topic_override = nullptr;
+
+  /** @brief Optional unit of measurement (e.g. "s"). */
+  const char* unit_of_measurement = nullptr;
+
+  /** @brief Optional device_class (e.g. "temperature"). */
+  const char* device_class = nullptr;
+
+  /** @brief Optional control shown in the UI: "auto", "box" or "slider". */
+  const char* mode = nullptr;
+
+  /** @brief Minimum value (Home Assistant default 1). */
+  float min = 1.0f;
+
+  /** @brief Maximum value (Home Assistant default 100). */
+  float max = 100.0f;
+
+  /** @brief Step between values (Home Assistant default 1). */
+  float step = 1.0f;
+};
+
+/**
+ * @brief Configuration for a Home Assistant MQTT Discovery select.
+ *
+ * Home Assistant publishes the selected option to the command topic.
+ */
+struct HaSelectConfig {
+  HaEntityCommon common;
+
+  /** @brief Optional override for command_topic (default `<baseTopicPrefix>/<node_id>/<object_id>/set`). */
+  const char* command_topic_override = nullptr;
+
+  /** @brief Options to choose from, terminated by nullptr (required). */
+  const char* const* options = nullptr;
+};
+
+/**
+ * @brief Configuration for a Home Assistant MQTT Discovery light, using the JSON schema.
+ *
+ * State and commands are JSON objects such as `{"state":"ON","brightness":128}`, so a
+ * single command topic carries on/off, brightness and color.
+ */
+struct HaLightConfig {
+  HaEntityCommon common;
+
+  /** @brief Optional override for command_topic (default `<baseTopicPrefix>/<node_id>/<object_id>/set`). */
+  const char* command_topic_override = nullptr;
+
+  /** @brief Optional color modes (e.g. "brightness", "rgb"), terminated by nullptr; nullptr for on/off only. */
+  const char* const* supported_color_modes = nullptr;
+
+  /** @brief Brightness value that means 100% (Home Assistant default 255). */
+  uint16_t brightness_scale = 255;
+};
+
+/**
+ * @brief Configuration for a Home Assistant MQTT Discovery cover.
+ */
+struct HaCoverConfig {
+  HaEntityCommon common;
+
+  /** @brief Optional override for command_topic (default `<baseTopicPrefix>/<node_id>/<object_id>/set`). */
+  const char* command_topic_override = nullptr;
+
+  /** @brief Optional device_class (e.g. "garage", "shutter"). */
+  const char* device_class = nullptr;
+
+  /** @brief Command payload to open (default "OPEN" if nullptr). */
+  const char* payload_open = nullptr;
+
+  /** @brief Command payload to close (default "CLOSE" if nullptr). */
+  const char* payload_close = nullptr;
+
+  /** @brief Command payload to stop (default "STOP" if nullptr). */
+  const char* payload_stop = nullptr;
+
+  /** @brief State payload when open (default "open" if nullptr). */
+  const char* state_open = nullptr;
+
+  /** @brief State payload when closed (default "closed" if nullptr). */
+  const char* state_closed = nullptr;
+};
+
+/**
+ * @brief Configuration for a Home Assistant MQTT Discovery climate (HVAC) entity.
+ *
+ * The entity's state and command topics carry the HVAC mode. Temperature topics are
+ * optional and used as given; receive target temperature commands by subscribing to
+ * temperature_command_topic (see HaDiscovery::setOnUnhandledMessage()).
+ */
+struct HaClimateConfig {
+  HaEntityCommon common;
+
+  /** @brief Optional override for mode_command_topic (default `<baseTopicPrefix>/<node_id>/<object_id>/set`). */
+  const char* command_topic_override = nullptr;
+
+  /** @brief Optional supported HVAC modes (e.g. "off", "heat"), terminated by nullptr; nullptr for all. */
+  const char* const* modes = nullptr;
+
+  /** @brief Optional topic Home Assistant publishes the target temperature to. */
+  const char* temperature_command_topic = nullptr;
+
+  /** @brief Optional topic the device publishes the target temperature to. */
+  const char* temperature_state_topic = nullptr;
+
+  /** @brief Optional topic the device publishes the measured temperature to. */
+  const char* current_temperature_topic = nullptr;
+
+  /** @brief Optional temperature unit, "C" or "F" (Home Assistant uses the system unit if nullptr). */
+  const char* temperature_unit = nullptr;
+
+  /** @brief Minimum target temperature (Home Assistant default 7, in °C). */
+  float min_temp = 7.0f;
+
+  /** @brief Maximum target temperature (Home Assistant default 35, in °C). */
+  float max_temp = 35.0f;
+
+  /** @brief Target temperature step (Home Assistant default 1). */
+  float temp_step = 1.0f;
+};
+
+/**
+ * @brief Reference to a registered entity.
+ *
+ * Returned by the register*() methods and entityHandle(). The entity's state and command
+ * topics are resolved once at registration, so publishing through a handle does not build
+ * any topic strings. A handle is invalidated when its entity is removed with removeEntity().
+ */
+struct HaEntityHandle {
+  /** @brief Construct an invalid handle. */
+  HaEntityHandle() = default;
+
+  /** @brief Construct a handle for a registry index. */
+  explicit HaEntityHandle(uint16_t i) : index(i) {}
+
+  /** @brief Index into the entity registry. */
+  uint16_t index = 0xFFFF;
+
+  /** @brief Check whether this handle refers to an entity. */
+  bool valid() const { return index != 0xFFFF; }
+};
+
+/**
+ * @brief Reference to a device known to HaDiscovery.
+ *
+ * The device set with HaDiscovery::setDevice() is the primary device (see
+ * HaDiscovery::primaryDevice()); methods without a device argument act on it.
+ * Further devices are added with HaDiscovery::addDevice().
+ */
+struct HaDeviceHandle {
+  /** @brief Construct an invalid handle. */
+  HaDeviceHandle() = default;
+
+  /** @brief Construct a handle for a device index. */
+  explicit HaDeviceHandle(uint16_t i) : index(i) {}
+
+  /** @brief Index into the device list. */
+  uint16_t index = 0xFFFF;
+
+  /** @brief Check whether this handle refers to a device. */
+  bool valid() const { return index != 0xFFFF; }
+};
+
+/**
+ * @brief Per-entity change detection settings for state publishes.
+ *
+ * A state publish is skipped when it would not tell Home Assistant anything new:
+ * - the payload equals the last sent payload (if suppress_unchanged is set), or
+ * - both payloads are numbers and differ by less than the deadband.
+ *
+ * The deadband is the larger of abs_deadband and rel_deadband * |last sent value|, always
+ * measured against the last value actually sent so slow drift is eventually published.
+ * A non-zero heartbeat_ms forces a publish when the last one is older than that.
+ */
+struct HaStateFilter {
+  /** @brief Skip payloads identical to the last sent one. */
+  bool suppress_unchanged = true;
+
+  /** @brief Absolute numeric deadband (0 disables). */
+  float abs_deadband = 0.0f;
+
+  /** @brief Relative numeric deadband as a fraction of the last sent value, e.g. 0.01 for 1% (0 disables). */
+  float rel_deadband = 0.0f;
+
+  /** @brief Maximum interval between publishes in milliseconds (0 disables the heartbeat). */
+  uint32_t heartbeat_ms = 0;
+};
+
+/**
+ * @brief Counters of state publishes made through an entity handle.
+ */
+struct HaStateStats {
+  /** @brief Publishes passed to the transport. */
+  uint32_t sent = 0;
+
+  /** @brief Publishes skipped by the state filter. */
+  uint32_t suppressed = 0;
+};
+
+/**
+ * @brief Handler for commands sent by Home Assistant to a switch or button.
+ *
+ * @param ctx     User context pointer passed to HaDiscovery::setCommandHandler()
+ * @param handle  Entity the command is for
+ * @param payload Command payload, null-terminated (e.g. "ON", "OFF", "PRESS")
+ * @param len     Payload length in bytes
+ */
+typedef void (*HaCommandHandler)(void* ctx, HaEntityHandle handle, const char* payload, size_t len);
+
+/**
+ * @brief Kinds of messages published by HaDiscovery, for HaMetrics.
+ */
+enum class HaMetricCategory : uint8_t {
+  Config,        /**< Discovery configs, including empty removal configs */
+  State,         /**< Entity states */
+  Availability,  /**< "online"/"offline" */
+  Command        /**< Commands sent by pressButton() */
+};
+
+/** @brief Number of HaMetricCategory values. */
+static constexpr size_t HA_METRIC_CATEGORIES = 4;
+
+/** @brief Number of buckets in the HaMetrics histograms. */
+static constexpr size_t HA_METRIC_BUCKETS = 8;
+
+/** @brief Upper bounds (exclusive) of the publish time histogram buckets; the last bucket has no bound. */
+static constexpr uint32_t HA_PUBLISH_TIME_BOUNDS_US[HA_METRIC_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 5000, 20000 };
+
+/**
+ * @brief Upper bounds (inclusive) of the config size histogram buckets; the last bucket has no bound.
+ *
+ * 767 bytes is the largest config that is built in the stack buffer instead of being streamed.
+ */
+static constexpr uint32_t HA_CONFIG_SIZE_BOUNDS[HA_METRIC_BUCKETS - 1] = { 128, 256, 384, 512, 640, 767, 1024 };
+
+/**
+ * @brief Message counters for one HaMetricCategory.
+ */
+struct HaMessageCounters {
+  /** @brief Messages accepted by the transport. */
+  uint32_t messages = 0;
+
+  /** @brief Payload bytes of the accepted messages. */
+  uint32_t bytes = 0;
+
+  /** @brief Messages the transport rejected. */
+  uint32_t failures = 0;
+};
+
+/**
+ * @brief Snapshot of what HaDiscovery has cost so far (see HaDiscovery::metrics()).
+ */
+struct HaMetrics {
+  /** @brief Counters per HaMetricCategory, indexed by its value. */
+  HaMessageCounters category[HA_METRIC_CATEGORIES];
+
+  /** @brief Commands received and dispatched to a handler. */
+  uint32_t commands_received = 0;
+
+  /** @brief Payload bytes of the received commands. */
+  uint32_t command_bytes_received = 0;
+
+  /** @brief Bytes of JSON and numeric text produced, including configs hashed for the manifest. */
+  uint32_t formatted_bytes = 0;
+
+  /** @brief Total time spent in transport publish calls, in microseconds. */
+  uint32_t publish_time_us = 0;
+
+  /** @brief Longest single publish call, in microseconds. */
+  uint32_t publish_time_max_us = 0;
+
+  /** @brief Publish calls by duration; see HA_PUBLISH_TIME_BOUNDS_US. */
+  uint32_t publish_time_histogram[HA_METRIC_BUCKETS] = {};
+
+  /** @brief Largest discovery config produced, in bytes. */
+  uint32_t largest_config = 0;
+
+  /** @brief Size of the stack buffer for configs; larger configs are streamed. */
+  uint32_t config_buffer = 0;
+
+  /** @brief Configs that did not fit in config_buffer and were streamed. */
+  uint32_t streamed_configs = 0;
+
+  /** @brief Discovery configs by size; see HA_CONFIG_SIZE_BOUNDS. */
+  uint32_t config_size_histogram[HA_METRIC_BUCKETS] = {};
+
+  /** @brief Acknowledgement statistics reported by the transport. */
+  MqttAckStats ack;
+
+  /** @brief QoS > 0 publishes the transport is still waiting on. */
+  size_t pending_publishes = 0;
+
+  /** @brief Counters for one category. */
+  const HaMessageCounters& operator[](HaMetricCategory c) const {
+    return category[static_cast<size_t>(c)];
+  }
+
+  /** @brief Messages accepted by the transport over all categories. */
+  uint32_t totalMessages() const;
+
+  /** @brief Payload bytes accepted by the transport over all categories. */
+  uint32_t totalBytes() const;
+
+  /** @brief Messages rejected by the transport over all categories. */
+  uint32_t totalFailures() const;
+};
+
+/**
+ * @brief Progress of the discovery re-publish (see HaDiscovery::discoveryProgress()).
+ */
+struct HaDiscoveryProgress {
+  /** @brief Configs handled so far: published, or skipped because the manifest says they are unchanged. */
+  size_t done = 0;
+
+  /** @brief Configs in the re-publish. */
+  size_t total = 0;
+
+  /** @brief Payload bytes published by the re-publish so far, availability included. */
+  size_t bytes = 0;
+
+  /** @brief tick() calls that published part of it. */
+  uint32_t ticks = 0;
+
+  /** @brief true while the re-publish is running. */
+  bool active = false;
+};
+
 /**
  * @brief Home Assistant MQTT Discovery publisher (transport-agnostic).
  *
@@ -161,10 +549,17 @@ struct HaButtonConfig {
  * - Construct with a MqttTransport implementation
  * - Provide device info via setDevice()
  * - Publish discovery configs (retained)
- * - Publish states as needed
+ * - Publish states as needed, preferably through an HaEntityHandle
+ *
+ * Every entity published through one of the publish*Discovery() methods is kept in an
+ * internal registry. When the transport reconnects, the registered configs are re-published
+ * a few at a time from tick() and availability is published last, so a broker restart does
+ * not require the firmware to replay its discovery calls.
  *
  * For async transports, onConnect is invoked automatically.
  * For sync transports, call tick() periodically to detect reconnection transitions.
+ * Both kinds of transport need tick() to be called: the resubscribe and re-publish after a
+ * connect run from it, never from the MQTT client's callback.
  */
 class HaDiscovery {
 public:
@@ -181,6 +576,27 @@ public:
               const char* base_topic_prefix = "devices",
               LogLevel log_level = LogLevel::LOG_LEVEL_INFO);
 
+  /**
+   * @brief Construct a publisher that logs through a caller-owned logger.
+   *
+   * Nothing is allocated for logging, so together with registering all entities during
+   * setup this keeps HaDiscovery free of heap use afterwards (see README, "Static allocation").
+   *
+   * @param transport         MQTT transport adapter
+   * @param logger            Logger to use; must outlive the publisher
+   * @param discovery_prefix  Home Assistant discovery prefix (default "homeassistant")
+   * @param base_topic_prefix Base topic prefix for device topics (default "devices")
+   */
+  HaDiscovery(MqttTransport& transport,
+              JBLogger& logger,
+              const char* discovery_prefix = "homeassistant",
+              const char* base_topic_prefix = "devices");
+
+  ~HaDiscovery();
+
+  HaDiscovery(const HaDiscovery&) = delete;
+  HaDiscovery& operator=(const HaDiscovery&) = delete;
+
   /**
    * @brief Set the minimum log level for the internal logger.
    *
@@ -193,127 +609,836 @@ public:
    *
    * This must be called before publishing discovery configs if you want correct device registry behavior.
    *
+   * Also sets the transport's Last Will and Testament to a retained "offline" on the
+   * availability topic (see MqttTransport::setWill()). Call it before connecting so the
+   * broker marks the device unavailable when the connection drops without a clean shutdown.
+   *
    * @param dev Device info struct (pointers must remain valid)
    */
   void setDevice(const HaDeviceInfo& dev);
 
   /**
-   * @brief Periodic processing hook.
+   * @brief Handle of the primary device, the one set with setDevice().
    *
-   * For synchronous MQTT clients (e.g. PubSubClient), call this from loop().
-   * For asynchronous clients, this is typically not required but harmless.
+   * @return Device handle (always valid)
    */
-  void tick();
+  HaDeviceHandle primaryDevice() const { return HaDeviceHandle(0); }
 
   /**
-   * @brief Publish "online" availability payload to the availability topic (retained by default).
+   * @brief Add a device whose entities are published by this instance (bridge/gateway mode).
    *
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for availability if supported)
+   * Each device has its own node_id, `dev` block, availability topic
+   * (`<base>/<node_id>/status`) and entity registry, so object_ids only need to be unique
+   * per device. Register entities on it with the register*()/publish*Discovery() overloads
+   * that take a device handle, and publish states through the returned entity handles.
+   *
+   * When the primary device has a node_id, entities of added devices list both availability
+   * topics with `avty_mode` "all": they become unavailable when the gateway or the device
+   * itself goes offline. Availability of added devices is published after their configs
+   * during the paced re-publish after a connect, and right away when added while connected.
+   *
+   * Adding a node_id that is already known updates that device instead.
+   *
+   * @param dev Device info (pointers must remain valid)
+   * @return Handle to the device, invalid if node_id is missing
    */
-  void publishAvailabilityOnline(bool retained = true, uint8_t qos = 1);
+  HaDeviceHandle addDevice(const HaDeviceInfo& dev);
 
   /**
-   * @brief Publish "offline" availability payload to the availability topic (retained by default).
+   * @brief Look up a device by node_id.
    *
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for availability if supported)
+   * This searches the device list; keep the handle returned by addDevice() instead of
+   * calling this per publish.
+   *
+   * @param node_id Device node_id
+   * @return Handle to the device, invalid if no device has that node_id
    */
-  void publishAvailabilityOffline(bool retained = true, uint8_t qos = 1);
+  HaDeviceHandle deviceHandle(const char* node_id) const;
 
   /**
-   * @brief Publish a sensor Discovery config (retained by default).
+   * @brief Number of devices, including the primary device.
    *
-   * @param cfg      Sensor configuration
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for discovery if supported)
-   * @return true if publish was accepted by transport, false otherwise
+   * @return Device count
    */
-  bool publishSensorDiscovery(const HaSensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+  size_t deviceCount() const;
 
   /**
-   * @brief Publish a switch Discovery config (retained by default).
+   * @brief Periodic processing hook.
    *
-   * @param cfg      Switch configuration
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for discovery if supported)
-   * @return true if publish was accepted by transport, false otherwise
+   * For synchronous MQTT clients (e.g. PubSubClient), call this from loop().
+   * For asynchronous clients, this handles a connect reported by the client's task
+   * (resubscribe, re-publish) and drives the paced re-publish of registered discovery configs.
    */
-  bool publishSwitchDiscovery(const HaSwitchConfig& cfg, bool retained = true, uint8_t qos = 1);
+  void tick();
 
   /**
-   * @brief Publish a binary_sensor Discovery config (retained by default).
+   * @brief Set the millisecond clock used for time-based features (e.g. state heartbeats).
    *
-   * @param cfg      Binary sensor configuration
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for discovery if supported)
-   * @return true if publish was accepted by transport, false otherwise
+   * Defaults to millis() on Arduino and a steady clock on native builds.
+   *
+   * @param millis_fn Function returning a free-running millisecond counter
    */
-  bool publishBinarySensorDiscovery(const HaBinarySensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+  void setClock(uint32_t (*millis_fn)());
 
   /**
-   * @brief Publish a button Discovery config (retained by default).
+   * @brief Set how many registered discovery configs are re-published per tick() after a reconnect.
    *
-   * @param cfg      Button configuration
-   * @param retained Retain flag (recommended true)
-   * @param qos      QoS level (recommended 1 for discovery if supported)
-   * @return true if publish was accepted by transport, false otherwise
+   * Spreading the re-publish over several tick() calls keeps a fleet of devices from
+   * flooding the broker when it restarts.
+   *
+   * Transports that track acknowledgements (see MqttTransport::publishWindow()) are instead
+   * kept at their in-flight window: each tick() publishes as many configs as there are free
+   * window slots, so the next config goes out as soon as an earlier one is acknowledged.
+   *
+   * @param configs_per_tick Maximum configs published per tick() (0 is treated as 1)
    */
-  bool publishButtonDiscovery(const HaButtonConfig& cfg, bool retained = true, uint8_t qos = 1);
-
+  void setRepublishPace(size_t configs_per_tick);
 
   /**
-   * @brief Remove an entity from Home Assistant by clearing its retained config topic.
+   * @brief Limit the time and bytes one tick() spends on the discovery re-publish.
    *
-   * Home Assistant removes the entity when the Discovery config topic is published
-   * with an empty payload and retain=true.
+   * A synchronous transport such as PubSubClient blocks in every publish, so a long burst of
+   * configs stalls loop(). With a budget, tick() stops publishing once either limit is reached,
+   * in addition to the setRepublishPace() count, and continues on the next call. Each tick()
+   * publishes at least one message, so a tick can exceed the budget by one message. Use
+   * `setRepublishPace(SIZE_MAX)` to let the budget alone decide.
    *
-   * @param component Component name (e.g. "sensor", "switch")
-   * @param object_id Entity object_id used in the config topic
-   * @param qos       QoS level (recommended 1 if supported)
-   * @return true if publish was accepted by transport, false otherwise
+   * Time is measured with the clock set by setClock().
+   *
+   * @param max_ms    Milliseconds per tick() (0 for no limit)
+   * @param max_bytes Payload bytes per tick() (0 for no limit)
    */
-  bool removeEntity(const char* component, const char* object_id, uint8_t qos = 1);
+  void setRepublishBudget(uint32_t max_ms, size_t max_bytes);
 
   /**
-   * @brief Publish an entity state payload using default state topic for object_id.
+   * @brief Progress of the current or last discovery re-publish.
    *
-   * @param object_id Entity object_id
-   * @param payload   Null-terminated payload string
-   * @param retained  Retain flag (usually false for state)
-   * @param qos       QoS level (usually 0 for state)
-   * @return true if publish was accepted by transport, false otherwise
+   * @return Progress snapshot
    */
-  bool publishState(const char* object_id, const char* payload, bool retained = false, uint8_t qos = 0);
+  HaDiscoveryProgress discoveryProgress() const;
 
   /**
-   * @brief Publish a switch state ("ON"/"OFF") using default state topic.
+   * @brief Register a callback invoked when a discovery re-publish completes.
    *
-   * @param object_id Entity object_id
-   * @param on        true -> "ON", false -> "OFF"
-   * @param retained  Retain flag (usually false)
-   * @param qos       QoS level (usually 0)
-   * @return true if publish was accepted by transport, false otherwise
+   * It runs from tick() after the last config and the availability, so the device is shown
+   * online once its configs are in place. A re-publish cut short by a disconnect does not
+   * complete; the next connect starts it over.
+   *
+   * @param cb  Callback function, or nullptr
+   * @param ctx User context pointer passed back to the callback
    */
-  bool publishStateSwitch(const char* object_id, bool on, bool retained = false, uint8_t qos = 0);
+  void setOnDiscoveryComplete(void (*cb)(void*), void* ctx = nullptr);
 
   /**
-   * @brief Publish a button "press" command to the default command topic.
+   * @brief Re-publish all registered discovery configs, paced over subsequent tick() calls.
    *
-   * @param object_id Entity object_id
-   * @param payload   Payload string to publish (if nullptr uses default "PRESS")
-   * @param retained  Retain flag (usually false)
-   * @param qos       QoS level (usually 0 or 1)
-   * @return true if publish was accepted by transport, false otherwise
+   * This is done automatically on every transport connect.
    */
-  bool pressButton(const char* object_id, const char* payload = nullptr, bool retained = false, uint8_t qos = 0);
-
-  // Convenience overloads for std::string parameters
+  void republishDiscovery();
 
-  /** @brief Overload of removeEntity using std::string. */
-  inline bool removeEntity(const std::string& component, const std::string& object_id, uint8_t qos = 1) {
-    return removeEntity(component.c_str(), object_id.c_str(), qos);
-  }
+  /**
+   * @brief Remember published configs across reboots and skip the ones that did not change.
+   *
+   * A manifest holds a hash of the last published config per (component, object_id). With it:
+   * - on the first replay after boot, retained configs whose hash matches are not published
+   *   again; later reconnects publish every config, as the broker may have lost them
+   * - after each connect replay, entities in the manifest that are no longer registered are
+   *   removed from Home Assistant with an empty retained config
+   * - the manifest is saved after the replay if anything changed
+   *
+   * Register all entities before the first connect, otherwise entities registered later are
+   * removed and re-added. Skipping on boot relies on the broker keeping retained configs while
+   * the device was offline; call clearManifest() to force a full publish on the next replay.
+   *
+   * Applies to HaDiscoveryMode::Entity; device-based discovery always publishes its configs.
+   *
+   * @param storage Storage backend (must outlive this object), or nullptr to disable
+   */
+  void setManifestStorage(HaManifestStorage* storage);
+
+  /**
+   * @brief Save the manifest now if it changed (it is also saved after each connect replay).
+   *
+   * @return true if nothing needed saving or saving succeeded
+   */
+  bool saveManifest();
+
+  /**
+   * @brief Forget all stored hashes so the next replay publishes every config.
+   *
+   * Stale-entity detection starts over as well.
+   */
+  void clearManifest();
+
+  /**
+   * @brief Select entity-based (default) or device-based Discovery.
+   *
+   * In device mode all registered entities are published as components of a single
+   * `<prefix>/device/<node_id>/config` message, sharing one `dev` block and one availability
+   * topic. publish*Discovery() then only registers the entity; the device config is published
+   * from the next tick(), so registering many entities in a row still results in one message.
+   * Select the mode before registering entities. Entities previously published in entity mode
+   * are not migrated; remove them with removeEntity() first if needed.
+   *
+   * @param mode Discovery mode
+   */
+  void setDiscoveryMode(HaDiscoveryMode mode);
+
+  /**
+   * @brief Currently selected Discovery mode.
+   *
+   * @return Discovery mode
+   */
+  HaDiscoveryMode discoveryMode() const;
+
+  /**
+   * @brief Select full (default) or compact Discovery config payloads.
+   *
+   * Compact configs leave out `pl_avail`/`pl_not_avail`, `pl_on`/`pl_off` and `pl_prs` when
+   * they equal the Home Assistant defaults ("online"/"offline", "ON"/"OFF", "PRESS"). In entity
+   * mode they also set `~` to `<base>/<node_id>` and abbreviate the topics below it, e.g.
+   * `"stat_t":"~/temperature/state"`. Device-based configs share one availability topic and
+   * have about one topic per component, so there only the defaults are left out.
+   *
+   * Applies to published configs and to the build*ConfigJson() functions. Changing the
+   * format changes the manifest hashes, so all configs are published once more.
+   *
+   * @param format Config format
+   */
+  void setConfigFormat(HaConfigFormat format);
+
+  /**
+   * @brief Currently selected config format.
+   *
+   * @return Config format
+   */
+  HaConfigFormat configFormat() const;
+
+  /**
+   * @brief Limit the size of device-based Discovery messages.
+   *
+   * When set, the device config is split into several messages of at most this many bytes,
+   * published on `<prefix>/device/<node_id>_<n>/config` for chunk n > 0. Each chunk carries the
+   * full `dev` block, so Home Assistant attaches all of them to the same device.
+   * A single component larger than the limit still gets a chunk of its own.
+   *
+   * @param max_bytes Maximum payload size per message, 0 for a single message (default)
+   */
+  void setDeviceChunkSize(size_t max_bytes);
+
+  /**
+   * @brief Publish the device-based Discovery config for all registered entities right away.
+   *
+   * @return true if all chunks were accepted by the transport, false otherwise
+   */
+  bool publishDeviceDiscovery();
+
+  /**
+   * @brief Check whether a paced re-publish of registered configs is still in progress.
+   *
+   * @return true if configs remain to be re-published, including after a connect that tick()
+   *         has not handled yet
+   */
+  bool isRepublishing() const;
+
+  /**
+   * @brief Check whether the last discovery burst has been delivered.
+   *
+   * true once all configs have been handed to the transport and the transport has nothing left
+   * queued or awaiting acknowledgement. With transports that do not track acknowledgements
+   * this is the same as !isRepublishing().
+   *
+   * @return true if discovery is complete
+   */
+  bool isDiscoveryDelivered() const;
+
+  /**
+   * @brief Number of entities currently held in the registry.
+   *
+   * @return Registered entity count
+   */
+  size_t entityCount() const;
+
+  /**
+   * @brief Size of the largest registered discovery config that is published in one piece.
+   *
+   * Each config is measured without being published. Configs too large for the internal
+   * buffer are streamed and only count with their topic.
+   *
+   * @param topic_len   Set to the topic length of that config
+   * @param payload_len Set to its payload length
+   * @return topic_len + payload_len (0 if nothing is registered)
+   */
+  size_t largestConfigMessage(size_t& topic_len, size_t& payload_len) const;
+
+  /**
+   * @brief Size the transport's packet buffer for the largest registered config.
+   *
+   * Measures with largestConfigMessage() and passes the result to
+   * MqttTransport::reservePublishSize(), so a PubSubClient buffer is allocated once with the
+   * exact size instead of a guessed setBufferSize(). This is done automatically before each
+   * re-publish (on connect included) when registrations changed since the last successful
+   * reservation. Call it after registering entities to allocate early, before the heap
+   * fragments. Configs published in between that are larger still grow the buffer before they
+   * are sent.
+   *
+   * @return false if the transport could not provide the buffer (the required size is logged)
+   */
+  bool reserveTransportBuffer();
+
+  /**
+   * @brief Publish "online" availability payload to the availability topic (retained by default).
+   *
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for availability if supported)
+   */
+  void publishAvailabilityOnline(bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish "offline" availability payload to the availability topic (retained by default).
+   *
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for availability if supported)
+   */
+  void publishAvailabilityOffline(bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish "online" availability for a device added with addDevice().
+   *
+   * @param device   Device handle
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for availability if supported)
+   */
+  void publishAvailabilityOnline(HaDeviceHandle device, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish "offline" availability for a device added with addDevice(), e.g. when a
+   * meter behind the gateway stops responding.
+   *
+   * @param device   Device handle
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for availability if supported)
+   */
+  void publishAvailabilityOffline(HaDeviceHandle device, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Keep the entity registry in a fixed-capacity HaEntityTable instead of on the heap.
+   *
+   * Registration, lookup by object_id, command dispatch and the re-publish after a connect then
+   * use only the table. Registering more entities than it holds fails with an invalid handle;
+   * HaEntityTable::registerStatic() checks the count at compile time. Must be called before any
+   * entity is registered.
+   *
+   * @param table Table that outlives this instance (see HaEntityTable.h)
+   * @return false if entities are already registered or more devices exist than the table holds
+   */
+  template <size_t N, size_t Devices, size_t TopicBytes>
+  bool setEntityTable(HaEntityTable<N, Devices, TopicBytes>& table) {
+    return useEntityStorage(table.storage());
+  }
+
+  /**
+   * @brief Register a sensor without publishing its Discovery config.
+   *
+   * The config is published on the next connect or republishDiscovery(). Registering an
+   * object_id that already exists replaces its config and keeps its handle.
+   * All string pointers in the config must remain valid for as long as the entity is registered.
+   *
+   * @param cfg      Sensor configuration
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if device info or object_id is missing
+   */
+  HaEntityHandle registerSensor(const HaSensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Register a switch without publishing its Discovery config, see registerSensor().
+   *
+   * @param cfg      Switch configuration
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if device info or object_id is missing
+   */
+  HaEntityHandle registerSwitch(const HaSwitchConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Register a binary_sensor without publishing its Discovery config, see registerSensor().
+   *
+   * @param cfg      Binary sensor configuration
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if device info or object_id is missing
+   */
+  HaEntityHandle registerBinarySensor(const HaBinarySensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Register a button without publishing its Discovery config, see registerSensor().
+   *
+   * @param cfg      Button configuration
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if device info or object_id is missing
+   */
+  HaEntityHandle registerButton(const HaButtonConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Register a sensor of another device, see registerSensor() and addDevice().
+   *
+   * @param device   Device handle
+   * @param cfg      Sensor configuration
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if the device, its node_id or the object_id is missing
+   */
+  HaEntityHandle registerSensor(HaDeviceHandle device, const HaSensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a switch of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerSwitch(HaDeviceHandle device, const HaSwitchConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a binary_sensor of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerBinarySensor(HaDeviceHandle device, const HaBinarySensorConfig& cfg, bool retained = true,
+                                      uint8_t qos = 1);
+
+  /** @brief Register a button of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerButton(HaDeviceHandle device, const HaButtonConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Register a compile-time entity schema without publishing its Discovery config.
+   *
+   * The invariant part of the config was serialized by the compiler (see HaStaticEntity.h),
+   * so publishing only adds uniq_id, topics, availability, numbers, defaulted payloads and the
+   * device block. Any component config can be used.
+   *
+   * @param entity   Schema declared with HA_STATIC_ENTITY() (must have static storage)
+   * @param retained Retain flag used when publishing the config
+   * @param qos      QoS level used when publishing the config
+   * @return Handle to the entity, invalid if device info or object_id is missing
+   */
+  template <typename Cfg, size_t N>
+  HaEntityHandle registerStatic(const HaStaticEntity<Cfg, N>& entity, bool retained = true, uint8_t qos = 1) {
+    return registerStatic(primaryDevice(), entity, retained, qos);
+  }
+
+  /** @brief Register a compile-time entity schema on another device, see registerStatic() and addDevice(). */
+  template <typename Cfg, size_t N>
+  HaEntityHandle registerStatic(HaDeviceHandle device, const HaStaticEntity<Cfg, N>& entity, bool retained = true,
+                                uint8_t qos = 1) {
+    HaEntityHandle handle = registerConfig(device, entity.config, retained, qos);
+    attachFixedJson(handle, entity.json);
+    return handle;
+  }
+
+  /**
+   * @brief Register and publish a compile-time entity schema, see registerStatic().
+   *
+   * @param entity   Schema declared with HA_STATIC_ENTITY() (must have static storage)
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for discovery if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  template <typename Cfg, size_t N>
+  bool publishStaticDiscovery(const HaStaticEntity<Cfg, N>& entity, bool retained = true, uint8_t qos = 1) {
+    return publishRegistered(registerStatic(entity, retained, qos));
+  }
+
+  /**
+   * @brief Look up the handle of a registered entity of the primary device by object_id.
+   *
+   * The lookup goes through a hash index, so its cost does not grow with the entity count.
+   *
+   * @param object_id Entity object_id
+   * @return Handle to the entity, invalid if no entity with that object_id is registered
+   */
+  HaEntityHandle entityHandle(const char* object_id) const;
+
+  /**
+   * @brief Look up the handle of a registered entity of any device by object_id.
+   *
+   * @param device    Device handle
+   * @param object_id Entity object_id
+   * @return Handle to the entity, invalid if the device has no entity with that object_id
+   */
+  HaEntityHandle entityHandle(HaDeviceHandle device, const char* object_id) const;
+
+  /**
+   * @brief Resolved state topic of a registered entity.
+   *
+   * @param handle Entity handle
+   * @return State topic, or nullptr if the handle is invalid or the entity has no state topic.
+   *         Valid until the next entity registration or device change.
+   */
+  const char* stateTopic(HaEntityHandle handle) const;
+
+  /**
+   * @brief Resolved command topic of a registered entity.
+   *
+   * @param handle Entity handle
+   * @return Command topic, or nullptr if the handle is invalid or the entity has no command topic.
+   *         Valid until the next entity registration or device change.
+   */
+  const char* commandTopic(HaEntityHandle handle) const;
+
+  /**
+   * @brief Publish a sensor Discovery config (retained by default).
+   *
+   * The config is also registered (see registerSensor()) so it is re-published
+   * automatically on reconnect.
+   *
+   * @param cfg      Sensor configuration
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for discovery if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishSensorDiscovery(const HaSensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish a switch Discovery config (retained by default).
+   *
+   * The config is also registered, see registerSensor().
+   *
+   * @param cfg      Switch configuration
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for discovery if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishSwitchDiscovery(const HaSwitchConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish a binary_sensor Discovery config (retained by default).
+   *
+   * The config is also registered, see registerSensor().
+   *
+   * @param cfg      Binary sensor configuration
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for discovery if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishBinarySensorDiscovery(const HaBinarySensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Publish a button Discovery config (retained by default).
+   *
+   * The config is also registered, see registerSensor().
+   *
+   * @param cfg      Button configuration
+   * @param retained Retain flag (recommended true)
+   * @param qos      QoS level (recommended 1 for discovery if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishButtonDiscovery(const HaButtonConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a sensor of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishSensorDiscovery(HaDeviceHandle device, const HaSensorConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a switch of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishSwitchDiscovery(HaDeviceHandle device, const HaSwitchConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a binary_sensor of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishBinarySensorDiscovery(HaDeviceHandle device, const HaBinarySensorConfig& cfg, bool retained = true,
+                                    uint8_t qos = 1);
+
+  /** @brief Register and publish a button of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishButtonDiscovery(HaDeviceHandle device, const HaButtonConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a number without publishing its Discovery config, see registerSensor(). */
+  HaEntityHandle registerNumber(const HaNumberConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a number of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerNumber(HaDeviceHandle device, const HaNumberConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a number Discovery config, see publishSensorDiscovery(). */
+  bool publishNumberDiscovery(const HaNumberConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a number of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishNumberDiscovery(HaDeviceHandle device, const HaNumberConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a select without publishing its Discovery config, see registerSensor(). */
+  HaEntityHandle registerSelect(const HaSelectConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a select of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerSelect(HaDeviceHandle device, const HaSelectConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a select Discovery config, see publishSensorDiscovery(). */
+  bool publishSelectDiscovery(const HaSelectConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a select of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishSelectDiscovery(HaDeviceHandle device, const HaSelectConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a light without publishing its Discovery config, see registerSensor(). */
+  HaEntityHandle registerLight(const HaLightConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a light of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerLight(HaDeviceHandle device, const HaLightConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a light Discovery config, see publishSensorDiscovery(). */
+  bool publishLightDiscovery(const HaLightConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a light of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishLightDiscovery(HaDeviceHandle device, const HaLightConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a cover without publishing its Discovery config, see registerSensor(). */
+  HaEntityHandle registerCover(const HaCoverConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a cover of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerCover(HaDeviceHandle device, const HaCoverConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a cover Discovery config, see publishSensorDiscovery(). */
+  bool publishCoverDiscovery(const HaCoverConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a cover of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishCoverDiscovery(HaDeviceHandle device, const HaCoverConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a climate without publishing its Discovery config, see registerSensor(). */
+  HaEntityHandle registerClimate(const HaClimateConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register a climate of another device, see registerSensor(HaDeviceHandle, ...). */
+  HaEntityHandle registerClimate(HaDeviceHandle device, const HaClimateConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a climate Discovery config, see publishSensorDiscovery(). */
+  bool publishClimateDiscovery(const HaClimateConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /** @brief Register and publish a climate of another device, see registerSensor(HaDeviceHandle, ...). */
+  bool publishClimateDiscovery(HaDeviceHandle device, const HaClimateConfig& cfg, bool retained = true, uint8_t qos = 1);
+
+  /**
+   * @brief Write the Discovery config payload of a sensor into a buffer, without publishing it.
+   *
+   * @param out    Output buffer
+   * @param outLen Size of the output buffer in bytes (including the null terminator)
+   * @param cfg    Sensor configuration
+   * @return true if the payload fit in the buffer
+   */
+  bool buildSensorConfigJson(char* out, size_t outLen, const HaSensorConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a switch into a buffer; see buildSensorConfigJson(). */
+  bool buildSwitchConfigJson(char* out, size_t outLen, const HaSwitchConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a binary sensor into a buffer; see buildSensorConfigJson(). */
+  bool buildBinarySensorConfigJson(char* out, size_t outLen, const HaBinarySensorConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a button into a buffer; see buildSensorConfigJson(). */
+  bool buildButtonConfigJson(char* out, size_t outLen, const HaButtonConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a number into a buffer; see buildSensorConfigJson(). */
+  bool buildNumberConfigJson(char* out, size_t outLen, const HaNumberConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a select into a buffer; see buildSensorConfigJson(). */
+  bool buildSelectConfigJson(char* out, size_t outLen, const HaSelectConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a light into a buffer; see buildSensorConfigJson(). */
+  bool buildLightConfigJson(char* out, size_t outLen, const HaLightConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a cover into a buffer; see buildSensorConfigJson(). */
+  bool buildCoverConfigJson(char* out, size_t outLen, const HaCoverConfig& cfg) const;
+
+  /** @brief Write the Discovery config payload of a climate into a buffer; see buildSensorConfigJson(). */
+  bool buildClimateConfigJson(char* out, size_t outLen, const HaClimateConfig& cfg) const;
+
+  /**
+   * @brief Remove an entity from Home Assistant by clearing its retained config topic.
+   *
+   * Home Assistant removes the entity when the Discovery config topic is published
+   * with an empty payload and retain=true. The entity is also dropped from the registry.
+   * In device mode a registered entity is instead removed through the next device config.
+   *
+   * @param component Component name (e.g. "sensor", "switch")
+   * @param object_id Entity object_id used in the config topic
+   * @param qos       QoS level (recommended 1 if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool removeEntity(const char* component, const char* object_id, uint8_t qos = 1);
+
+  /**
+   * @brief Remove an entity of another device, see removeEntity() and addDevice().
+   *
+   * @param device    Device handle
+   * @param component Component name (e.g. "sensor", "switch")
+   * @param object_id Entity object_id used in the config topic
+   * @param qos       QoS level (recommended 1 if supported)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool removeEntity(HaDeviceHandle device, const char* component, const char* object_id, uint8_t qos = 1);
+
+  /**
+   * @brief Publish an entity state payload using default state topic for object_id.
+   *
+   * @param object_id Entity object_id
+   * @param payload   Null-terminated payload string
+   * @param retained  Retain flag (usually false for state)
+   * @param qos       QoS level (usually 0 for state)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishState(const char* object_id, const char* payload, bool retained = false, uint8_t qos = 0);
+
+  /**
+   * @brief Publish an entity state payload to the resolved state topic of a registered entity.
+   *
+   * This is the allocation-free fast path for frequently updated entities.
+   *
+   * @param handle   Entity handle
+   * @param payload  Null-terminated payload string
+   * @param retained Retain flag (usually false for state)
+   * @param qos      QoS level (usually 0 for state)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishState(HaEntityHandle handle, const char* payload, bool retained = false, uint8_t qos = 0);
+
+  /**
+   * @brief Publish a numeric state with a fixed number of decimals.
+   *
+   * The value is formatted into a small stack buffer with haFormatFloat() (no printf, no heap,
+   * always '.' as decimal separator) and published like publishState(object_id, payload).
+   *
+   * @param object_id Entity object_id
+   * @param value     Value to publish
+   * @param precision Number of decimals (max HA_NUMBER_MAX_PRECISION)
+   * @param retained  Retain flag (usually false for state)
+   * @param qos       QoS level (usually 0 for state)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishState(const char* object_id, float value, uint8_t precision = 2, bool retained = false, uint8_t qos = 0);
+
+  /** @brief Publish a signed integer state. See publishState(const char*, float, uint8_t, bool, uint8_t). */
+  bool publishState(const char* object_id, int32_t value, bool retained = false, uint8_t qos = 0);
+
+  /** @brief Publish an unsigned integer state. See publishState(const char*, float, uint8_t, bool, uint8_t). */
+  bool publishState(const char* object_id, uint32_t value, bool retained = false, uint8_t qos = 0);
+
+  /** @brief Publish a numeric state with a fixed number of decimals by handle. */
+  bool publishState(HaEntityHandle handle, float value, uint8_t precision = 2, bool retained = false, uint8_t qos = 0);
+
+  /** @brief Publish a signed integer state by handle. */
+  bool publishState(HaEntityHandle handle, int32_t value, bool retained = false, uint8_t qos = 0);
+
+  /** @brief Publish an unsigned integer state by handle. */
+  bool publishState(HaEntityHandle handle, uint32_t value, bool retained = false, uint8_t qos = 0);
+
+  /**
+   * @brief Enable change detection for state publishes of a registered entity.
+   *
+   * Applies to publishState()/publishStateSwitch() for this entity, by handle or object_id.
+   * The first state after every (re)connect is always sent.
+   *
+   * @param handle Entity handle
+   * @param filter Filter settings
+   * @return true if the handle is valid
+   */
+  bool setStateFilter(HaEntityHandle handle, const HaStateFilter& filter);
+
+  /**
+   * @brief Disable change detection for a registered entity.
+   *
+   * @param handle Entity handle
+   */
+  void clearStateFilter(HaEntityHandle handle);
+
+  /**
+   * @brief Sent/suppressed counters for one entity.
+   *
+   * @param handle Entity handle
+   * @return Counters (all zero for an invalid handle)
+   */
+  HaStateStats stateStats(HaEntityHandle handle) const;
+
+  /**
+   * @brief Sent/suppressed counters summed over all entities.
+   *
+   * @return Counters
+   */
+  HaStateStats stateStats() const;
+
+  /**
+   * @brief Counters and histograms of the messages published so far.
+   *
+   * Includes the acknowledgement statistics of the transport.
+   */
+  HaMetrics metrics() const;
+
+  /** @brief Reset all counters returned by metrics(). */
+  void resetMetrics();
+
+  /**
+   * @brief Publish metrics as Home Assistant diagnostic sensors.
+   *
+   * Registers sensors for messages, bytes, failures, average publish time and the largest
+   * config, and publishes their states from tick() every interval_ms. Call after setDevice().
+   *
+   * @param interval_ms Publish interval in milliseconds; 0 removes the sensors again
+   * @return true on success
+   */
+  bool enableMetricsSensors(uint32_t interval_ms);
+
+  /**
+   * @brief Handle commands sent to a registered switch or button.
+   *
+   * Commands on default command topics arrive through a single `<base>/<node_id>/+/set`
+   * subscription per node; entities with a command_topic_override are subscribed individually.
+   * Subscriptions are made when connected and renewed on every reconnect. Incoming topics
+   * are looked up in a hash index, so dispatch cost does not grow with the entity count.
+   *
+   * Incoming messages are queued (up to 4) and the handler is called from tick(), also with
+   * AsyncMqttClient, whose callbacks run in the AsyncTCP task. Payloads must be shorter than
+   * 128 bytes.
+   *
+   * @param handle  Entity handle (must have a command topic)
+   * @param handler Handler, or nullptr to stop handling commands for the entity
+   * @param ctx     User context pointer passed back to the handler
+   * @return true if the handle is valid and has a command topic
+   */
+  bool setCommandHandler(HaEntityHandle handle, HaCommandHandler handler, void* ctx = nullptr);
+
+  /**
+   * @brief Receive messages that are not commands for a registered entity.
+   *
+   * HaDiscovery installs itself as the transport's message handler; use this for your own
+   * subscriptions made through MqttTransport::subscribe(). Like command handlers, the callback
+   * runs from tick(), except for messages too large to be commands (payloads of 128 bytes or
+   * more), which it receives straight from the transport's callback.
+   *
+   * @param cb  Callback, or nullptr
+   * @param ctx User context pointer passed back to the callback
+   */
+  void setOnUnhandledMessage(MqttTransport::MessageFn cb, void* ctx = nullptr);
+
+  /**
+   * @brief Publish a switch state ("ON"/"OFF") using default state topic.
+   *
+   * @param object_id Entity object_id
+   * @param on        true -> "ON", false -> "OFF"
+   * @param retained  Retain flag (usually false)
+   * @param qos       QoS level (usually 0)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishStateSwitch(const char* object_id, bool on, bool retained = false, uint8_t qos = 0);
+
+  /**
+   * @brief Publish a switch state ("ON"/"OFF") to the resolved state topic of a registered entity.
+   *
+   * @param handle   Entity handle
+   * @param on       true -> "ON", false -> "OFF"
+   * @param retained Retain flag (usually false)
+   * @param qos      QoS level (usually 0)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool publishStateSwitch(HaEntityHandle handle, bool on, bool retained = false, uint8_t qos = 0);
+
+  /**
+   * @brief Publish a button "press" command to the default command topic.
+   *
+   * @param object_id Entity object_id
+   * @param payload   Payload string to publish (if nullptr uses default "PRESS")
+   * @param retained  Retain flag (usually false)
+   * @param qos       QoS level (usually 0 or 1)
+   * @return true if publish was accepted by transport, false otherwise
+   */
+  bool pressButton(const char* object_id, const char* payload = nullptr, bool retained = false, uint8_t qos = 0);
+
+  // Convenience overloads for std::string parameters
+
+  /** @brief Overload of removeEntity using std::string. */
+  inline bool removeEntity(const std::string& component, const std::string& object_id, uint8_t qos = 1) {
+    return removeEntity(component.c_str(), object_id.c_str(), qos);
+  }
   /** @brief Overload of removeEntity using std::string for object_id. */
   inline bool removeEntity(const char* component, const std::string& object_id, uint8_t qos = 1) {
     return removeEntity(component, object_id.c_str(), qos);
@@ -336,6 +1461,37 @@ public:
     return publishState(object_id, payload.c_str(), retained, qos);
   }
 
+  /** @brief Overload of publishState by handle using std::string for payload. */
+  inline bool publishState(HaEntityHandle handle, const std::string& payload, bool retained = false, uint8_t qos = 0) {
+    return publishState(handle, payload.c_str(), retained, qos);
+  }
+
+  /** @brief Overload of numeric publishState for double (formatted as float). */
+  inline bool publishState(const char* object_id, double value, uint8_t precision = 2, bool retained = false, uint8_t qos = 0) {
+    return publishState(object_id, static_cast<float>(value), precision, retained, qos);
+  }
+  /** @brief Overload of numeric publishState by handle for double (formatted as float). */
+  inline bool publishState(HaEntityHandle handle, double value, uint8_t precision = 2, bool retained = false, uint8_t qos = 0) {
+    return publishState(handle, static_cast<float>(value), precision, retained, qos);
+  }
+
+  // Other integer types (e.g. int, long and uint8_t when int32_t/uint32_t are `long` types, as
+  // on newer ESP32 toolchains) would otherwise be ambiguous between the float and integer overloads.
+  /** @brief Overload of integer publishState for other integer types of up to 32 bits. */
+  template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                                    sizeof(T) <= 4, int>::type = 0>
+  inline bool publishState(const char* object_id, T value, bool retained = false, uint8_t qos = 0) {
+    return std::is_signed<T>::value ? publishState(object_id, static_cast<int32_t>(value), retained, qos)
+                                    : publishState(object_id, static_cast<uint32_t>(value), retained, qos);
+  }
+  /** @brief Overload of integer publishState by handle for other integer types of up to 32 bits. */
+  template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                                    sizeof(T) <= 4, int>::type = 0>
+  inline bool publishState(HaEntityHandle handle, T value, bool retained = false, uint8_t qos = 0) {
+    return std::is_signed<T>::value ? publishState(handle, static_cast<int32_t>(value), retained, qos)
+                                    : publishState(handle, static_cast<uint32_t>(value), retained, qos);
+  }
+
   /** @brief Overload of publishStateSwitch using std::string for object_id. */
   inline bool publishStateSwitch(const std::string& object_id, bool on, bool retained = false, uint8_t qos = 0) {
     return publishStateSwitch(object_id.c_str(), on, retained, qos);
@@ -355,20 +1511,229 @@ public:
   }
 
 private:
+  template <size_t N, size_t Devices, size_t TopicBytes> friend class HaEntityTable;
+
+  /** @brief Offset of an entity without this topic in the topic pool. */
+  static constexpr uint32_t NO_TOPIC = UINT32_MAX;
+
+  /** @brief A registered entity, replayed on reconnect. */
+  struct Entity {
+    HaComponent component = HaComponent::Sensor;
+    uint16_t device = 0;
+    uint32_t idHash = 0;
+    bool active = false;
+    bool removePending = false;
+    bool retained = true;
+    uint8_t qos = 1;
+    union Config {
+      Config() : sensor() {}
+      HaSensorConfig sensor;
+      HaSwitchConfig sw;
+      HaBinarySensorConfig binarySensor;
+      HaButtonConfig button;
+      HaNumberConfig number;
+      HaSelectConfig select;
+      HaLightConfig light;
+      HaCoverConfig cover;
+      HaClimateConfig climate;
+    } cfg;
+    /** @brief Resolved topics: offsets of null-terminated strings in the topic pool, or NO_TOPIC. */
+    uint32_t stateTopic = NO_TOPIC;
+    uint32_t commandTopic = NO_TOPIC;
+    /** @brief Pre-serialized invariant members from an HaStaticEntity, or nullptr. */
+    const char* fixedJson = nullptr;
+
+    // State change detection
+    HaStateFilter filter;
+    bool filtered = false;
+    bool hasLast = false;
+    bool lastNumeric = false;
+    float lastValue = 0.0f;
+    uint32_t lastHash = 0;
+    uint32_t lastSentMs = 0;
+    HaStateStats stats;
+
+    // Inbound commands
+    HaCommandHandler commandHandler = nullptr;
+    void* commandCtx = nullptr;
+    uint32_t commandHash = 0;
+
+    const HaEntityCommon& common() const;
+  };
+
+  /** @brief A device and the registry indices of its entities, in registration order. */
+  struct Device {
+    HaDeviceInfo info;
+    std::string availabilityTopic;
+    /** @brief Includes entities removed in device mode until the device config without them is sent. */
+    HaSlotVector<uint16_t> entities;
+    /** @brief Device-mode messages sent by the last publish of this device. */
+    size_t chunkCount = 0;
+    /** @brief The device config has changed since it was last published (device mode). */
+    bool dirty = false;
+    bool commandWildcardSubscribed = false;
+  };
+
+  /** @brief Storage supplied by an HaEntityTable. */
+  struct EntityStorage {
+    Entity* entities;
+    uint16_t* freeList;
+    size_t capacity;
+    uint16_t* index;
+    uint16_t* commandIndex;
+    size_t indexSize;
+    uint16_t* deviceLists;
+    size_t devices;
+    char* topics;
+    size_t topicBytes;
+  };
+
+  // Discovery manifest: last published config hash per (component, object_id), sorted by key.
+  struct ManifestEntry {
+    uint32_t key = 0;
+    uint32_t hash = 0;
+    HaComponent component = HaComponent::Sensor;
+    bool seen = false;
+    std::string objectId;
+  };
+
+  void attachTransport();
   static void onTransportConnectThunk(void* ctx);
   void onTransportConnect();
+  void resumeAfterConnect();
+  static void onTransportMessageThunk(void* ctx, const char* topic, const uint8_t* payload, size_t len);
+  void onTransportMessage(const char* topic, const uint8_t* payload, size_t len);
+  void dispatchMessages();
+  void dispatchMessage(const char* topic, const char* payload, size_t len);
+  void indexCommand(uint16_t index);
+  void rebuildCommandIndex();
+  void subscribeCommands();
+  void subscribeCommand(const Entity& entity);
+  bool isDefaultCommandTopic(const Entity& entity) const;
+
+  static const char* componentName(HaComponent component);
+  static bool componentFromName(const char* name, HaComponent& out);
+  void applyDeviceInfo(uint16_t index, const HaDeviceInfo& dev);
+  const Device* deviceFor(HaDeviceHandle device) const;
+  bool isBridged(const Device& dev) const;
+  void markDirty(Device& dev);
+  static uint32_t entityKey(uint16_t device, const char* object_id);
+  HaEntityHandle findEntity(uint16_t device, const char* object_id, const HaComponent* component) const;
+  void indexEntity(uint16_t index);
+  void rebuildEntityIndex();
+  void releaseEntity(uint16_t index);
+  void discardEntity(uint16_t index);
+  bool useEntityStorage(const EntityStorage& storage);
+  bool bindDeviceList(uint16_t index);
+  Entity* registerEntity(HaComponent component, HaDeviceHandle device, const char* object_id, bool retained,
+                         uint8_t qos);
+  HaEntityHandle registerComponent(HaComponent component, HaDeviceHandle device, const void* cfg, size_t size,
+                                   bool retained, uint8_t qos);
+  HaEntityHandle handleOf(const Entity& entity) const {
+    return HaEntityHandle(static_cast<uint16_t>(&entity - _entities.data()));
+  }
+  bool resolveTopics(Entity& entity);
+  bool storeTopic(const char* topic, uint32_t& offset);
+  bool storeTopics(Entity& entity);
+  void dropTopics(Entity& entity);
+  bool compactTopics(const Entity* last);
+  const char* topicAt(uint32_t offset) const {
+    return offset == NO_TOPIC ? "" : _topics.data() + offset;
+  }
+  const Entity* entityFor(HaEntityHandle handle) const;
+  bool publishEntity(const Entity& entity);
+  bool publishRegistered(HaEntityHandle handle);
+  bool shouldSuppressState(const Entity& entity, const char* payload, uint32_t hash, uint32_t now) const;
+  void attachFixedJson(HaEntityHandle handle, const char* json);
+  static uint32_t manifestKey(HaComponent component, const char* node_id, const char* object_id);
+  const char* manifestNode(uint16_t device) const;
+  uint32_t manifestScope() const;
+  bool loadManifest();
+  ManifestEntry* manifestFind(HaComponent component, const char* node_id, const char* object_id);
+  void manifestSet(HaComponent component, const char* node_id, const char* object_id, uint32_t hash);
+  void manifestErase(HaComponent component, const char* node_id, const char* object_id);
+  void removeStaleEntities();
 
-  std::string buildConfigTopic(const char* component, const char* object_id) const;
-  std::string buildDefaultStateTopic(const char* object_id) const;
-  std::string buildDefaultCommandTopic(const char* object_id) const;
-  std::string buildDefaultAvailabilityTopic() const;
+  bool sendMessage(HaMetricCategory category, const char* topic, const uint8_t* payload, size_t len,
+                   bool retained, uint8_t qos);
+  void recordPublish(HaMetricCategory category, size_t len, bool ok, uint32_t elapsed_us);
+  void recordConfigSize(size_t len);
+  size_t countFormatted(size_t len);
+  void serviceMetricsSensors();
+
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaSensorConfig& cfg, bool retained, uint8_t qos) {
+    return registerSensor(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaSwitchConfig& cfg, bool retained, uint8_t qos) {
+    return registerSwitch(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaBinarySensorConfig& cfg, bool retained, uint8_t qos) {
+    return registerBinarySensor(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaButtonConfig& cfg, bool retained, uint8_t qos) {
+    return registerButton(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaNumberConfig& cfg, bool retained, uint8_t qos) {
+    return registerNumber(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaSelectConfig& cfg, bool retained, uint8_t qos) {
+    return registerSelect(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaLightConfig& cfg, bool retained, uint8_t qos) {
+    return registerLight(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaCoverConfig& cfg, bool retained, uint8_t qos) {
+    return registerCover(device, cfg, retained, qos);
+  }
+  HaEntityHandle registerConfig(HaDeviceHandle device, const HaClimateConfig& cfg, bool retained, uint8_t qos) {
+    return registerClimate(device, cfg, retained, qos);
+  }
+  void startRepublish(bool dirty_only, bool availability);
+  bool republishAvailabilityDue() const;
+  bool republishBudgetLeft(size_t published, size_t max_messages) const;
+  void nextRepublishDevice();
+  void serviceRepublish();
+  bool finishRepublish(size_t& published, size_t max_messages);
+
+  bool buildConfigTopic(char* out, size_t outLen, const char* component, const char* node_id,
+                        const char* object_id) const;
+  bool buildDefaultTopic(char* out, size_t outLen, const Device& dev, const char* object_id,
+                         const char* suffix) const;
+  std::string buildDefaultAvailabilityTopic(const Device& dev) const;
 
   bool publishConfigJson(const char* topic, const char* json, bool retained, uint8_t qos);
+  template <typename WriteFn>
+  bool publishJson(const char* topic, bool retained, uint8_t qos, WriteFn write);
+  template <typename WriteFn>
+  uint32_t hashJson(WriteFn write);
+  static bool transportSink(void* ctx, const char* data, size_t len);
 
-  bool buildSensorConfigJson(char* out, size_t outLen, const HaSensorConfig& cfg) const;
-  bool buildSwitchConfigJson(char* out, size_t outLen, const HaSwitchConfig& cfg) const;
-  bool buildBinarySensorConfigJson(char* out, size_t outLen, const HaBinarySensorConfig& cfg) const;
-  bool buildButtonConfigJson(char* out, size_t outLen, const HaButtonConfig& cfg) const;
+
+  void writeConfig(HaJsonWriter& w, const Device& dev, HaComponent component, const void* cfg,
+                   bool shared_availability, const char* fixed_json = nullptr) const;
+  bool buildConfigJson(char* out, size_t outLen, HaComponent component, const void* cfg) const;
+  void writeEntityConfig(HaJsonWriter& w, const Entity& entity, bool shared_availability) const;
+
+  static bool isDeviceComponent(const Entity& entity);
+  void writeDeviceConfig(HaJsonWriter& w, const Device& dev, size_t first, size_t last) const;
+  size_t nextDeviceChunk(const Device& dev, size_t first) const;
+  bool buildDeviceConfigTopic(char* out, size_t outLen, const Device& dev, size_t chunk) const;
+  bool publishDeviceChunk(const Device& dev, size_t first, size_t last, size_t chunk);
+  void finishDeviceDiscovery(Device& dev);
+  bool advanceDeviceDiscovery(size_t max_messages);
+
+  bool useTopicBase(bool shared_availability) const;
+  void writeTopic(HaJsonWriter& w, const Device& dev, const char* key, const char* override_topic,
+                  const char* object_id, const char* suffix, bool topic_base) const;
+  void writeTopicValue(HaJsonWriter& w, const Device& dev, const char* key, const char* topic, bool topic_base) const;
+  void writeTopicBase(HaJsonWriter& w, const Device& dev) const;
+  void writePayload(HaJsonWriter& w, const char* key, const char* payload, const char* ha_default) const;
+  void writeEntityHeader(HaJsonWriter& w, const Device& dev, const HaEntityCommon& common, bool topic_base,
+                         bool name = true) const;
+  void writeAvailability(HaJsonWriter& w, const Device& dev, const HaEntityCommon& common,
+                         bool shared_availability) const;
+  void writeBridgedAvailability(HaJsonWriter& w, const Device& dev, bool topic_base) const;
+  void writeDevice(HaJsonWriter& w, const Device& dev) const;
 
 
 private:
@@ -376,9 +1741,90 @@ private:
   std::string _discoveryPrefix;
   std::string _baseTopicPrefix;
   JBLogger* _log;
-  HaDeviceInfo _device{};
+  bool _ownsLog;
+  std::vector<Device> _devices;
+
+  HaSlotVector<Entity> _entities;
+  HaSlotVector<uint16_t> _freeEntities;
+  // Open-addressing hash index over (device, object_id): entity index + 1, 0 = empty.
+  // Entries of removed entities stay until the next rebuild; lookups skip them.
+  HaSlotVector<uint16_t> _entityIndex;
+  size_t _entityIndexUsed = 0;
+  // Resolved state and command topics of all entities, back to back. Topics replaced or
+  // released leave garbage bytes until the pool is compacted.
+  HaSlotVector<char> _topics;
+  size_t _topicGarbage = 0;
+  // Per-device entity lists supplied by an HaEntityTable: `_deviceListCount` rows of
+  // `_deviceListCapacity` indices.
+  uint16_t* _deviceLists = nullptr;
+  size_t _deviceListCount = 0;
+  size_t _deviceListCapacity = 0;
+
+  // Paced re-publish position: device, position in its entity list, device-mode chunk.
+  size_t _republishDevice = 0;
+  size_t _republishCursor = 0;
+  size_t _republishChunk = 0;
+  bool _republishDeviceOpen = false;
+  bool _republishDirtyOnly = false;
+  bool _republishAvailability = false;
+  size_t _republishPerTick = 1;
+  bool _republishPending = false;
+  // Per-tick budget (0 = none) and where the current tick started.
+  uint32_t _republishMaxMs = 0;
+  size_t _republishMaxBytes = 0;
+  bool _republishBudgeted = false;
+  uint32_t _republishTickMs = 0;
+  uint32_t _republishTickBytes = 0;
+  HaDiscoveryProgress _progress;
+  bool _transportReserved = false;
+  volatile bool _connectPending = false;  // set by the transport's connect callback, handled by tick()
+  void (*_discoveryCompleteCb)(void*) = nullptr;
+  void* _discoveryCompleteCtx = nullptr;
+
+  uint32_t (*_millis)() = nullptr;
+  size_t _filteredCount = 0;
+  HaStateStats _stateTotals;
+
+  HaMetrics _metrics;
+  uint32_t _metricsIntervalMs = 0;
+  uint32_t _metricsLastMs = 0;
+  bool _metricsPublished = false;
+  HaEntityHandle _metricsSensors[5];
+
+  HaManifestStorage* _manifestStorage = nullptr;
+  std::vector<ManifestEntry> _manifest;
+  bool _manifestLoaded = false;
+  bool _manifestDirty = false;
+  bool _manifestSkip = false;  // until the first replay after loadManifest() completes
+
+  // Open-addressing hash index over command topics: entity index + 1, 0 = empty.
+  HaSlotVector<uint16_t> _commandIndex;
+  size_t _commandIndexUsed = 0;
+  MqttTransport::MessageFn _unhandledCb = nullptr;
+  void* _unhandledCtx = nullptr;
+
+  HaDiscoveryMode _mode = HaDiscoveryMode::Entity;
+  HaConfigFormat _format = HaConfigFormat::Full;
+  size_t _deviceChunkSize = 0;
+  size_t _dirtyDevices = 0;
 
   static constexpr size_t JSON_BUF = 768;
+  static constexpr size_t TOPIC_BUF = 192;
+  static constexpr size_t STREAM_BUF = 64;
+  static constexpr size_t COMMAND_BUF = 128;
+  static constexpr size_t COMMAND_QUEUE = 4;
+
+  // Messages copied by the transport's callback and dispatched from tick(), so the command index
+  // and the registry are only read on the application's task.
+  struct QueuedMessage {
+    char topic[TOPIC_BUF];
+    char payload[COMMAND_BUF];
+    size_t len;
+  };
+  QueuedMessage _messageQueue[COMMAND_QUEUE];
+  size_t _messageHead = 0;
+  size_t _messageCount = 0;
+  MqttMutex _messageMutex;
 };
 
 /** @} */
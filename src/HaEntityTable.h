@@ -0,0 +1,94 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include "HaDiscovery.h"
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+namespace ha_table {
+
+/** @brief Hash index size for n entities: a power of two, at most half full. */
+constexpr size_t indexSize(size_t n, size_t size = 8) {
+  return size >= 2 * (n + 1) ? size : indexSize(n, size * 2);
+}
+
+}  // namespace ha_table
+
+/**
+ * @brief Fixed-capacity entity registry for HaDiscovery::setEntityTable().
+ *
+ * Holds everything HaDiscovery keeps per entity in arrays sized at compile time: one
+ * contiguous array of entity records (config, topic offsets, state filter and flags), the
+ * object_id and command topic hash indexes, the per-device entity lists and a pool for the
+ * resolved state and command topics. Once attached, registering, looking up and removing
+ * entities, dispatching commands and re-publishing after a connect never touch the heap.
+ *
+ * Registering past the capacity fails at runtime with an invalid handle and a logged error.
+ * registerStatic() registers a list of compile-time entities and rejects a list longer than
+ * the table at compile time.
+ *
+ * @code
+ * static HaEntityTable<8> table;   // static storage: no heap and no stack
+ * ha.setEntityTable(table);
+ * ha.setDevice(dev);
+ * auto handles = table.registerStatic(ha, kTemp, kHumidity, kRelay);
+ * @endcode
+ *
+ * @tparam N          Maximum number of entities (removed entities free their slot)
+ * @tparam Devices    Maximum number of devices including the primary one (see HaDiscovery::addDevice())
+ * @tparam TopicBytes Size of the topic pool: each entity stores its state and command topic
+ *                    (those it has) with a null terminator; the default allows 64 bytes per entity
+ */
+template <size_t N, size_t Devices = 1, size_t TopicBytes = N * 64>
+class HaEntityTable {
+  static_assert(N > 0, "HaEntityTable needs room for at least one entity");
+  static_assert(N < 0xFFFF, "HaEntityTable holds at most 65534 entities");
+  static_assert(Devices > 0 && Devices < 0xFFFF, "HaEntityTable needs 1 to 65534 devices");
+  static_assert(TopicBytes > 0 && TopicBytes < UINT32_MAX, "HaEntityTable topic pool size out of range");
+
+public:
+  HaEntityTable() = default;
+  HaEntityTable(const HaEntityTable&) = delete;
+  HaEntityTable& operator=(const HaEntityTable&) = delete;
+
+  /** @brief Maximum number of entities. */
+  static constexpr size_t capacity() { return N; }
+
+  /**
+   * @brief Register compile-time entities on the primary device of a discovery instance using this table.
+   *
+   * Fails to compile when more entities are passed than the table holds.
+   *
+   * @param ha       Discovery instance the table was passed to with setEntityTable()
+   * @param entities Schemas declared with HA_STATIC_ENTITY() (see HaStaticEntity.h)
+   * @return One handle per entity, in order (invalid where registration failed)
+   */
+  template <typename... Entities>
+  std::array<HaEntityHandle, sizeof...(Entities)> registerStatic(HaDiscovery& ha, const Entities&... entities) {
+    static_assert(sizeof...(Entities) <= N, "HaEntityTable capacity exceeded: raise N");
+    return std::array<HaEntityHandle, sizeof...(Entities)>{ { ha.registerStatic(entities)... } };
+  }
+
+private:
+  friend class HaDiscovery;
+
+  static constexpr size_t INDEX_SIZE = ha_table::indexSize(N);
+
+  HaDiscovery::EntityStorage storage() {
+    return HaDiscovery::EntityStorage{ _entities, _free, N, _index, _commandIndex, INDEX_SIZE,
+                                       _deviceLists, Devices, _topics, TopicBytes };
+  }
+
+  HaDiscovery::Entity _entities[N];
+  uint16_t _free[N];
+  uint16_t _index[INDEX_SIZE];
+  uint16_t _commandIndex[INDEX_SIZE];
+  uint16_t _deviceLists[Devices * N];
+  char _topics[TopicBytes];
+};
+
+/** @} */
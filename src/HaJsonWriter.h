@@ -0,0 +1,280 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+/**
+ * @brief Minimal streaming JSON writer used for Discovery payloads.
+ *
+ * Writes directly into a caller-supplied buffer, without building a document tree and
+ * without touching the heap. String values may be written in several pieces, which lets
+ * topics such as `<base>/<node_id>/<object_id>/state` be emitted without first being
+ * concatenated into a temporary string.
+ *
+ * When the buffer is too small, writing continues to be counted but not stored, so
+ * length() reports the size the payload would have needed and ok() returns false.
+ * The buffer is always null-terminated when its capacity is non-zero.
+ *
+ * With a sink, the buffer is only a staging area: it is handed to the sink whenever it
+ * fills up and on flush(), so payloads of any size can be written with a small buffer.
+ */
+class HaJsonWriter {
+public:
+  /**
+   * @brief Output callback for streaming mode.
+   *
+   * @param ctx  User context pointer
+   * @param data Bytes to write
+   * @param len  Number of bytes
+   * @return true if all bytes were accepted
+   */
+  typedef bool (*Sink)(void* ctx, const char* data, size_t len);
+
+  /**
+   * @brief Construct a writer over a buffer.
+   *
+   * @param out    Output buffer
+   * @param outLen Size of the output buffer in bytes (including the null terminator)
+   */
+  HaJsonWriter(char* out, size_t outLen)
+    : _out(out), _cap(outLen) {
+    if (_out && _cap) {
+      _out[0] = '\0';
+    }
+  }
+
+  /**
+   * @brief Construct a streaming writer that hands its buffer to a sink when full.
+   *
+   * Call flush() after the last value to pass on the remaining bytes.
+   *
+   * @param buf    Staging buffer
+   * @param bufLen Size of the staging buffer in bytes (must be non-zero)
+   * @param sink   Output callback
+   * @param ctx    User context pointer passed to the sink
+   */
+  HaJsonWriter(char* buf, size_t bufLen, Sink sink, void* ctx)
+    : _out(buf), _cap(bufLen), _sink(sink), _sinkCtx(ctx) {}
+
+  /** @brief Start an object, as a value or array element. */
+  void beginObject() {
+    separator();
+    put('{');
+    _needComma = false;
+  }
+
+  /** @brief End the current object. */
+  void endObject() {
+    put('}');
+    _needComma = true;
+  }
+
+  /** @brief Start an array, as a value or array element. */
+  void beginArray() {
+    separator();
+    put('[');
+    _needComma = false;
+  }
+
+  /** @brief End the current array. */
+  void endArray() {
+    put(']');
+    _needComma = true;
+  }
+
+  /**
+   * @brief Write an object key. Must be followed by exactly one value.
+   *
+   * @param key Key name (written as-is, must not need escaping)
+   */
+  void key(const char* key) {
+    separator();
+    put('"');
+    putRaw(key);
+    put('"');
+    put(':');
+    _needComma = false;
+  }
+
+  /**
+   * @brief Write a string value.
+   *
+   * @param value Null-terminated string (nullptr writes an empty string)
+   */
+  void value(const char* value) {
+    beginString();
+    appendString(value);
+    endString();
+  }
+
+  /**
+   * @brief Write a key and string value pair.
+   *
+   * @param k Key name
+   * @param v String value
+   */
+  void member(const char* k, const char* v) {
+    key(k);
+    value(v);
+  }
+
+  /**
+   * @brief Write a key and string value pair only if the value is not nullptr.
+   *
+   * @param k Key name
+   * @param v String value, or nullptr to skip the member
+   */
+  void optionalMember(const char* k, const char* v) {
+    if (v) {
+      member(k, v);
+    }
+  }
+
+  /**
+   * @brief Write pre-serialized object members (e.g. `"a":"b","c":"d"`) as-is.
+   *
+   * @param json Members without surrounding braces (nullptr or empty writes nothing)
+   */
+  void rawMembers(const char* json) {
+    if (!json || !*json) {
+      return;
+    }
+    separator();
+    putRaw(json);
+    _needComma = true;
+  }
+
+  /**
+   * @brief Write a pre-serialized value (e.g. a number or `true`) as-is.
+   *
+   * @param json Value as JSON text
+   */
+  void rawValue(const char* json) {
+    separator();
+    putRaw(json);
+    _needComma = true;
+  }
+
+  /** @brief Start a string value that is written in pieces with appendString(). */
+  void beginString() {
+    separator();
+    put('"');
+  }
+
+  /**
+   * @brief Append an escaped piece to the string started with beginString().
+   *
+   * @param s Null-terminated string (nullptr is ignored)
+   */
+  void appendString(const char* s) {
+    if (!s) {
+      return;
+    }
+    for (; *s; s++) {
+      putEscaped(*s);
+    }
+  }
+
+  /** @brief Finish a string started with beginString(). */
+  void endString() {
+    put('"');
+    _needComma = true;
+  }
+
+  /**
+   * @brief Pass any staged bytes on to the sink (streaming mode only).
+   *
+   * @return true if the sink has accepted everything written so far
+   */
+  bool flush() {
+    if (_sink && _pos) {
+      if (!_sink(_sinkCtx, _out, _pos)) {
+        _sinkFailed = true;
+      }
+      _pos = 0;
+    }
+    return ok();
+  }
+
+  /**
+   * @brief Check whether everything written so far fit in the buffer,
+   *        or in streaming mode, was accepted by the sink.
+   */
+  bool ok() const {
+    if (_sink) {
+      return !_sinkFailed;
+    }
+    return _cap != 0 && _len < _cap;
+  }
+
+  /** @brief Length of the JSON written so far, including any part that did not fit. */
+  size_t length() const {
+    return _len;
+  }
+
+  /** @brief The output buffer (not null-terminated in streaming mode). */
+  const char* c_str() const {
+    return _out;
+  }
+
+private:
+  void separator() {
+    if (_needComma) {
+      put(',');
+    }
+  }
+
+  void put(char c) {
+    if (_sink) {
+      if (_pos == _cap) {
+        flush();
+      }
+      _out[_pos++] = c;
+    } else if (_len + 1 < _cap) {
+      _out[_len] = c;
+      _out[_len + 1] = '\0';
+    }
+    _len++;
+  }
+
+  void putRaw(const char* s) {
+    while (*s) {
+      put(*s++);
+    }
+  }
+
+  void putEscaped(char c) {
+    static const char hex[] = "0123456789abcdef";
+    switch (c) {
+      case '"':  put('\\'); put('"'); break;
+      case '\\': put('\\'); put('\\'); break;
+      case '\n': put('\\'); put('n'); break;
+      case '\r': put('\\'); put('r'); break;
+      case '\t': put('\\'); put('t'); break;
+      default:
+        if (static_cast<uint8_t>(c) < 0x20) {
+          put('\\'); put('u'); put('0'); put('0');
+          put(hex[(c >> 4) & 0x0F]);
+          put(hex[c & 0x0F]);
+        } else {
+          put(c);
+        }
+        break;
+    }
+  }
+
+  char* _out;
+  size_t _cap;
+  size_t _len = 0;
+  bool _needComma = false;
+  Sink _sink = nullptr;
+  void* _sinkCtx = nullptr;
+  size_t _pos = 0;
+  bool _sinkFailed = false;
+};
+
+/** @} */
@@ -0,0 +1,124 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+/**
+ * @brief Persistent storage for the discovery manifest (see HaDiscovery::setManifestStorage()).
+ *
+ * The manifest is a small binary blob that is read once and rewritten only when a
+ * discovery config changed, so flash wear is negligible.
+ */
+class HaManifestStorage {
+public:
+  virtual ~HaManifestStorage() = default;
+
+  /**
+   * @brief Read the stored manifest.
+   *
+   * @param data Receives the stored bytes
+   * @return true if a manifest was read, false if none is stored or reading failed
+   */
+  virtual bool load(std::string& data) = 0;
+
+  /**
+   * @brief Replace the stored manifest.
+   *
+   * @param data Bytes to store
+   * @return true on success
+   */
+  virtual bool save(const std::string& data) = 0;
+};
+
+/**
+ * @brief Manifest storage in a file, through stdio.
+ *
+ * On native builds this is a plain file. On ESP32 the path can point into a mounted
+ * LittleFS or SPIFFS partition (e.g. "/littlefs/ha_manifest.bin").
+ */
+class HaFileManifestStorage : public HaManifestStorage {
+public:
+  /**
+   * @param path File path (the string must outlive the storage object)
+   */
+  explicit HaFileManifestStorage(const char* path)
+    : path(path) {}
+
+  bool load(std::string& data) override {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    data.clear();
+    char buf[128];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      data.append(buf, n);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+  }
+
+  bool save(const std::string& data) override {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+      return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = fclose(f) == 0 && ok;
+    return ok;
+  }
+
+private:
+  const char* path;
+};
+
+#if defined(ESP32) && __has_include(<Preferences.h>)
+#include <Preferences.h>
+
+/**
+ * @brief Manifest storage in NVS, through the ESP32 Preferences library.
+ */
+class HaPreferencesManifestStorage : public HaManifestStorage {
+public:
+  /**
+   * @param ns  NVS namespace (max 15 characters)
+   * @param key NVS key (max 15 characters)
+   */
+  explicit HaPreferencesManifestStorage(const char* ns = "hadiscovery", const char* key = "manifest")
+    : ns(ns), key(key) {}
+
+  bool load(std::string& data) override {
+    Preferences prefs;
+    if (!prefs.begin(ns, true)) {
+      return false;
+    }
+    size_t n = prefs.getBytesLength(key);
+    data.assign(n, '\0');
+    bool ok = n > 0 && prefs.getBytes(key, &data[0], n) == n;
+    prefs.end();
+    return ok;
+  }
+
+  bool save(const std::string& data) override {
+    Preferences prefs;
+    if (!prefs.begin(ns, false)) {
+      return false;
+    }
+    bool ok = prefs.putBytes(key, data.data(), data.size()) == data.size();
+    prefs.end();
+    return ok;
+  }
+
+private:
+  const char* ns;
+  const char* key;
+};
+#endif
+
+/** @} */
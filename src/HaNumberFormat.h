@@ -0,0 +1,155 @@
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+/**
+ * @brief Buffer size that fits any number written by the haFormat*() functions.
+ *
+ * Sign, 20 digits, decimal point and the null terminator.
+ */
+static constexpr size_t HA_NUMBER_BUF = 24;
+
+/** @brief Maximum number of decimals accepted by haFormatFloat(). */
+static constexpr uint8_t HA_NUMBER_MAX_PRECISION = 9;
+
+namespace ha_number {
+
+/** @brief Write the decimal digits of v right-aligned, ending just before end. Returns the first digit. */
+inline char* writeDigits(char* end, uint32_t v) {
+  do {
+    *--end = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v);
+  return end;
+}
+
+/** @brief 64-bit variant; stays on 32-bit division (cheap on 32-bit MCUs) once the value fits. */
+inline char* writeDigits(char* end, uint64_t v) {
+  while (v > 0xFFFFFFFFULL) {
+    *--end = static_cast<char>('0' + v % 10);
+    v /= 10;
+  }
+  return writeDigits(end, static_cast<uint32_t>(v));
+}
+
+inline size_t copyOut(char* out, size_t outLen, const char* s, size_t n) {
+  if (n + 1 > outLen) {
+    if (outLen) {
+      out[0] = '\0';
+    }
+    return 0;
+  }
+  for (size_t i = 0; i < n; i++) {
+    out[i] = s[i];
+  }
+  out[n] = '\0';
+  return n;
+}
+
+}  // namespace ha_number
+
+/**
+ * @brief Write an unsigned integer as decimal text.
+ *
+ * @param out    Output buffer
+ * @param outLen Size of the output buffer in bytes (including the null terminator)
+ * @param value  Value to write
+ * @return Number of characters written, or 0 if the buffer is too small
+ */
+inline size_t haFormatUint(char* out, size_t outLen, uint32_t value) {
+  char tmp[HA_NUMBER_BUF];
+  char* end = tmp + sizeof(tmp);
+  char* p = ha_number::writeDigits(end, value);
+  return ha_number::copyOut(out, outLen, p, static_cast<size_t>(end - p));
+}
+
+/**
+ * @brief Write a signed integer as decimal text.
+ *
+ * @param out    Output buffer
+ * @param outLen Size of the output buffer in bytes (including the null terminator)
+ * @param value  Value to write
+ * @return Number of characters written, or 0 if the buffer is too small
+ */
+inline size_t haFormatInt(char* out, size_t outLen, int32_t value) {
+  char tmp[HA_NUMBER_BUF];
+  char* end = tmp + sizeof(tmp);
+  uint32_t mag = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+  char* p = ha_number::writeDigits(end, mag);
+  if (value < 0) {
+    *--p = '-';
+  }
+  return ha_number::copyOut(out, outLen, p, static_cast<size_t>(end - p));
+}
+
+/**
+ * @brief Write a float with a fixed number of decimals, without printf and independent of locale.
+ *
+ * The output matches `snprintf("%.*f", precision, value)`, including round-half-to-even on exact
+ * ties and "-0.0" for small negative values. NaN and infinities are written as "nan", "inf" and
+ * "-inf". Values too large to print with all requested decimals (|value| * 10^precision >= 1e19)
+ * are rejected.
+ *
+ * @param out       Output buffer
+ * @param outLen    Size of the output buffer in bytes (including the null terminator)
+ * @param value     Value to write
+ * @param precision Number of decimals (clamped to HA_NUMBER_MAX_PRECISION)
+ * @return Number of characters written, or 0 if the value or buffer is out of range
+ */
+inline size_t haFormatFloat(char* out, size_t outLen, float value, uint8_t precision) {
+  static const uint32_t kPow10[] = {
+    1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL
+  };
+  if (precision > HA_NUMBER_MAX_PRECISION) {
+    precision = HA_NUMBER_MAX_PRECISION;
+  }
+
+  if (isnan(value)) {
+    return ha_number::copyOut(out, outLen, "nan", 3);
+  }
+  bool negative = signbit(value);
+  if (isinf(value)) {
+    return negative ? ha_number::copyOut(out, outLen, "-inf", 4) : ha_number::copyOut(out, outLen, "inf", 3);
+  }
+  double mag = negative ? -static_cast<double>(value) : static_cast<double>(value);
+
+  // A float has 24 significant bits and 10^9 fits in 30, so the scaled value is exact in a double
+  // for all but the largest precisions; the remaining error is far below the rounding step.
+  double scaled = mag * static_cast<double>(kPow10[precision]);
+  if (scaled >= 1e19) {
+    if (outLen) {
+      out[0] = '\0';
+    }
+    return 0;
+  }
+  uint64_t units = static_cast<uint64_t>(scaled);
+  double frac = scaled - static_cast<double>(units);
+  if (frac > 0.5 || (frac == 0.5 && (units & 1))) {
+    units++;
+  }
+
+  char tmp[HA_NUMBER_BUF];
+  char* end = tmp + sizeof(tmp);
+  char* p = end;
+  if (precision) {
+    uint32_t fraction = static_cast<uint32_t>(units % kPow10[precision]);
+    for (uint8_t i = 0; i < precision; i++) {
+      *--p = static_cast<char>('0' + fraction % 10);
+      fraction /= 10;
+    }
+    *--p = '.';
+  }
+  p = ha_number::writeDigits(p, units / kPow10[precision]);
+  if (negative) {
+    *--p = '-';
+  }
+  return ha_number::copyOut(out, outLen, p, static_cast<size_t>(end - p));
+}
+
+/** @} */
@@ -0,0 +1,157 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+/**
+ * @brief Contiguous array that lives on the heap or in caller-supplied storage.
+ *
+ * By default it grows like a std::vector. After setBuffer() the elements are kept in the given
+ * array instead: the capacity is fixed, growing past it fails (push_back() and assign() return
+ * false) and nothing touches the heap. HaDiscovery keeps its registry in these so that an
+ * HaEntityTable can provide the storage.
+ *
+ * Element access is a plain pointer index in both modes.
+ */
+template <typename T>
+class HaSlotVector {
+public:
+  HaSlotVector() = default;
+
+  HaSlotVector(const HaSlotVector& other)
+    : _heap(other._heap), _buf(other._buf), _size(other._size), _cap(other._cap) {
+    sync();
+  }
+
+  HaSlotVector& operator=(const HaSlotVector& other) {
+    if (this != &other) {
+      _heap = other._heap;
+      _buf = other._buf;
+      _size = other._size;
+      _cap = other._cap;
+      sync();
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Keep the elements in a caller-supplied array, discarding the current ones.
+   *
+   * @param buf      Array that outlives this object, or nullptr to go back to the heap
+   * @param capacity Number of elements in buf
+   */
+  void setBuffer(T* buf, size_t capacity) {
+    std::vector<T>().swap(_heap);
+    _buf = buf;
+    _cap = buf ? capacity : 0;
+    _size = 0;
+    sync();
+  }
+
+  /** @brief True when the elements live in a caller-supplied array. */
+  bool fixed() const { return _buf != nullptr; }
+
+  size_t size() const { return _size; }
+  size_t capacity() const { return _buf ? _cap : _heap.capacity(); }
+  bool empty() const { return _size == 0; }
+
+  T* data() { return _data; }
+  const T* data() const { return _data; }
+  T& operator[](size_t i) { return _data[i]; }
+  const T& operator[](size_t i) const { return _data[i]; }
+  T& back() { return _data[_size - 1]; }
+  T* begin() { return _data; }
+  T* end() { return _data + _size; }
+  const T* begin() const { return _data; }
+  const T* end() const { return _data + _size; }
+
+  /** @return false if the caller-supplied array is full */
+  bool push_back(const T& value) {
+    if (_buf) {
+      if (_size >= _cap) {
+        return false;
+      }
+      _buf[_size++] = value;
+      return true;
+    }
+    _heap.push_back(value);
+    _size = _heap.size();
+    sync();
+    return true;
+  }
+
+  void pop_back() {
+    if (_buf) {
+      _size--;
+    } else {
+      _heap.pop_back();
+      _size = _heap.size();
+    }
+  }
+
+  /** @brief Shrink to count elements; growing is only done by push_back() and assign(). */
+  void truncate(size_t count) {
+    if (count >= _size) {
+      return;
+    }
+    if (_buf) {
+      _size = count;
+    } else {
+      _heap.resize(count);
+      _size = count;
+    }
+  }
+
+  void clear() { truncate(0); }
+
+  /** @brief Remove the element at it, keeping the order of the others. */
+  void erase(T* it) {
+    for (T* next = it + 1; next < end(); it++, next++) {
+      *it = *next;
+    }
+    truncate(_size - 1);
+  }
+
+  /** @return false if count exceeds the caller-supplied array (the contents are then unchanged) */
+  bool assign(size_t count, const T& value) {
+    if (_buf) {
+      if (count > _cap) {
+        return false;
+      }
+      for (size_t i = 0; i < count; i++) {
+        _buf[i] = value;
+      }
+      _size = count;
+      return true;
+    }
+    _heap.assign(count, value);
+    _size = count;
+    sync();
+    return true;
+  }
+
+  /** @brief Preallocate heap capacity; no-op with a caller-supplied array. */
+  void reserve(size_t count) {
+    if (!_buf) {
+      _heap.reserve(count);
+      sync();
+    }
+  }
+
+private:
+  void sync() {
+    _data = _buf ? _buf : _heap.data();
+  }
+
+  std::vector<T> _heap;
+  T* _buf = nullptr;
+  T* _data = nullptr;
+  size_t _size = 0;
+  size_t _cap = 0;
+};
+
+/** @} */
@@ -0,0 +1,227 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "HaComponentFields.h"
+#include "HaDiscovery.h"
+
+#if __cplusplus < 201402L
+#error "HaStaticEntity.h requires C++14 or later (e.g. build_flags = -std=gnu++17)"
+#endif
+
+/**
+ * @addtogroup hadiscovery
+ * @{
+ */
+
+namespace ha_static {
+
+using ha_fields::FieldType;
+
+/**
+ * @brief constexpr JSON member writer used to pre-serialize the invariant part of a config.
+ *
+ * With a nullptr output it only counts, which is how the size of the stored payload is found.
+ */
+struct ConstWriter {
+  char* out;
+  size_t cap;
+  size_t len;
+
+  constexpr void put(char c) {
+    if (out && len < cap) {
+      out[len] = c;
+    }
+    len++;
+  }
+
+  constexpr void raw(const char* s) {
+    while (*s) {
+      put(*s++);
+    }
+  }
+
+  constexpr void escaped(const char* s) {
+    const char* hex = "0123456789abcdef";
+    for (; *s; s++) {
+      char c = *s;
+      if (c == '"' || c == '\\') {
+        put('\\');
+        put(c);
+      } else if (c == '\n') {
+        raw("\\n");
+      } else if (c == '\r') {
+        raw("\\r");
+      } else if (c == '\t') {
+        raw("\\t");
+      } else if (static_cast<uint8_t>(c) < 0x20) {
+        raw("\\u00");
+        put(hex[(c >> 4) & 0x0F]);
+        put(hex[c & 0x0F]);
+      } else {
+        put(c);
+      }
+    }
+  }
+
+  constexpr void member(const char* key, const char* value) {
+    if (len) {
+      put(',');
+    }
+    put('"');
+    raw(key);
+    raw("\":\"");
+    escaped(value);
+    put('"');
+  }
+
+  constexpr void optionalMember(const char* key, const char* value) {
+    if (value) {
+      member(key, value);
+    }
+  }
+
+  // Payloads equal to Home Assistant's default are left to HaDiscovery, which writes them
+  // unless the config format is compact.
+  constexpr void payloadMember(const char* key, const char* value, const char* ha_default) {
+    if (value && !equal(value, ha_default)) {
+      member(key, value);
+    }
+  }
+
+  constexpr void list(const char* key, const char* const* items) {
+    if (len) {
+      put(',');
+    }
+    put('"');
+    raw(key);
+    raw("\":[");
+    for (const char* const* item = items; *item; item++) {
+      if (item != items) {
+        put(',');
+      }
+      put('"');
+      escaped(*item);
+      put('"');
+    }
+    put(']');
+  }
+
+  // One overload per member type of the field lists in HaComponentFields.h. Topics, numbers and
+  // availability are written by HaDiscovery when the config is published.
+  constexpr void field(FieldType type, const char* key, const char* def, const char* value) {
+    if (type == FieldType::String) {
+      optionalMember(key, value);
+    } else if (type == FieldType::Payload) {
+      payloadMember(key, value, def);
+    }
+  }
+
+  constexpr void field(FieldType type, const char* key, const char*, const char* const* items) {
+    if (type == FieldType::StringList && items) {
+      list(key, items);
+    }
+  }
+
+  constexpr void field(FieldType type, const char* key, const char* def, const HaEntityCommon&) {
+    if (type == FieldType::Constant) {
+      member(key, def);
+    }
+  }
+
+  constexpr void field(FieldType, const char*, const char*, float) {}
+  constexpr void field(FieldType, const char*, const char*, uint16_t) {}
+
+  static constexpr bool equal(const char* a, const char* b) {
+    for (; *a && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+  }
+};
+
+// Invariant members per component, from the same field lists as the runtime serializer.
+// Topics, uniq_id, availability, numbers, defaulted payloads and the device block depend on
+// runtime values or the config format and are added by HaDiscovery when the config is published.
+
+#define HA_STATIC_FIELD(config, type, key, def, member) w.field(FieldType::type, key, def, cfg.member);
+#define HA_STATIC_WRITER(Config, FIELDS)                                        \
+  constexpr void writeFixed(ConstWriter& w, const Config& cfg) {                \
+    w.member("name", cfg.common.name ? cfg.common.name : cfg.common.object_id); \
+    FIELDS(HA_STATIC_FIELD)                                                     \
+  }
+
+HA_STATIC_WRITER(HaSensorConfig, HA_SENSOR_FIELDS)
+HA_STATIC_WRITER(HaSwitchConfig, HA_SWITCH_FIELDS)
+HA_STATIC_WRITER(HaBinarySensorConfig, HA_BINARY_SENSOR_FIELDS)
+HA_STATIC_WRITER(HaButtonConfig, HA_BUTTON_FIELDS)
+HA_STATIC_WRITER(HaNumberConfig, HA_NUMBER_FIELDS)
+HA_STATIC_WRITER(HaSelectConfig, HA_SELECT_FIELDS)
+HA_STATIC_WRITER(HaLightConfig, HA_LIGHT_FIELDS)
+HA_STATIC_WRITER(HaCoverConfig, HA_COVER_FIELDS)
+HA_STATIC_WRITER(HaClimateConfig, HA_CLIMATE_FIELDS)
+
+#undef HA_STATIC_WRITER
+#undef HA_STATIC_FIELD
+
+/** @brief Length of the pre-serialized invariant members of a config. */
+template <typename Cfg>
+constexpr size_t fixedLength(const Cfg& cfg) {
+  ConstWriter w{nullptr, 0, 0};
+  writeFixed(w, cfg);
+  return w.len;
+}
+
+}  // namespace ha_static
+
+/**
+ * @brief Compile-time entity schema: a config plus its pre-serialized invariant JSON members.
+ *
+ * Declare it with HA_STATIC_ENTITY() from a `constexpr` config so the JSON is generated by the
+ * compiler and stored as read-only data (flash on ESP32). Register it with
+ * HaDiscovery::registerStatic() or publish it with HaDiscovery::publishStaticDiscovery();
+ * at runtime only uniq_id, topics, availability, numbers and the device block are added, plus
+ * the payloads left at Home Assistant's default unless the config format is
+ * HaConfigFormat::Compact.
+ *
+ * @tparam Cfg Any component config (HaSensorConfig, HaSwitchConfig, ..., HaClimateConfig)
+ * @tparam N   Size of the stored JSON including the null terminator
+ */
+template <typename Cfg, size_t N>
+struct HaStaticEntity {
+  /** @brief The entity config. */
+  Cfg config;
+
+  /** @brief Invariant members as JSON, without braces (e.g. `"name":"Temp","dev_cla":"temperature"`). */
+  char json[N];
+
+  /** @brief Build the schema from a config (evaluated at compile time for constexpr configs). */
+  constexpr explicit HaStaticEntity(const Cfg& cfg)
+    : config(cfg), json{} {
+    ha_static::ConstWriter w{json, N - 1, 0};
+    ha_static::writeFixed(w, cfg);
+  }
+};
+
+/** @brief Create an HaStaticEntity with an explicit JSON size. Prefer HA_STATIC_ENTITY(). */
+template <size_t N, typename Cfg>
+constexpr HaStaticEntity<Cfg, N> haMakeStaticEntity(const Cfg& cfg) {
+  return HaStaticEntity<Cfg, N>(cfg);
+}
+
+/**
+ * @brief Declare a compile-time entity schema from a `constexpr` config.
+ *
+ * @code
+ * constexpr HaSensorConfig kTempCfg{
+ *   .common = { .object_id = "temperature", .name = "Temperature" },
+ *   .unit_of_measurement = "°C",
+ *   .device_class = "temperature"
+ * };
+ * HA_STATIC_ENTITY(kTemp, kTempCfg);
+ *
+ * ha.publishStaticDiscovery(kTemp);
+ * @endcode
+ */
+#define HA_STATIC_ENTITY(name, cfg) \
+  constexpr auto name = haMakeStaticEntity<ha_static::fixedLength(cfg) + 1>(cfg)
+
+/** @} */
@@ -1,5 +1,7 @@
 #pragma once
 #include "MqttTransport.h"
+#include "MqttMutex.h"
+#include "MqttPublishQueue.h"
 #include <AsyncMqttClient.h>
 
 /**
@@ -20,6 +22,19 @@
  *
  * This transport provides the most reliable behavior for Home Assistant
  * discovery and availability handling.
+ *
+ * AsyncMqttClient needs the whole payload in one buffer, so streamed publishes are
+ * collected in an exactly sized buffer (or the one given to setStreamBuffer()) and sent
+ * from endPublish().
+ *
+ * Messages that cannot be sent right away (disconnected, or AsyncTCP's send buffer full)
+ * are copied into a bounded queue (see setQueueLimits()) and retried in order on the next
+ * publish, on tick(), on PUBACK and on reconnect. publish() returns false only when a
+ * message is neither sent nor queued.
+ *
+ * QoS 1/2 publishes are tracked by packet id until AsyncMqttClient reports them acknowledged
+ * (onPublish). At most setInFlightWindow() of them are unacknowledged at a time; further ones
+ * wait in the queue. Completion is reported through setOnPublishComplete() and ackStats().
  */
 class AsyncMqttClientTransport : public MqttTransport {
 public:
@@ -29,7 +44,130 @@ public:
    * @param client Reference to an already configured AsyncMqttClient instance
    */
   explicit AsyncMqttClientTransport(AsyncMqttClient& client)
-    : client(client) {}
+    : client(client) {
+    queue.setLimits(DEFAULT_QUEUE_BYTES, DEFAULT_QUEUE_ENTRIES, MqttQueueDropPolicy::DropNewest);
+    queue.setEvictCallback(&AsyncMqttClientTransport::onEvict, this);
+  }
+
+  using MqttTransport::setServer;
+
+  /** @brief Default outbound queue size in bytes. */
+  static constexpr size_t DEFAULT_QUEUE_BYTES = 4096;
+
+  /** @brief Default maximum number of queued messages. */
+  static constexpr size_t DEFAULT_QUEUE_ENTRIES = 32;
+
+  /** @brief Largest supported in-flight window. */
+  static constexpr size_t MAX_IN_FLIGHT = 16;
+
+  /** @brief Default in-flight window. */
+  static constexpr size_t DEFAULT_IN_FLIGHT = 8;
+
+  /**
+   * @brief Limit the number of unacknowledged QoS 1/2 publishes.
+   *
+   * @param window Maximum in-flight publishes (clamped to 1..MAX_IN_FLIGHT)
+   */
+  void setInFlightWindow(size_t window) {
+    MqttLock lock(queueMutex);
+    inFlightWindow = window < 1 ? 1 : window > MAX_IN_FLIGHT ? MAX_IN_FLIGHT : window;
+  }
+
+  /** @brief Number of QoS 1/2 publishes awaiting acknowledgement. */
+  size_t inFlight() const {
+    MqttLock lock(queueMutex);
+    return inFlightCount;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setOnPublishComplete(PublishCompleteFn cb_, void* ctx_) override {
+    MqttLock lock(queueMutex);
+    completeCb = cb_;
+    completeCtx = ctx_;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  uint32_t lastPublishTicket() const override {
+    return lastTicket;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  size_t publishWindow() const override {
+    MqttLock lock(queueMutex);
+    return inFlightWindow > inFlightCount ? inFlightWindow - inFlightCount : 0;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  size_t pendingPublishes() const override {
+    MqttLock lock(queueMutex);
+    return inFlightCount + queue.size();
+  }
+
+  /**
+   * @inheritdoc
+   */
+  MqttAckStats ackStats() const override {
+    MqttLock lock(queueMutex);
+    MqttAckStats s = stats;
+    s.avgLatencyMs = s.acked ? static_cast<uint32_t>(latencySumMs / s.acked) : 0;
+    return s;
+  }
+
+  /**
+   * @brief Configure the outbound queue, discarding anything queued.
+   *
+   * Each queued message uses its topic and payload length plus about 20 bytes.
+   *
+   * @param max_bytes   Queue buffer size in bytes (0 disables queueing)
+   * @param max_entries Maximum number of queued messages (0 for no entry limit)
+   * @param policy      Whether a full queue rejects new messages or evicts the oldest ones
+   * @return false if the buffer could not be allocated
+   */
+  bool setQueueLimits(size_t max_bytes, size_t max_entries,
+                      MqttQueueDropPolicy policy = MqttQueueDropPolicy::DropNewest) {
+    MqttLock lock(queueMutex);
+    return queue.setLimits(max_bytes, max_entries, policy);
+  }
+
+  /**
+   * @brief Use a caller-supplied queue buffer instead of a heap allocation, discarding anything queued.
+   *
+   * @param buf         Buffer that outlives the transport (4-byte aligned), or nullptr to disable queueing
+   * @param len         Buffer size in bytes
+   * @param max_entries Maximum number of queued messages (0 for no entry limit)
+   * @param policy      Whether a full queue rejects new messages or evicts the oldest ones
+   */
+  void setQueueBuffer(uint8_t* buf, size_t len, size_t max_entries,
+                      MqttQueueDropPolicy policy = MqttQueueDropPolicy::DropNewest) {
+    MqttLock lock(queueMutex);
+    queue.setBuffer(buf, len, max_entries, policy);
+  }
+
+  /** @brief Number of messages waiting in the outbound queue. */
+  size_t queueDepth() const {
+    MqttLock lock(queueMutex);
+    return queue.size();
+  }
+
+  /** @brief Bytes of the outbound queue in use. */
+  size_t queueBytes() const {
+    MqttLock lock(queueMutex);
+    return queue.bytes();
+  }
+
+  /** @brief Messages dropped because the queue was full, disabled or too small (rejected or evicted). */
+  uint32_t queueDrops() const {
+    MqttLock lock(queueMutex);
+    return queue.dropped();
+  }
 
   /**
    * @brief Set MQTT server and credentials.
@@ -61,6 +199,17 @@ public:
     }
   }
 
+  /**
+   * @inheritdoc
+   */
+  bool setWill(const MqttWill& will) override {
+    // AsyncMqttClient keeps the pointers, so the strings live in the transport.
+    willTopic = will.topic ? will.topic : "";
+    willPayload = will.payload ? will.payload : "";
+    client.setWill(will.topic ? willTopic.c_str() : nullptr, will.qos, will.retain, willPayload.c_str());
+    return true;
+  }
+
   /**
    * @inheritdoc
    */
@@ -76,24 +225,104 @@ public:
                size_t len,
                bool retained,
                uint8_t qos) override {
-    if (!isConnected) {
-      if (log) log->warn("Async publish skipped (disconnected) topic=%s", topic);
+    size_t l = payload ? len : 0;
+
+    HA_LOGD(log, "Async publish topic=%s len=%u retained=%d qos=%u", topic,
+            (unsigned)l, retained ? 1 : 0, (unsigned)qos);
+
+    MqttLock lock(queueMutex);
+    uint32_t ticket = ++ticketSeq;
+    if (ticket == 0) {
+      ticket = ++ticketSeq;
+    }
+    lastTicket = ticket;
+
+    // Older queued messages go first, so a new message may only bypass an empty queue.
+    drainQueue();
+    if (queue.size() == 0 && isConnected && windowOpen(qos) && send(topic, payload, l, retained, qos, ticket)) {
+      return true;
+    }
+
+    if (!queue.push(topic, payload, l, retained, qos, qos ? ticket : 0)) {
+      HA_LOGE(log, "Async publish FAILED topic=%s (%s)", topic,
+              queue.enabled() ? "queue full" : isConnected ? "client busy" : "disconnected");
       return false;
     }
+    HA_LOGD(log, "Async publish queued topic=%s depth=%u", topic, (unsigned)queue.size());
+    return true;
+  }
 
-    const char* p = payload ? reinterpret_cast<const char*>(payload) : "";
-    size_t l = payload ? len : 0;
+  /**
+   * @brief Retry queued messages. Optional; the queue is also drained on publish, PUBACK and reconnect.
+   */
+  void tick() override {
+    MqttLock lock(queueMutex, true);
+    if (lock.ownsLock()) {
+      drainQueue();
+    }
+  }
 
-    if (log) log->debug("Async publish topic=%s len=%u retained=%d qos=%u", topic,
-                        (unsigned)l, retained ? 1 : 0, (unsigned)qos);
+  /** @brief Largest incoming payload that is reassembled when AsyncMqttClient delivers it in parts. */
+  static constexpr size_t MAX_FRAGMENTED_PAYLOAD = 1024;
 
-    uint16_t pid = client.publish(topic, qos, retained, p, l);
-    if (pid == 0) {
-      if (log) log->error("Async publish FAILED topic=%s", topic);
-    } else {
-      if (log) log->debug("Async publish OK topic=%s pid=%u", topic, (unsigned)pid);
+  /**
+   * @inheritdoc
+   */
+  bool subscribe(const char* topic, uint8_t qos) override {
+    if (!isConnected) {
+      return false;
     }
-    return true;
+    bool ok = client.subscribe(topic, qos) != 0;
+    if (!ok) {
+      HA_LOGE(log, "Async subscribe FAILED topic=%s", topic);
+    }
+    return ok;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool unsubscribe(const char* topic) override {
+    return isConnected && client.unsubscribe(topic) != 0;
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * Called from the AsyncTCP task. Payloads that AsyncMqttClient splits into several parts are
+   * reassembled first, up to MAX_FRAGMENTED_PAYLOAD bytes; larger ones are dropped.
+   */
+  void setOnMessage(MessageFn cb_, void* ctx_) override {
+    msgCb = cb_;
+    msgCtx = ctx_;
+    client.onMessage([this](char* topic, char* payload, AsyncMqttClientMessageProperties /*properties*/,
+                            size_t len, size_t index, size_t total) {
+      if (!msgCb) {
+        return;
+      }
+      if (index == 0 && len == total) {
+        msgCb(msgCtx, topic, reinterpret_cast<const uint8_t*>(payload), len);
+        return;
+      }
+      if (total > MAX_FRAGMENTED_PAYLOAD) {
+        if (index == 0) {
+          HA_LOGW(log, "Async message too large topic=%s len=%u", topic, (unsigned)total);
+        }
+        return;
+      }
+      if (index == 0) {
+        fragmentLen = 0;
+      }
+      if (index != fragmentLen || len > total - index) {
+        return;  // out of sequence
+      }
+      memcpy(fragment + fragmentLen, payload, len);
+      fragmentLen += len;
+      if (fragmentLen == total) {
+        msgCb(msgCtx, topic, fragment, fragmentLen);
+        fragmentLen = 0;
+      }
+    });
   }
 
   /**
@@ -105,6 +334,7 @@ public:
 
     client.onConnect([this](bool /*sessionPresent*/) {
       isConnected = true;
+      tick();
       if (cb) {
         cb(ctx);
       }
@@ -112,14 +342,149 @@ public:
 
     client.onDisconnect([this](AsyncMqttClientDisconnectReason /*reason*/) {
       isConnected = false;
+      // Unacknowledged packets are not resent by AsyncMqttClient after a reconnect.
+      InFlight lost[MAX_IN_FLIGHT];
+      size_t n = 0;
+      PublishCompleteFn fn;
+      void* fnCtx;
+      {
+        MqttLock lock(queueMutex);
+        for (InFlight& f : inFlightSlots) {
+          if (f.packetId) {
+            lost[n++] = f;
+            f.packetId = 0;
+          }
+        }
+        inFlightCount = 0;
+        stats.failed += static_cast<uint32_t>(n);
+        fn = completeCb;
+        fnCtx = completeCtx;
+      }
+      if (fn) {
+        for (size_t i = 0; i < n; i++) {
+          fn(fnCtx, lost[i].ticket, false, 0);
+        }
+      }
+    });
+
+    // An acknowledged packet frees a window slot and means the connection is making progress.
+    client.onPublish([this](uint16_t packetId) {
+      onAck(packetId);
+      tick();
     });
   }
 
 private:
+  struct InFlight {
+    uint16_t packetId = 0;
+    uint32_t ticket = 0;
+    uint32_t sentMs = 0;
+  };
+
+  // Called with queueMutex held.
+  bool windowOpen(uint8_t qos) const {
+    return qos == 0 || inFlightCount < inFlightWindow;
+  }
+
+  // Called with queueMutex held. AsyncMqttClient returns packet id 0 when the message was not accepted.
+  bool send(const char* topic, const uint8_t* payload, size_t len, bool retained, uint8_t qos, uint32_t ticket) {
+    // A zero length makes AsyncMqttClient use strlen(payload), so empty payloads must be "".
+    const char* p = len ? reinterpret_cast<const char*>(payload) : "";
+    uint16_t pid = client.publish(topic, qos, retained, p, len);
+    if (pid == 0) {
+      return false;
+    }
+    if (qos > 0) {
+      for (InFlight& f : inFlightSlots) {
+        if (f.packetId == 0) {
+          f.packetId = pid;
+          f.ticket = ticket;
+          f.sentMs = mqttMillis();
+          inFlightCount++;
+          break;
+        }
+      }
+    }
+    HA_LOGD(log, "Async publish OK topic=%s pid=%u", topic, (unsigned)pid);
+    return true;
+  }
+
+  // Called with queueMutex held.
+  void drainQueue() {
+    MqttPublishQueue::Entry e;
+    while (isConnected && queue.front(e) && windowOpen(e.qos)) {
+      if (!send(e.topic, e.payload, e.len, e.retained, e.qos, e.tag)) {
+        break;
+      }
+      queue.pop();
+    }
+  }
+
+  void onAck(uint16_t packetId) {
+    uint32_t ticket = 0;
+    uint32_t latency = 0;
+    PublishCompleteFn fn;
+    void* fnCtx;
+    {
+      MqttLock lock(queueMutex);
+      InFlight* slot = nullptr;
+      for (InFlight& f : inFlightSlots) {
+        if (f.packetId == packetId) {
+          slot = &f;
+          break;
+        }
+      }
+      if (!slot) {
+        return;
+      }
+      ticket = slot->ticket;
+      latency = mqttMillis() - slot->sentMs;
+      slot->packetId = 0;
+      inFlightCount--;
+      stats.acked++;
+      stats.lastLatencyMs = latency;
+      if (latency > stats.maxLatencyMs) {
+        stats.maxLatencyMs = latency;
+      }
+      latencySumMs += latency;
+      fn = completeCb;
+      fnCtx = completeCtx;
+    }
+    HA_LOGD(log, "Async publish acked pid=%u latency=%ums", (unsigned)packetId, (unsigned)latency);
+    if (fn) {
+      fn(fnCtx, ticket, true, latency);
+    }
+  }
+
+  // Called with queueMutex held. Only QoS 1/2 messages are queued with a non-zero tag.
+  static void onEvict(void* self, uint32_t tag) {
+    if (tag) {
+      static_cast<AsyncMqttClientTransport*>(self)->stats.failed++;
+    }
+  }
+
   AsyncMqttClient& client;
+  MqttPublishQueue queue;
+  InFlight inFlightSlots[MAX_IN_FLIGHT];
+  size_t inFlightCount = 0;
+  size_t inFlightWindow = DEFAULT_IN_FLIGHT;
+  uint32_t ticketSeq = 0;
+  volatile uint32_t lastTicket = 0;
+  MqttAckStats stats;
+  uint64_t latencySumMs = 0;
+  PublishCompleteFn completeCb = nullptr;
+  void* completeCtx = nullptr;
+  // Publishes come from the application task, retries also from AsyncTCP callbacks.
+  mutable MqttMutex queueMutex;
   volatile bool isConnected = false;
   void (*cb)(void*) = nullptr;
   /** @brief Pointer to user context for callback. */
   void* ctx = nullptr;
+  MessageFn msgCb = nullptr;
+  void* msgCtx = nullptr;
+  std::string willTopic;
+  std::string willPayload;
+  uint8_t fragment[MAX_FRAGMENTED_PAYLOAD];
+  size_t fragmentLen = 0;
 };
 /** @} */
@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+
+#if defined(ESP32) || !defined(ARDUINO)
+#include <mutex>
+#define MQTT_MUTEX_THREADED 1
+#else
+#define MQTT_MUTEX_THREADED 0
+#endif
+
+/**
+ * @addtogroup transport
+ * @{
+ */
+
+/**
+ * @brief Lock for state shared between the application and the MQTT client's callbacks.
+ *
+ * On ESP32 (and native builds) the callbacks run on another task, so this is a std::mutex.
+ * Single-core Arduino cores such as ESP8266 run them from the same loop as the sketch and
+ * have no std::mutex; there the lock only records that it is held, so try_lock() still keeps
+ * a callback from re-entering a section it interrupted.
+ */
+class MqttMutex {
+public:
+  MqttMutex() = default;
+  MqttMutex(const MqttMutex&) = delete;
+  MqttMutex& operator=(const MqttMutex&) = delete;
+
+#if MQTT_MUTEX_THREADED
+  void lock() { mutex.lock(); }
+  bool try_lock() { return mutex.try_lock(); }
+  void unlock() { mutex.unlock(); }
+
+private:
+  std::mutex mutex;
+#else
+  void lock() { depth++; }
+  bool try_lock() {
+    if (depth) {
+      return false;
+    }
+    depth++;
+    return true;
+  }
+  void unlock() { depth--; }
+
+private:
+  volatile uint8_t depth = 0;
+#endif
+};
+
+/**
+ * @brief Scoped MqttMutex lock, optionally only taken if it is free.
+ */
+class MqttLock {
+public:
+  explicit MqttLock(MqttMutex& m) : mutex(m), owned(true) { mutex.lock(); }
+  MqttLock(MqttMutex& m, bool try_only) : mutex(m), owned(try_only ? m.try_lock() : (m.lock(), true)) {}
+  ~MqttLock() {
+    if (owned) {
+      mutex.unlock();
+    }
+  }
+  MqttLock(const MqttLock&) = delete;
+  MqttLock& operator=(const MqttLock&) = delete;
+
+  /** @brief False if a try-only lock found the mutex held. */
+  bool ownsLock() const { return owned; }
+
+private:
+  MqttMutex& mutex;
+  bool owned;
+};
+
+/** @} */
@@ -0,0 +1,311 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <new>
+
+/**
+ * @addtogroup transport
+ * @{
+ */
+
+/**
+ * @brief What to do when a message does not fit in a full publish queue.
+ */
+enum class MqttQueueDropPolicy : uint8_t {
+  DropNewest,  /**< Reject the new message (the publish call returns false) */
+  DropOldest   /**< Evict the oldest queued messages until the new one fits */
+};
+
+/**
+ * @brief Bounded FIFO of outbound MQTT messages in a single preallocated ring buffer.
+ *
+ * Each entry (header, null-terminated topic, payload) is stored contiguously so it can be
+ * handed to the MQTT client without copying. An entry that does not fit before the end of
+ * the buffer starts again at offset 0, leaving the tail unused until the reader passes it.
+ *
+ * Limits are the buffer size in bytes and a maximum number of entries. The buffer is
+ * allocated once by setLimits(), or supplied by the caller with setBuffer(); push/pop
+ * never touch the heap.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+class MqttPublishQueue {
+public:
+  /** @brief A queued message. Pointers stay valid until the entry is popped or evicted. */
+  struct Entry {
+    const char* topic;
+    const uint8_t* payload;
+    size_t len;
+    bool retained;
+    uint8_t qos;
+    uint32_t tag;
+  };
+
+  /** @brief Called for each message evicted by DropOldest, with the tag it was pushed with. */
+  typedef void (*EvictFn)(void* ctx, uint32_t tag);
+
+  MqttPublishQueue() = default;
+  MqttPublishQueue(const MqttPublishQueue&) = delete;
+  MqttPublishQueue& operator=(const MqttPublishQueue&) = delete;
+
+  ~MqttPublishQueue() {
+    release();
+  }
+
+  /**
+   * @brief Set the queue limits, discarding anything queued.
+   *
+   * @param max_bytes   Ring buffer size in bytes (0 disables the queue)
+   * @param max_entries Maximum number of queued messages (0 means no limit besides max_bytes)
+   * @param policy      Behavior when full
+   * @return false if the buffer could not be allocated (the queue is then disabled)
+   */
+  bool setLimits(size_t max_bytes, size_t max_entries, MqttQueueDropPolicy policy) {
+    release();
+    _maxEntries = max_entries;
+    _policy = policy;
+    if (max_bytes == 0) {
+      return true;
+    }
+    max_bytes &= ~static_cast<size_t>(kAlign - 1);
+    _buf = new (std::nothrow) uint8_t[max_bytes];
+    if (!_buf) {
+      return false;
+    }
+    _owned = true;
+    _cap = max_bytes;
+    return true;
+  }
+
+  /**
+   * @brief Use a caller-supplied ring buffer, discarding anything queued.
+   *
+   * @param buf         Buffer that outlives the queue (4-byte aligned), or nullptr to disable the queue
+   * @param len         Buffer size in bytes
+   * @param max_entries Maximum number of queued messages (0 means no limit besides len)
+   * @param policy      Behavior when full
+   */
+  void setBuffer(uint8_t* buf, size_t len, size_t max_entries, MqttQueueDropPolicy policy) {
+    release();
+    _maxEntries = max_entries;
+    _policy = policy;
+    if (buf) {
+      _buf = buf;
+      _cap = len & ~static_cast<size_t>(kAlign - 1);
+    }
+  }
+
+  /**
+   * @brief Set a callback for messages evicted to make room (DropOldest).
+   *
+   * @param fn  Callback, or nullptr
+   * @param ctx User context pointer passed to the callback
+   */
+  void setEvictCallback(EvictFn fn, void* ctx) {
+    _evictFn = fn;
+    _evictCtx = ctx;
+  }
+
+  /** @brief Whether a buffer has been configured. */
+  bool enabled() const {
+    return _cap != 0;
+  }
+
+  /**
+   * @brief Queue a copy of a message.
+   *
+   * @param tag Caller-defined value returned with the entry (e.g. a publish ticket)
+   * @return true if queued; false if it was dropped (queue disabled, message larger than the
+   *         buffer, or full with DropNewest)
+   */
+  bool push(const char* topic, const uint8_t* payload, size_t len, bool retained, uint8_t qos, uint32_t tag = 0) {
+    size_t topicLen = strlen(topic);
+    if (!payload) {
+      len = 0;
+    }
+    size_t need = entrySize(topicLen, len);
+    if (!_cap || need > _cap || topicLen > 0xFFFF) {
+      _dropped++;
+      return false;
+    }
+
+    size_t at = 0;
+    while (!reserve(need, at)) {
+      if (_policy == MqttQueueDropPolicy::DropNewest || _count == 0) {
+        _dropped++;
+        return false;
+      }
+      Header old;
+      memcpy(&old, _buf + _head, sizeof(old));
+      pop();
+      _dropped++;
+      if (_evictFn) {
+        _evictFn(_evictCtx, old.tag);
+      }
+    }
+
+    Header h;
+    h.size = static_cast<uint32_t>(need);
+    h.len = static_cast<uint32_t>(len);
+    h.topicLen = static_cast<uint16_t>(topicLen);
+    h.retained = retained ? 1 : 0;
+    h.qos = qos;
+    h.tag = tag;
+    uint8_t* p = _buf + at;
+    memcpy(p, &h, sizeof(h));
+    memcpy(p + sizeof(h), topic, topicLen + 1);
+    if (len) {
+      memcpy(p + sizeof(h) + topicLen + 1, payload, len);
+    }
+
+    if (at < _tail) {
+      _wrapAt = _tail;  // reader jumps back to 0 here
+    }
+    _tail = at + need;
+    _count++;
+    _bytes += need;
+    return true;
+  }
+
+  /**
+   * @brief Look at the oldest message without removing it.
+   *
+   * @return false if the queue is empty
+   */
+  bool front(Entry& out) const {
+    if (_count == 0) {
+      return false;
+    }
+    Header h;
+    memcpy(&h, _buf + _head, sizeof(h));
+    const uint8_t* p = _buf + _head + sizeof(h);
+    out.topic = reinterpret_cast<const char*>(p);
+    out.payload = p + h.topicLen + 1;
+    out.len = h.len;
+    out.retained = h.retained != 0;
+    out.qos = h.qos;
+    out.tag = h.tag;
+    return true;
+  }
+
+  /** @brief Remove the oldest message. */
+  void pop() {
+    if (_count == 0) {
+      return;
+    }
+    Header h;
+    memcpy(&h, _buf + _head, sizeof(h));
+    _head += h.size;
+    _bytes -= h.size;
+    _count--;
+    if (_head == _wrapAt) {
+      _head = 0;
+      _wrapAt = kNoWrap;
+    }
+    if (_count == 0) {
+      clear();
+    }
+  }
+
+  /** @brief Discard all queued messages (not counted as drops). */
+  void clear() {
+    _head = 0;
+    _tail = 0;
+    _wrapAt = kNoWrap;
+    _count = 0;
+    _bytes = 0;
+  }
+
+  /** @brief Number of queued messages. */
+  size_t size() const {
+    return _count;
+  }
+
+  /** @brief Bytes of the ring buffer in use, including per-entry overhead. */
+  size_t bytes() const {
+    return _bytes;
+  }
+
+  /** @brief Ring buffer size in bytes. */
+  size_t capacity() const {
+    return _cap;
+  }
+
+  /** @brief Messages dropped since construction (rejected or evicted). */
+  uint32_t dropped() const {
+    return _dropped;
+  }
+
+private:
+  struct Header {
+    uint32_t size;
+    uint32_t len;
+    uint16_t topicLen;
+    uint8_t retained;
+    uint8_t qos;
+    uint32_t tag;
+  };
+
+  static constexpr size_t kAlign = 4;
+  static constexpr size_t kNoWrap = static_cast<size_t>(-1);
+
+  void release() {
+    if (_owned) {
+      delete[] _buf;
+    }
+    _buf = nullptr;
+    _owned = false;
+    _cap = 0;
+    clear();
+  }
+
+  static size_t entrySize(size_t topicLen, size_t len) {
+    return (sizeof(Header) + topicLen + 1 + len + kAlign - 1) & ~(kAlign - 1);
+  }
+
+  // Find room for a contiguous entry of `need` bytes; does not modify the queue.
+  bool reserve(size_t need, size_t& at) const {
+    if (_maxEntries && _count >= _maxEntries) {
+      return false;
+    }
+    if (_count == 0) {
+      at = 0;
+      return true;
+    }
+    if (_wrapAt == kNoWrap) {
+      // Used region is [head, tail): space after tail, or before head after wrapping.
+      if (_cap - _tail >= need) {
+        at = _tail;
+        return true;
+      }
+      if (_head >= need) {
+        at = 0;
+        return true;
+      }
+      return false;
+    }
+    // Wrapped: used regions are [head, wrapAt) and [0, tail).
+    if (_head - _tail >= need) {
+      at = _tail;
+      return true;
+    }
+    return false;
+  }
+
+  uint8_t* _buf = nullptr;
+  bool _owned = false;
+  size_t _cap = 0;
+  size_t _maxEntries = 0;
+  MqttQueueDropPolicy _policy = MqttQueueDropPolicy::DropNewest;
+  size_t _head = 0;
+  size_t _tail = 0;
+  size_t _wrapAt = kNoWrap;
+  size_t _count = 0;
+  size_t _bytes = 0;
+  uint32_t _dropped = 0;
+  EvictFn _evictFn = nullptr;
+  void* _evictCtx = nullptr;
+};
+
+/** @} */
@@ -1,6 +1,7 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 #if __has_include(<jblogger.h>)
@@ -23,8 +24,9 @@ enum LogLevel {
  */
 class JBLogger {
 public:
-  /** @brief Constructor. @param moduleName Name of the module. */
-  JBLogger(const char* moduleName) {}
+  /** @brief Constructor. @param moduleName Name of the module. @param level Minimum log level. */
+  JBLogger(const char* moduleName, LogLevel level = LOG_LEVEL_INFO) {}
+  virtual ~JBLogger() = default;
   /** @brief Log a debug message. @param format Format string. */
   virtual void debug(const char* format, ...) {}
   /** @brief Log an info message. @param format Format string. */
@@ -38,11 +40,131 @@ public:
 };
 #endif
 
+/**
+ * @brief Most verbose log level compiled into the library (1 = errors ... 4 = debug).
+ *
+ * Log calls above this level compile to nothing: no call, no argument setup and no format
+ * string in flash. For release builds, e.g. `-DHA_LOG_COMPILE_LEVEL=2` keeps errors and
+ * warnings. The runtime level set with setLogLevel() still filters the calls that remain.
+ * Defaults to debug with JBLogger and to nothing without it.
+ */
+#ifndef HA_LOG_COMPILE_LEVEL
+#if __has_include(<jblogger.h>)
+#define HA_LOG_COMPILE_LEVEL 4
+#else
+#define HA_LOG_COMPILE_LEVEL 0
+#endif
+#endif
+
+static_assert(LOG_LEVEL_ERROR == 1 && LOG_LEVEL_WARNING == 2 && LOG_LEVEL_INFO == 3 && LOG_LEVEL_DEBUG == 4,
+              "HA_LOG_COMPILE_LEVEL uses the LogLevel values");
+
+#define HA_LOG_DISCARD() do {} while (0)
+#define HA_LOG_CALL(logger, method, ...) do { if (logger) (logger)->method(__VA_ARGS__); } while (0)
+
+#if HA_LOG_COMPILE_LEVEL >= 1
+#define HA_LOGE(logger, ...) HA_LOG_CALL(logger, error, __VA_ARGS__)
+#else
+#define HA_LOGE(logger, ...) HA_LOG_DISCARD()
+#endif
+#if HA_LOG_COMPILE_LEVEL >= 2
+#define HA_LOGW(logger, ...) HA_LOG_CALL(logger, warn, __VA_ARGS__)
+#else
+#define HA_LOGW(logger, ...) HA_LOG_DISCARD()
+#endif
+#if HA_LOG_COMPILE_LEVEL >= 3
+#define HA_LOGI(logger, ...) HA_LOG_CALL(logger, info, __VA_ARGS__)
+#else
+#define HA_LOGI(logger, ...) HA_LOG_DISCARD()
+#endif
+#if HA_LOG_COMPILE_LEVEL >= 4
+#define HA_LOGD(logger, ...) HA_LOG_CALL(logger, debug, __VA_ARGS__)
+#else
+#define HA_LOGD(logger, ...) HA_LOG_DISCARD()
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+/** @brief Millisecond clock shared by the library (millis() on Arduino). */
+inline uint32_t mqttMillis() {
+  return millis();
+}
+
+/** @brief Microsecond clock used for timing measurements (micros() on Arduino). */
+inline uint32_t mqttMicros() {
+  return micros();
+}
+#else
+#include <chrono>
+/** @brief Millisecond clock shared by the library (steady clock on native builds). */
+inline uint32_t mqttMillis() {
+  using namespace std::chrono;
+  return static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+/** @brief Microsecond clock used for timing measurements (steady clock on native builds). */
+inline uint32_t mqttMicros() {
+  using namespace std::chrono;
+  return static_cast<uint32_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+#endif
+
 /**
  * @defgroup transport MQTT Transports
  * @brief Transport adapters for different MQTT client libraries.
  * @{
  */
+/**
+ * @brief Delivery statistics of a transport that tracks acknowledgements.
+ */
+struct MqttAckStats {
+  /** @brief QoS 1/2 publishes acknowledged by the broker. */
+  uint32_t acked = 0;
+
+  /** @brief QoS 1/2 publishes evicted from a queue or lost on disconnect before being acknowledged. */
+  uint32_t failed = 0;
+
+  /** @brief Latency of the most recent QoS 1/2 acknowledgement in milliseconds. */
+  uint32_t lastLatencyMs = 0;
+
+  /** @brief Highest QoS 1/2 acknowledgement latency in milliseconds. */
+  uint32_t maxLatencyMs = 0;
+
+  /** @brief Mean QoS 1/2 acknowledgement latency in milliseconds. */
+  uint32_t avgLatencyMs = 0;
+};
+
+/**
+ * @brief Priority of an outbound message, for transports that rate-limit (see RateLimitedTransport).
+ */
+enum class MqttPriority : uint8_t {
+  High,    /**< Availability and commands */
+  Normal,  /**< Entity states and anything not marked */
+  Low      /**< Discovery configs */
+};
+
+/** @brief Number of MqttPriority values. */
+static constexpr size_t MQTT_PRIORITIES = 3;
+
+/**
+ * @brief Last Will and Testament, published by the broker when the client disconnects uncleanly.
+ *
+ * The broker stores the will on CONNECT, so changes take effect on the next connect.
+ */
+struct MqttWill {
+  /** @brief Will topic, or nullptr for no will. */
+  const char* topic = nullptr;
+
+  /** @brief Will payload (null-terminated). */
+  const char* payload = nullptr;
+
+  /** @brief Whether the will message is retained. */
+  bool retain = true;
+
+  /** @brief QoS level of the will message. */
+  uint8_t qos = 1;
+};
+
 /**
  * @brief Abstract MQTT transport interface.
  *
@@ -55,7 +177,8 @@ public:
  *
  * The transport is responsible only for:
  * - reporting connection state
- * - publishing MQTT messages
+ * - publishing MQTT messages, either from a contiguous buffer or streamed in pieces
+ * - subscribing to topics and passing incoming messages to a single handler
  * - notifying when a connection is (re)established
  *
  * It does NOT:
@@ -94,6 +217,146 @@ public:
                        bool retained,
                        uint8_t qos) = 0;
 
+  /**
+   * @brief Start a streamed publish of a message with a known payload length.
+   *
+   * The payload is then passed in pieces with write() and the message completed with
+   * endPublish(). Only one streamed publish can be in progress at a time.
+   *
+   * The default implementation collects the pieces in an internal buffer and calls
+   * publish() from endPublish(), so every transport supports streaming. Transports whose
+   * client can write directly to the socket should override all three methods. The buffer
+   * grows on the heap as needed unless one is supplied with setStreamBuffer().
+   *
+   * @param topic    MQTT topic (null-terminated string)
+   * @param len      Total payload length in bytes
+   * @param retained Whether the message should be retained
+   * @param qos      Requested QoS level (best-effort for some clients)
+   *
+   * @return true if the publish was started, false otherwise
+   */
+  virtual bool beginPublish(const char* topic, size_t len, bool retained, uint8_t qos) {
+    if (streamBuf) {
+      size_t topicLen = strlen(topic);
+      if (topicLen + 1 > streamBufLen || len > streamBufLen - topicLen - 1) {
+        return false;
+      }
+      memcpy(streamBuf, topic, topicLen + 1);
+      streamPos = topicLen + 1;
+    } else {
+      streamTopic = topic;
+      streamPayload.clear();
+      streamPayload.reserve(len);
+    }
+    streamLen = len;
+    streamRetained = retained;
+    streamQos = qos;
+    streaming = true;
+    return true;
+  }
+
+  /**
+   * @brief Write a piece of the payload of a publish started with beginPublish().
+   *
+   * @param data Payload bytes
+   * @param len  Number of bytes
+   *
+   * @return Number of bytes accepted
+   */
+  virtual size_t write(const uint8_t* data, size_t len) {
+    if (!streaming) {
+      return 0;
+    }
+    if (streamBuf) {
+      size_t room = streamBufLen - streamPos;
+      size_t n = len < room ? len : room;
+      memcpy(streamBuf + streamPos, data, n);
+      streamPos += n;
+      return n;
+    }
+    streamPayload.append(reinterpret_cast<const char*>(data), len);
+    return len;
+  }
+
+  /**
+   * @brief Complete a publish started with beginPublish().
+   *
+   * @return true if the message was accepted, false otherwise (including when fewer
+   *         bytes than announced were written)
+   */
+  virtual bool endPublish() {
+    if (!streaming) {
+      return false;
+    }
+    streaming = false;
+    if (streamBuf) {
+      const char* topic = reinterpret_cast<const char*>(streamBuf);
+      size_t payloadAt = strlen(topic) + 1;
+      return streamPos - payloadAt == streamLen &&
+             publish(topic, streamBuf + payloadAt, streamLen, streamRetained, streamQos);
+    }
+    bool ok = streamPayload.size() == streamLen &&
+              publish(streamTopic.c_str(),
+                      reinterpret_cast<const uint8_t*>(streamPayload.data()),
+                      streamPayload.size(),
+                      streamRetained,
+                      streamQos);
+    streamPayload.clear();
+    return ok;
+  }
+
+  /**
+   * @brief Make sure publish() can send a message of this size.
+   *
+   * Transports whose client has a fixed packet buffer (PubSubClient) grow it to fit;
+   * others have no limit and return true. HaDiscovery calls this with its largest config
+   * (see HaDiscovery::reserveTransportBuffer()) and before each config it publishes.
+   *
+   * @param topic_len   Topic length in bytes
+   * @param payload_len Payload length in bytes
+   * @return true if such a message fits, false if the buffer could not be grown
+   */
+  virtual bool reservePublishSize(size_t topic_len, size_t payload_len) { return true; }
+
+  /**
+   * @brief Callback for incoming messages.
+   *
+   * @param ctx     User context pointer
+   * @param topic   Topic the message was published to (null-terminated)
+   * @param payload Payload bytes (not null-terminated)
+   * @param len     Payload length in bytes
+   */
+  typedef void (*MessageFn)(void* ctx, const char* topic, const uint8_t* payload, size_t len);
+
+  /**
+   * @brief Subscribe to a topic filter (wildcards allowed).
+   *
+   * Subscriptions do not survive a reconnect with a clean session; re-subscribe from the
+   * onConnect callback.
+   *
+   * @param topic Topic filter
+   * @param qos   Requested QoS level
+   * @return true if the subscribe request was accepted, false otherwise (including for
+   *         transports without subscribe support)
+   */
+  virtual bool subscribe(const char* topic, uint8_t qos) { return false; }
+
+  /**
+   * @brief Remove a subscription.
+   *
+   * @param topic Topic filter passed to subscribe()
+   * @return true if the unsubscribe request was accepted, false otherwise
+   */
+  virtual bool unsubscribe(const char* topic) { return false; }
+
+  /**
+   * @brief Register the handler for messages on subscribed topics (replaces any previous one).
+   *
+   * @param cb  Callback function, or nullptr
+   * @param ctx User context pointer passed back to the callback
+   */
+  virtual void setOnMessage(MessageFn cb, void* ctx) {}
+
   /**
    * @brief Register a callback invoked when the MQTT connection is established.
    *
@@ -128,6 +391,47 @@ public:
    */
   virtual void setServer(const std::string& host, uint16_t port, const std::string& user = "", const std::string& pass = "") = 0;
 
+  /**
+   * @brief Set MQTT server, credentials and Last Will and Testament.
+   *
+   * @param host MQTT host/IP
+   * @param port MQTT port
+   * @param user MQTT username (may be nullptr)
+   * @param pass MQTT password (may be nullptr)
+   * @param will Will sent with the next connect (strings are copied)
+   */
+  void setServer(const char* host, uint16_t port, const char* user, const char* pass, const MqttWill& will) {
+    setServer(host, port, user, pass);
+    setWill(will);
+  }
+
+  /**
+   * @brief Set MQTT server, credentials and Last Will and Testament (std::string version).
+   *
+   * @param host MQTT host/IP
+   * @param port MQTT port
+   * @param user MQTT username
+   * @param pass MQTT password
+   * @param will Will sent with the next connect (strings are copied)
+   */
+  void setServer(const std::string& host, uint16_t port, const std::string& user, const std::string& pass,
+                 const MqttWill& will) {
+    setServer(host, port, user, pass);
+    setWill(will);
+  }
+
+  /**
+   * @brief Set the Last Will and Testament sent with the next connect.
+   *
+   * HaDiscovery::setDevice() sets the availability topic with payload "offline" here, so
+   * the broker marks the device unavailable on a crash or power loss. A will set after
+   * setDevice() replaces it.
+   *
+   * @param will Will to send (strings are copied), or one with topic nullptr to send none
+   * @return true if the transport supports wills, false otherwise
+   */
+  virtual bool setWill(const MqttWill& will) { return false; }
+
   /**
    * @brief Periodic processing hook (optional).
    *
@@ -139,6 +443,82 @@ public:
    */
   virtual void tick() {}
 
+  /**
+   * @brief Callback invoked when a QoS 1/2 publish that was sent completes.
+   *
+   * @param ctx        User context pointer
+   * @param ticket     Ticket of the publish (see lastPublishTicket())
+   * @param acked      true if acknowledged by the broker, false if the connection was lost first
+   * @param latency_ms Time from sending to acknowledgement
+   */
+  typedef void (*PublishCompleteFn)(void* ctx, uint32_t ticket, bool acked, uint32_t latency_ms);
+
+  /**
+   * @brief Register a callback for completed publishes (only for transports that track acknowledgements).
+   *
+   * @param cb  Callback function, or nullptr
+   * @param ctx User context pointer passed back to the callback
+   */
+  virtual void setOnPublishComplete(PublishCompleteFn cb, void* ctx) {}
+
+  /**
+   * @brief Ticket assigned to the most recent publish() call, used to match completion callbacks.
+   *
+   * @return Ticket, or 0 if the transport does not track acknowledgements
+   */
+  virtual uint32_t lastPublishTicket() const { return 0; }
+
+  /**
+   * @brief Number of QoS 1/2 publishes that can be sent before the in-flight window is full.
+   *
+   * @return Free window slots, or SIZE_MAX if the transport does not limit in-flight messages
+   */
+  virtual size_t publishWindow() const { return SIZE_MAX; }
+
+  /**
+   * @brief Publishes accepted but not yet completed (queued, or QoS 1/2 awaiting acknowledgement).
+   *
+   * @return Count, or 0 if the transport does not track acknowledgements
+   */
+  virtual size_t pendingPublishes() const { return 0; }
+
+  /**
+   * @brief Delivery statistics.
+   *
+   * @return Statistics (all zero if the transport does not track acknowledgements)
+   */
+  virtual MqttAckStats ackStats() const { return MqttAckStats(); }
+
+  /**
+   * @brief Collect streamed publishes in a caller-supplied buffer instead of on the heap.
+   *
+   * Only used by the default beginPublish()/write()/endPublish(). The buffer holds the topic
+   * and the payload of one message; larger messages are rejected by beginPublish().
+   *
+   * @param buf Buffer that outlives the transport, or nullptr to go back to the heap
+   * @param len Buffer size in bytes
+   */
+  void setStreamBuffer(uint8_t* buf, size_t len) {
+    streamBuf = buf;
+    streamBufLen = buf ? len : 0;
+    streamTopic.clear();
+    streamTopic.shrink_to_fit();
+    streamPayload.clear();
+    streamPayload.shrink_to_fit();
+  }
+
+  /**
+   * @brief Mark the priority of the next publish() or beginPublish().
+   *
+   * HaDiscovery sets it before each message. Transports that do not rate-limit ignore it;
+   * RateLimitedTransport uses it once and falls back to MqttPriority::Normal.
+   *
+   * @param priority Priority of the next message
+   */
+  void setPublishPriority(MqttPriority priority) {
+    publishPriority = priority;
+  }
+
   /**
    * @brief Set the logger for this transport.
    *
@@ -150,5 +530,17 @@ public:
 
 protected:
   JBLogger* log = nullptr;
+  MqttPriority publishPriority = MqttPriority::Normal;
+
+private:
+  std::string streamTopic;
+  std::string streamPayload;
+  uint8_t* streamBuf = nullptr;
+  size_t streamBufLen = 0;
+  size_t streamPos = 0;
+  size_t streamLen = 0;
+  bool streamRetained = false;
+  uint8_t streamQos = 0;
+  bool streaming = false;
 };
 /** @} */
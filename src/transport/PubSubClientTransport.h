@@ -17,6 +17,16 @@
  * - The host firmware MUST call mqtt.loop() frequently.
  * - QoS handling is best-effort.
  * - Connection events are detected via rising-edge logic in tick().
+ *
+ * Streamed publishes (beginPublish/write/endPublish) are written straight to the
+ * socket and are not limited by PubSubClient's packet buffer size.
+ *
+ * Messages sent with publish() must fit in PubSubClient's packet buffer (256 bytes by
+ * default). HaDiscovery measures its largest config and the buffer is grown to exactly that
+ * through reservePublishSize(), so setBufferSize() need not be guessed.
+ *
+ * PubSubClient takes credentials and the Last Will and Testament as connect() arguments,
+ * so connect through connect(client_id) to send the ones set on the transport.
  */
 class PubSubClientTransport : public MqttTransport {
 public:
@@ -28,6 +38,8 @@ public:
   explicit PubSubClientTransport(PubSubClient& client)
     : client(client) {}
 
+  using MqttTransport::setServer;
+
   /**
    * @brief Set MQTT server and credentials.
    *
@@ -58,6 +70,65 @@ public:
     this->pass = this->passStr.c_str();
   }
 
+  /**
+   * @inheritdoc
+   */
+  bool setWill(const MqttWill& will) override {
+    willTopic = will.topic ? will.topic : "";
+    willPayload = will.payload ? will.payload : "";
+    willRetain = will.retain;
+    willQos = will.qos;
+    return true;
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * Grows the PubSubClient buffer with setBufferSize() when it is too small; it is never shrunk.
+   */
+  bool reservePublishSize(size_t topic_len, size_t payload_len) override {
+    size_t need = packetSize(topic_len, payload_len);
+    if (need <= client.getBufferSize()) {
+      return true;
+    }
+    if (need > UINT16_MAX || !client.setBufferSize(static_cast<uint16_t>(need))) {
+      if (need > required) {
+        required = need;
+      }
+      HA_LOGE(log, "PubSub buffer of %u bytes could not be allocated (have %u)", (unsigned)need,
+              (unsigned)client.getBufferSize());
+      return false;
+    }
+    HA_LOGI(log, "PubSub buffer resized to %u bytes", (unsigned)need);
+    return true;
+  }
+
+  /**
+   * @brief PubSubClient buffer size that reservePublishSize() could not allocate.
+   *
+   * @return Largest size that failed, or 0 if every reservation succeeded
+   */
+  size_t requiredBufferSize() const {
+    return required;
+  }
+
+  /**
+   * @brief Connect with the credentials and will set on the transport.
+   *
+   * @param client_id MQTT client id
+   * @return true if connected, false otherwise (see PubSubClient::state())
+   */
+  bool connect(const char* client_id) {
+    bool hasWill = !willTopic.empty();
+    bool ok = client.connect(client_id, user, pass,
+                             hasWill ? willTopic.c_str() : nullptr, willQos, willRetain,
+                             hasWill ? willPayload.c_str() : nullptr);
+    if (!ok) {
+      HA_LOGE(log, "PubSub connect FAILED state=%d", client.state());
+    }
+    return ok;
+  }
+
   /**
    * @inheritdoc
    */
@@ -77,8 +148,8 @@ public:
       len = 0;
     }
 
-    if (log) log->debug("PubSub publish topic=%s len=%u retained=%d", topic,
-                        (unsigned)len, retained ? 1 : 0);
+    HA_LOGD(log, "PubSub publish topic=%s len=%u retained=%d", topic,
+            (unsigned)len, retained ? 1 : 0);
 
     bool ok = client.publish(topic,
                              payload,
@@ -86,13 +157,85 @@ public:
                              retained);
 
     if (!ok) {
-      if (log) log->error("PubSub publish FAILED topic=%s", topic);
+      size_t need = packetSize(strlen(topic), len);
+      if (need > client.getBufferSize()) {
+        HA_LOGE(log, "PubSub publish FAILED topic=%s: needs a %u-byte buffer, have %u", topic, (unsigned)need,
+                (unsigned)client.getBufferSize());
+      } else {
+        HA_LOGE(log, "PubSub publish FAILED topic=%s", topic);
+      }
     } else {
-      if (log) log->debug("PubSub publish OK topic=%s", topic);
+      HA_LOGD(log, "PubSub publish OK topic=%s", topic);
+    }
+    return ok;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool beginPublish(const char* topic, size_t len, bool retained, uint8_t /*qos*/) override {
+    HA_LOGD(log, "PubSub stream publish topic=%s len=%u retained=%d", topic,
+            (unsigned)len, retained ? 1 : 0);
+
+    bool ok = client.beginPublish(topic, static_cast<unsigned int>(len), retained);
+    if (!ok) {
+      HA_LOGE(log, "PubSub stream publish FAILED topic=%s", topic);
+    }
+    return ok;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  size_t write(const uint8_t* data, size_t len) override {
+    return client.write(data, len);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool endPublish() override {
+    bool ok = client.endPublish() == 1;
+    if (!ok) {
+      HA_LOGE(log, "PubSub stream publish FAILED at end");
+    }
+    return ok;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool subscribe(const char* topic, uint8_t qos) override {
+    // PubSubClient supports QoS 0 and 1 subscriptions.
+    bool ok = client.subscribe(topic, qos > 1 ? 1 : qos);
+    if (!ok) {
+      HA_LOGE(log, "PubSub subscribe FAILED topic=%s", topic);
     }
     return ok;
   }
 
+  /**
+   * @inheritdoc
+   */
+  bool unsubscribe(const char* topic) override {
+    return client.unsubscribe(topic);
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * Replaces any callback set directly with PubSubClient::setCallback().
+   */
+  void setOnMessage(MessageFn cb_, void* ctx_) override {
+    msgCb = cb_;
+    msgCtx = ctx_;
+    client.setCallback([this](char* topic, uint8_t* payload, unsigned int len) {
+      if (msgCb) {
+        msgCb(msgCtx, topic, payload, len);
+      }
+    });
+  }
+
   /**
    * @inheritdoc
    */
@@ -124,14 +267,30 @@ public:
   }
 
 private:
+  // Fixed header, topic length field, topic and payload, as PubSubClient::publish() checks it.
+  static size_t packetSize(size_t topic_len, size_t payload_len) {
+#ifdef MQTT_MAX_HEADER_SIZE
+    return MQTT_MAX_HEADER_SIZE + 2 + topic_len + payload_len;
+#else
+    return 5 + 2 + topic_len + payload_len;
+#endif
+  }
+
   PubSubClient& client;
+  size_t required = 0;
   const char* user = nullptr;
   const char* pass = nullptr;
   std::string userStr;
   std::string passStr;
+  std::string willTopic;
+  std::string willPayload;
+  bool willRetain = true;
+  uint8_t willQos = 1;
   bool wasConnected = false;
   void (*cb)(void*) = nullptr;
   /** @brief Pointer to user context for callback. */
   void* ctx = nullptr;
+  MessageFn msgCb = nullptr;
+  void* msgCtx = nullptr;
 };
 /** @} */
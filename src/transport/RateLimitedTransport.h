@@ -0,0 +1,432 @@
+#pragma once
+#include "MqttTransport.h"
+#include "MqttPublishQueue.h"
+
+/**
+ * @addtogroup transport
+ * @{
+ */
+
+/**
+ * @brief Rate limiter statistics for one MqttPriority.
+ */
+struct MqttPriorityStats {
+  /** @brief Messages handed to the wrapped transport, right away or after waiting. */
+  uint32_t sent = 0;
+
+  /** @brief Messages that had to wait in the deferral queue. */
+  uint32_t deferred = 0;
+
+  /** @brief Messages dropped: rejected or evicted by a full queue, or refused by the wrapped transport. */
+  uint32_t dropped = 0;
+
+  /** @brief Messages currently waiting. */
+  uint32_t queued = 0;
+
+  /** @brief Longest time a sent message waited, in milliseconds. */
+  uint32_t maxWaitMs = 0;
+
+  /** @brief Mean time the deferred messages that were sent waited, in milliseconds. */
+  uint32_t avgWaitMs = 0;
+};
+
+/**
+ * @brief Rate limiter statistics (see RateLimitedTransport::rateStats()).
+ */
+struct MqttRateStats {
+  /** @brief Statistics per priority, indexed by its value. */
+  MqttPriorityStats priority[MQTT_PRIORITIES];
+
+  /** @brief Statistics for one priority. */
+  const MqttPriorityStats& operator[](MqttPriority p) const {
+    return priority[static_cast<size_t>(p)];
+  }
+};
+
+/**
+ * @brief Transport decorator that limits the outbound message rate with a token bucket.
+ *
+ * Brokers and cloud bridges throttle or disconnect clients that burst. This transport sits
+ * between HaDiscovery and the client adapter and lets at most `burst` messages through at
+ * once, refilled at `messages_per_second`. Messages without a token wait in a bounded
+ * deferral queue per MqttPriority and are sent highest priority first, oldest first within
+ * a priority: availability and commands, then states, then discovery configs. A message
+ * never overtakes a waiting message of the same or higher priority.
+ *
+ * HaDiscovery marks each message with MqttTransport::setPublishPriority(); messages from
+ * other callers count as MqttPriority::Normal. publish() returns true when a message is sent
+ * or queued. Queued messages are sent from tick() (HaDiscovery::tick() calls it) and from later
+ * publishes, as tokens become available and the wrapped transport is connected.
+ *
+ * publishWindow() reports the free tokens, so the paced discovery re-publish after a
+ * connect follows the rate instead of filling the queue.
+ *
+ * @code
+ * PubSubClientTransport client(mqtt);
+ * RateLimitedTransport transport(client, 10, 20);   // 10 messages/s, bursts of 20
+ * HaDiscovery ha(transport);
+ * @endcode
+ */
+class RateLimitedTransport : public MqttTransport {
+public:
+  /** @brief Default deferral queue size per priority in bytes. */
+  static constexpr size_t DEFAULT_QUEUE_BYTES = 2048;
+
+  /**
+   * @brief Wrap a transport.
+   *
+   * @param inner               Transport that sends the messages (must outlive this one)
+   * @param messages_per_second Sustained rate (0 for no limit)
+   * @param burst               Messages that can be sent at once after an idle period (at least 1)
+   */
+  RateLimitedTransport(MqttTransport& inner, uint32_t messages_per_second, uint32_t burst)
+    : inner(inner) {
+    setRate(messages_per_second, burst);
+    tokens = capacity;
+    for (size_t i = 0; i < MQTT_PRIORITIES; i++) {
+      // Newer states and availability supersede older ones; configs are re-published anyway.
+      queues[i].setLimits(DEFAULT_QUEUE_BYTES, 0,
+                          i == static_cast<size_t>(MqttPriority::Low) ? MqttQueueDropPolicy::DropNewest
+                                                                      : MqttQueueDropPolicy::DropOldest);
+    }
+  }
+
+  using MqttTransport::setServer;
+
+  /**
+   * @brief Change the rate.
+   *
+   * @param messages_per_second Sustained rate (0 for no limit)
+   * @param burst               Messages that can be sent at once after an idle period (at least 1)
+   */
+  void setRate(uint32_t messages_per_second, uint32_t burst) {
+    // Tokens are counted in thousandths: messages_per_second of them accrue per millisecond.
+    rate = messages_per_second;
+    capacity = (burst ? burst : 1) * kTokenUnit;
+    if (tokens > capacity) {
+      tokens = capacity;
+    }
+  }
+
+  /**
+   * @brief Configure the deferral queue of one priority, discarding what it holds.
+   *
+   * Each queued message uses its topic and payload length plus about 20 bytes.
+   *
+   * @param priority    Queue to configure
+   * @param max_bytes   Queue buffer size in bytes (0 disables deferral: messages without a token are dropped)
+   * @param max_entries Maximum number of queued messages (0 for no entry limit)
+   * @param policy      Whether a full queue rejects new messages or evicts the oldest ones
+   * @return false if the buffer could not be allocated
+   */
+  bool setQueueLimits(MqttPriority priority, size_t max_bytes, size_t max_entries, MqttQueueDropPolicy policy) {
+    return queues[static_cast<size_t>(priority)].setLimits(max_bytes, max_entries, policy);
+  }
+
+  /**
+   * @brief Use a caller-supplied queue buffer for one priority instead of a heap allocation.
+   *
+   * @param priority    Queue to configure
+   * @param buf         Buffer that outlives the transport (4-byte aligned), or nullptr to disable deferral
+   * @param len         Buffer size in bytes
+   * @param max_entries Maximum number of queued messages (0 for no entry limit)
+   * @param policy      Whether a full queue rejects new messages or evicts the oldest ones
+   */
+  void setQueueBuffer(MqttPriority priority, uint8_t* buf, size_t len, size_t max_entries,
+                      MqttQueueDropPolicy policy) {
+    queues[static_cast<size_t>(priority)].setBuffer(buf, len, max_entries, policy);
+  }
+
+  /**
+   * @brief Set the millisecond clock used for refilling and wait times.
+   *
+   * @param millis_fn Function returning a free-running millisecond counter, or nullptr for mqttMillis()
+   */
+  void setClock(uint32_t (*millis_fn)()) {
+    clock = millis_fn ? millis_fn : &mqttMillis;
+    lastRefillMs = clock();
+  }
+
+  /** @brief Messages waiting in the deferral queues. */
+  size_t queueDepth() const {
+    size_t n = 0;
+    for (const MqttPublishQueue& q : queues) {
+      n += q.size();
+    }
+    return n;
+  }
+
+  /**
+   * @brief Rate limiter statistics.
+   *
+   * @return Statistics per priority
+   */
+  MqttRateStats rateStats() const {
+    MqttRateStats s;
+    for (size_t i = 0; i < MQTT_PRIORITIES; i++) {
+      s.priority[i] = stats[i];
+      s.priority[i].dropped += queues[i].dropped();
+      s.priority[i].queued = static_cast<uint32_t>(queues[i].size());
+      s.priority[i].avgWaitMs = waitCount[i] ? static_cast<uint32_t>(waitSumMs[i] / waitCount[i]) : 0;
+    }
+    return s;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool connected() const override {
+    return inner.connected();
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool publish(const char* topic, const uint8_t* payload, size_t len, bool retained, uint8_t qos) override {
+    size_t p = takePriority();
+    drain();
+    if (sendableNow(p)) {
+      tokens -= rate ? kTokenUnit : 0;
+      return sendNow(p, topic, payload, len, retained, qos);
+    }
+    if (!queues[p].push(topic, payload, len, retained, qos, clock())) {
+      HA_LOGW(log, "Rate limiter dropped topic=%s", topic);
+      return false;
+    }
+    stats[p].deferred++;
+    return true;
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * Streamed straight to the wrapped transport when a token is available; otherwise
+   * collected and queued like publish().
+   */
+  bool beginPublish(const char* topic, size_t len, bool retained, uint8_t qos) override {
+    size_t p = static_cast<size_t>(publishPriority);
+    drain();
+    if (!sendableNow(p)) {
+      return MqttTransport::beginPublish(topic, len, retained, qos);
+    }
+    takePriority();
+    tokens -= rate ? kTokenUnit : 0;
+    directStream = inner.beginPublish(topic, len, retained, qos);
+    if (directStream) {
+      stats[p].sent++;
+    } else {
+      stats[p].dropped++;
+    }
+    return directStream;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  size_t write(const uint8_t* data, size_t len) override {
+    return directStream ? inner.write(data, len) : MqttTransport::write(data, len);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool endPublish() override {
+    if (directStream) {
+      directStream = false;
+      return inner.endPublish();
+    }
+    return MqttTransport::endPublish();
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool reservePublishSize(size_t topic_len, size_t payload_len) override {
+    return inner.reservePublishSize(topic_len, payload_len);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool subscribe(const char* topic, uint8_t qos) override {
+    return inner.subscribe(topic, qos);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool unsubscribe(const char* topic) override {
+    return inner.unsubscribe(topic);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setOnMessage(MessageFn cb, void* ctx) override {
+    inner.setOnMessage(cb, ctx);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setOnConnect(void (*cb)(void*), void* ctx) override {
+    inner.setOnConnect(cb, ctx);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setServer(const char* host, uint16_t port, const char* user = nullptr, const char* pass = nullptr) override {
+    inner.setServer(host, port, user, pass);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setServer(const std::string& host, uint16_t port, const std::string& user = "", const std::string& pass = "") override {
+    inner.setServer(host, port, user, pass);
+  }
+
+  /**
+   * @inheritdoc
+   */
+  bool setWill(const MqttWill& will) override {
+    return inner.setWill(will);
+  }
+
+  /**
+   * @brief Tick the wrapped transport, then send queued messages that have a token.
+   */
+  void tick() override {
+    inner.tick();
+    drain();
+  }
+
+  /**
+   * @inheritdoc
+   */
+  void setOnPublishComplete(PublishCompleteFn cb, void* ctx) override {
+    inner.setOnPublishComplete(cb, ctx);
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * Deferred messages get their ticket when they are sent, so this is only meaningful right
+   * after a publish() that went out immediately.
+   */
+  uint32_t lastPublishTicket() const override {
+    return inner.lastPublishTicket();
+  }
+
+  /**
+   * @inheritdoc
+   *
+   * The free tokens not claimed by queued messages, capped by the wrapped transport's window.
+   */
+  size_t publishWindow() const override {
+    size_t window = inner.publishWindow();
+    if (!rate) {
+      return window;
+    }
+    size_t free = tokensAt(clock()) / kTokenUnit;
+    size_t waiting = queueDepth();
+    free = free > waiting ? free - waiting : 0;
+    return free < window ? free : window;
+  }
+
+  /**
+   * @inheritdoc
+   */
+  size_t pendingPublishes() const override {
+    return inner.pendingPublishes() + queueDepth();
+  }
+
+  /**
+   * @inheritdoc
+   */
+  MqttAckStats ackStats() const override {
+    return inner.ackStats();
+  }
+
+private:
+  static constexpr uint32_t kTokenUnit = 1000;
+
+  size_t takePriority() {
+    size_t p = static_cast<size_t>(publishPriority);
+    publishPriority = MqttPriority::Normal;
+    return p < MQTT_PRIORITIES ? p : static_cast<size_t>(MqttPriority::Normal);
+  }
+
+  uint32_t tokensAt(uint32_t now) const {
+    uint64_t next = tokens + static_cast<uint64_t>(now - lastRefillMs) * rate;
+    return next < capacity ? static_cast<uint32_t>(next) : capacity;
+  }
+
+  void refill() {
+    uint32_t now = clock();
+    tokens = tokensAt(now);
+    lastRefillMs = now;
+  }
+
+  // Whether a message of priority p may bypass the queues: nothing waiting at or above it,
+  // and a token left.
+  bool sendableNow(size_t p) {
+    for (size_t i = 0; i <= p; i++) {
+      if (queues[i].size()) {
+        return false;
+      }
+    }
+    refill();
+    return !rate || tokens >= kTokenUnit;
+  }
+
+  bool sendNow(size_t p, const char* topic, const uint8_t* payload, size_t len, bool retained, uint8_t qos) {
+    bool ok = inner.publish(topic, payload, len, retained, qos);
+    if (ok) {
+      stats[p].sent++;
+    } else {
+      stats[p].dropped++;
+    }
+    return ok;
+  }
+
+  void drain() {
+    if (!inner.connected()) {
+      return;
+    }
+    refill();
+    for (size_t p = 0; p < MQTT_PRIORITIES; p++) {
+      MqttPublishQueue::Entry e;
+      while (queues[p].front(e)) {
+        if (rate && tokens < kTokenUnit) {
+          return;
+        }
+        tokens -= rate ? kTokenUnit : 0;
+        uint32_t waited = clock() - e.tag;
+        if (sendNow(p, e.topic, e.payload, e.len, e.retained, e.qos)) {
+          waitSumMs[p] += waited;
+          waitCount[p]++;
+          if (waited > stats[p].maxWaitMs) {
+            stats[p].maxWaitMs = waited;
+          }
+        }
+        queues[p].pop();
+      }
+    }
+  }
+
+  MqttTransport& inner;
+  MqttPublishQueue queues[MQTT_PRIORITIES];
+  MqttPriorityStats stats[MQTT_PRIORITIES];
+  uint64_t waitSumMs[MQTT_PRIORITIES] = {};
+  uint32_t waitCount[MQTT_PRIORITIES] = {};
+  uint32_t (*clock)() = &mqttMillis;
+  uint32_t rate = 0;
+  uint32_t capacity = 0;
+  uint32_t tokens = 0;
+  uint32_t lastRefillMs = mqttMillis();
+  bool directStream = false;
+};
+
+/** @} */
@@ -0,0 +1,66 @@
+// Heap accounting for the native tests: replaces the global operator new/delete so a test can
+// read the bytes in use, the peak and the number of allocations. Include it from exactly one
+// translation unit per test program.
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+static size_t g_heapCurrent = 0;
+static size_t g_heapPeak = 0;
+static size_t g_allocCount = 0;
+
+namespace heap_counter {
+
+// The block size is stored in front of each allocation, padded so the pointer handed out keeps
+// the alignment operator new guarantees.
+#ifdef __STDCPP_DEFAULT_NEW_ALIGNMENT__
+constexpr size_t kAlign = __STDCPP_DEFAULT_NEW_ALIGNMENT__ > alignof(max_align_t) ? __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                                                                                   : alignof(max_align_t);
+#else
+constexpr size_t kAlign = alignof(max_align_t);
+#endif
+constexpr size_t kHeader = sizeof(size_t) > kAlign ? (sizeof(size_t) + kAlign - 1) / kAlign * kAlign : kAlign;
+
+// Not inlined, so the optimizer neither pairs free() with the replaced operator new
+// (-Wmismatched-new-delete) nor sees the header read as an out-of-bounds access (-Warray-bounds).
+__attribute__((noinline)) static unsigned char* block(void* ptr) {
+    return static_cast<unsigned char*>(ptr) - kHeader;
+}
+
+__attribute__((noinline)) static void release(void* raw) {
+    free(raw);
+}
+
+}  // namespace heap_counter
+
+void* operator new(size_t size) {
+    unsigned char* raw = static_cast<unsigned char*>(malloc(size + heap_counter::kHeader));
+    if (!raw) {
+        abort();
+    }
+    memcpy(raw, &size, sizeof(size));
+    g_heapCurrent += size;
+    g_allocCount++;
+    if (g_heapCurrent > g_heapPeak) {
+        g_heapPeak = g_heapCurrent;
+    }
+    return raw + heap_counter::kHeader;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+    unsigned char* raw = heap_counter::block(ptr);
+    size_t size;
+    memcpy(&size, raw, sizeof(size));
+    g_heapCurrent -= size;
+    heap_counter::release(raw);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
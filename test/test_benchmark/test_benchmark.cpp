@@ -0,0 +1,293 @@
+// Hot-path benchmarks: ns/op, heap allocations/op and peak heap bytes per operation.
+//
+// Heap use is counted by replacing the global operator new/delete; publishing goes to a
+// transport that discards everything, so only the library's own work is measured.
+//
+// Each result is compared against the baseline table below and the test fails when it is
+// worse by more than the threshold:
+//   -DHA_BENCH_THRESHOLD_PCT=<n>   allowed regression in percent (default 25)
+//   -DHA_BENCH_CHECK_TIME=0        report ns/op without checking it (time baselines are
+//                                  machine-specific; the allocation checks always apply)
+// On native builds the HA_BENCH_THRESHOLD_PCT environment variable overrides the build flag.
+//
+//   pio test -e native_bench
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "HaDiscovery.h"
+#include "transport/MqttTransport.h"
+#include "../heap_counter.h"
+
+#ifndef HA_BENCH_THRESHOLD_PCT
+#define HA_BENCH_THRESHOLD_PCT 25
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#ifndef HA_BENCH_CHECK_TIME
+#define HA_BENCH_CHECK_TIME 0
+#endif
+static const uint32_t kIterations = 2000;
+static uint32_t nowMicros() { return micros(); }
+#else
+#include <chrono>
+#ifndef HA_BENCH_CHECK_TIME
+#define HA_BENCH_CHECK_TIME 1
+#endif
+static const uint32_t kIterations = 100000;
+static uint32_t nowMicros() {
+    using namespace std::chrono;
+    return static_cast<uint32_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+#endif
+
+// ---- Transport ----
+
+class NullTransport : public MqttTransport {
+public:
+    size_t bytes = 0;
+
+    bool connected() const override { return true; }
+
+    bool publish(const char*, const uint8_t*, size_t len, bool, uint8_t) override {
+        bytes += len;
+        return true;
+    }
+
+    void setOnConnect(void (*)(void*), void*) override {}
+    void setServer(const char*, uint16_t, const char* = nullptr, const char* = nullptr) override {}
+    void setServer(const std::string&, uint16_t, const std::string& = "", const std::string& = "") override {}
+};
+
+// ---- Baselines ----
+
+struct Baseline {
+    const char* name;
+    float nsPerOp;       // budget for a native x86-64 build at -O2
+    float allocsPerOp;
+    size_t peakBytes;
+};
+
+static const Baseline kBaselines[] = {
+    { "publishState(handle)",          300.0f, 0.0f,   0 },
+    { "publishState(object_id)",       800.0f, 0.0f,   0 },
+    { "publishState(handle, float)",   400.0f, 0.0f,   0 },
+    { "publishStateSwitch(handle)",    300.0f, 0.0f,   0 },
+    { "publishSensorDiscovery",       6000.0f, 0.0f,   0 },
+    { "publishSwitchDiscovery",       6000.0f, 0.0f,   0 },
+    { "publishBinarySensorDiscovery", 6000.0f, 0.0f,   0 },
+    { "publishButtonDiscovery",       6000.0f, 0.0f,   0 },
+    { "buildSensorConfigJson",        4000.0f, 0.0f,   0 },
+    { "buildSwitchConfigJson",        4000.0f, 0.0f,   0 },
+    { "buildBinarySensorConfigJson",  4000.0f, 0.0f,   0 },
+    { "buildButtonConfigJson",        4000.0f, 0.0f,   0 },
+};
+
+static const Baseline* findBaseline(const char* name) {
+    for (const Baseline& b : kBaselines) {
+        if (strcmp(b.name, name) == 0) {
+            return &b;
+        }
+    }
+    return nullptr;
+}
+
+static float thresholdFactor() {
+    long pct = HA_BENCH_THRESHOLD_PCT;
+#if !defined(ARDUINO)
+    const char* env = getenv("HA_BENCH_THRESHOLD_PCT");
+    if (env && *env) {
+        pct = strtol(env, nullptr, 10);
+    }
+#endif
+    return 1.0f + pct / 100.0f;
+}
+
+// ---- Measurement ----
+
+struct Result {
+    float nsPerOp;
+    float allocsPerOp;
+    size_t peakBytes;
+};
+
+template <typename Fn>
+static Result measure(Fn fn) {
+    fn(0);  // warm up: first-use allocations are not part of the steady state
+    size_t base = g_heapCurrent;
+    g_heapPeak = base;
+    g_allocCount = 0;
+    uint32_t start = nowMicros();
+    for (uint32_t i = 0; i < kIterations; i++) {
+        fn(i);
+    }
+    uint32_t elapsed = nowMicros() - start;
+    return Result{ elapsed * 1000.0f / kIterations,
+                   static_cast<float>(g_allocCount) / kIterations,
+                   g_heapPeak - base };
+}
+
+static void check(const char* name, const Result& r) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-30s %9.1f ns/op %6.2f allocs/op %6u B peak",
+             name, r.nsPerOp, r.allocsPerOp, (unsigned)r.peakBytes);
+    TEST_MESSAGE(line);
+
+    const Baseline* b = findBaseline(name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(b, name);
+    float factor = thresholdFactor();
+    snprintf(line, sizeof(line), "%s: allocations/op above baseline %.2f", name, b->allocsPerOp);
+    TEST_ASSERT_TRUE_MESSAGE(r.allocsPerOp <= b->allocsPerOp * factor, line);
+    snprintf(line, sizeof(line), "%s: peak heap above baseline %u B", name, (unsigned)b->peakBytes);
+    TEST_ASSERT_TRUE_MESSAGE(r.peakBytes <= b->peakBytes * factor, line);
+#if HA_BENCH_CHECK_TIME
+    snprintf(line, sizeof(line), "%s: ns/op above baseline %.1f", name, b->nsPerOp);
+    TEST_ASSERT_TRUE_MESSAGE(r.nsPerOp <= b->nsPerOp * factor, line);
+#endif
+}
+
+// ---- Fixtures ----
+
+static NullTransport transport;
+static HaDiscovery* ha;
+
+static HaSensorConfig sensorConfig() {
+    HaSensorConfig cfg;
+    cfg.common.object_id = "temperature";
+    cfg.common.name = "Kitchen Temperature";
+    cfg.common.icon = "mdi:thermometer";
+    cfg.unit_of_measurement = "°C";
+    cfg.device_class = "temperature";
+    cfg.state_class = "measurement";
+    return cfg;
+}
+
+static HaSwitchConfig switchConfig() {
+    HaSwitchConfig cfg;
+    cfg.common.object_id = "relay1";
+    cfg.common.name = "Kitchen Light";
+    cfg.common.icon = "mdi:lightbulb";
+    return cfg;
+}
+
+static HaBinarySensorConfig binarySensorConfig() {
+    HaBinarySensorConfig cfg;
+    cfg.common.object_id = "motion";
+    cfg.common.name = "Hallway Motion";
+    cfg.device_class = "motion";
+    return cfg;
+}
+
+static HaButtonConfig buttonConfig() {
+    HaButtonConfig cfg;
+    cfg.common.object_id = "restart";
+    cfg.common.name = "Restart Device";
+    cfg.common.icon = "mdi:restart";
+    return cfg;
+}
+
+void setUp(void) {
+    ha = new HaDiscovery(transport, "homeassistant", "devices");
+    ha->setLogLevel(LOG_LEVEL_NONE);
+    HaDeviceInfo dev;
+    dev.node_id = "esp32_kitchen_01";
+    dev.name = "Kitchen Node";
+    dev.identifiers = "a4cf12345678";
+    dev.manufacturer = "YourBrand";
+    dev.model = "ESP32";
+    dev.sw_version = "1.0.0";
+    ha->setDevice(dev);
+}
+
+void tearDown(void) {
+    delete ha;
+}
+
+// ---- Benchmarks ----
+
+void test_bench_publish_state(void) {
+    HaEntityHandle temp = ha->registerSensor(sensorConfig());
+    static const char* payloads[] = { "21.5", "21.6", "21.7", "21.8" };
+
+    check("publishState(handle)", measure([&](uint32_t i) {
+        ha->publishState(temp, payloads[i & 3]);
+    }));
+    check("publishState(object_id)", measure([&](uint32_t i) {
+        ha->publishState("temperature", payloads[i & 3]);
+    }));
+    check("publishState(handle, float)", measure([&](uint32_t i) {
+        ha->publishState(temp, 20.0f + (i & 63) * 0.1f, 1);
+    }));
+}
+
+void test_bench_publish_state_switch(void) {
+    HaEntityHandle relay = ha->registerSwitch(switchConfig());
+    check("publishStateSwitch(handle)", measure([&](uint32_t i) {
+        ha->publishStateSwitch(relay, (i & 1) != 0);
+    }));
+}
+
+void test_bench_publish_discovery(void) {
+    // Publishing the same object_id again replaces the registered entity in place.
+    HaSensorConfig sensor = sensorConfig();
+    check("publishSensorDiscovery", measure([&](uint32_t) {
+        ha->publishSensorDiscovery(sensor);
+    }));
+    HaSwitchConfig sw = switchConfig();
+    check("publishSwitchDiscovery", measure([&](uint32_t) {
+        ha->publishSwitchDiscovery(sw);
+    }));
+    HaBinarySensorConfig binary = binarySensorConfig();
+    check("publishBinarySensorDiscovery", measure([&](uint32_t) {
+        ha->publishBinarySensorDiscovery(binary);
+    }));
+    HaButtonConfig button = buttonConfig();
+    check("publishButtonDiscovery", measure([&](uint32_t) {
+        ha->publishButtonDiscovery(button);
+    }));
+}
+
+void test_bench_build_config_json(void) {
+    char json[768];
+    HaSensorConfig sensor = sensorConfig();
+    check("buildSensorConfigJson", measure([&](uint32_t) {
+        TEST_ASSERT_TRUE(ha->buildSensorConfigJson(json, sizeof(json), sensor));
+    }));
+    HaSwitchConfig sw = switchConfig();
+    check("buildSwitchConfigJson", measure([&](uint32_t) {
+        TEST_ASSERT_TRUE(ha->buildSwitchConfigJson(json, sizeof(json), sw));
+    }));
+    HaBinarySensorConfig binary = binarySensorConfig();
+    check("buildBinarySensorConfigJson", measure([&](uint32_t) {
+        TEST_ASSERT_TRUE(ha->buildBinarySensorConfigJson(json, sizeof(json), binary));
+    }));
+    HaButtonConfig button = buttonConfig();
+    check("buildButtonConfigJson", measure([&](uint32_t) {
+        TEST_ASSERT_TRUE(ha->buildButtonConfigJson(json, sizeof(json), button));
+    }));
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_bench_publish_state);
+    RUN_TEST(test_bench_publish_state_switch);
+    RUN_TEST(test_bench_publish_discovery);
+    RUN_TEST(test_bench_build_config_json);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_bench_publish_state);
+    RUN_TEST(test_bench_publish_state_switch);
+    RUN_TEST(test_bench_publish_discovery);
+    RUN_TEST(test_bench_build_config_json);
+    return UNITY_END();
+}
+#endif
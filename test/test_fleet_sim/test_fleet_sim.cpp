@@ -0,0 +1,457 @@
+// Fleet-scale load simulation: N devices x M entities against one simulated broker.
+//
+// Every device is its own HaDiscovery instance on its own transport, as in a real fleet; the
+// transports count what reaches the broker instead of sending it. The fleet goes through
+//   setup    create the devices and register their entities
+//   connect  first connect: subscriptions, discovery configs and availability
+//   states   every entity publishes a changing state, HA_FLEET_STATE_ROUNDS times
+//   storm    broker restart: all devices drop and reconnect at once, HA_FLEET_STORMS times
+// and each phase reports messages and bytes at the broker, CPU time, ticks until the fleet
+// settles, and heap use (peak during the phase and live at its end, counted by replacing the
+// global operator new/delete). The run is repeated in entity and device discovery mode.
+//
+// Sizes are build flags; on native builds environment variables of the same name override them:
+//   -DHA_FLEET_DEVICES=<n>       devices (default 1000)
+//   -DHA_FLEET_ENTITIES=<n>      entities per device (default 20)
+//   -DHA_FLEET_STATE_ROUNDS=<n>  state publishes per entity (default 10)
+//   -DHA_FLEET_STORMS=<n>        broker restarts (default 3)
+//   -DHA_FLEET_PACE=<n>          configs re-published per device and tick (default 4)
+//
+//   HA_FLEET_DEVICES=5000 pio test -e native_fleet -v
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "HaDiscovery.h"
+#include "transport/MqttTransport.h"
+#include "../heap_counter.h"
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+// A whole fleet does not fit on a microcontroller; run a small one as a smoke test.
+#ifndef HA_FLEET_DEVICES
+#define HA_FLEET_DEVICES 4
+#endif
+#ifndef HA_FLEET_ENTITIES
+#define HA_FLEET_ENTITIES 8
+#endif
+static uint32_t cpuMicros() { return micros(); }
+#else
+#include <ctime>
+static uint32_t cpuMicros() {
+    return static_cast<uint32_t>(std::clock() * (1000000.0 / CLOCKS_PER_SEC));
+}
+#endif
+
+#ifndef HA_FLEET_DEVICES
+#define HA_FLEET_DEVICES 1000
+#endif
+#ifndef HA_FLEET_ENTITIES
+#define HA_FLEET_ENTITIES 20
+#endif
+#ifndef HA_FLEET_STATE_ROUNDS
+#define HA_FLEET_STATE_ROUNDS 10
+#endif
+#ifndef HA_FLEET_STORMS
+#define HA_FLEET_STORMS 3
+#endif
+#ifndef HA_FLEET_PACE
+#define HA_FLEET_PACE 4
+#endif
+
+static size_t setting(const char* name, size_t fallback) {
+#if !defined(ARDUINO)
+    const char* env = getenv(name);
+    if (env && *env) {
+        return static_cast<size_t>(strtoul(env, nullptr, 10));
+    }
+#endif
+    return fallback;
+}
+
+// ---- Broker ----
+
+// What the broker received, over all devices.
+struct BrokerCounters {
+    size_t messages = 0;
+    size_t bytes = 0;       // topic + payload
+    size_t configs = 0;
+    size_t states = 0;
+    size_t availability = 0;
+    size_t subscribes = 0;
+};
+
+static BrokerCounters g_broker;
+
+static bool endsWith(const char* s, size_t len, const char* suffix) {
+    size_t n = strlen(suffix);
+    return len >= n && memcmp(s + len - n, suffix, n) == 0;
+}
+
+// One device's connection to the broker.
+class FleetTransport : public MqttTransport {
+public:
+    bool isConnected = false;
+    void (*onConnectCb)(void*) = nullptr;
+    void* onConnectCtx = nullptr;
+
+    bool connected() const override { return isConnected; }
+
+    bool publish(const char* topic, const uint8_t*, size_t len, bool, uint8_t) override {
+        if (!isConnected) {
+            return false;
+        }
+        size_t topic_len = strlen(topic);
+        g_broker.messages++;
+        g_broker.bytes += topic_len + len;
+        if (endsWith(topic, topic_len, "/config")) {
+            g_broker.configs++;
+        } else if (endsWith(topic, topic_len, "/status")) {
+            g_broker.availability++;
+        } else {
+            g_broker.states++;
+        }
+        return true;
+    }
+
+    bool subscribe(const char*, uint8_t) override {
+        g_broker.subscribes++;
+        return isConnected;
+    }
+
+    void setOnConnect(void (*cb)(void*), void* ctx) override {
+        onConnectCb = cb;
+        onConnectCtx = ctx;
+    }
+
+    void setServer(const char*, uint16_t, const char* = nullptr, const char* = nullptr) override {}
+    void setServer(const std::string&, uint16_t, const std::string& = "", const std::string& = "") override {}
+
+    void connect() {
+        isConnected = true;
+        onConnectCb(onConnectCtx);
+    }
+};
+
+// ---- Fleet ----
+
+static uint32_t g_now = 0;
+static uint32_t fleetMillis() {
+    return g_now;
+}
+
+static void onCommand(void*, HaEntityHandle, const char*, size_t) {}
+
+// Entity configs are shared by all devices, as firmware constants would be.
+struct EntityKinds {
+    std::vector<std::string> ids;
+    std::vector<std::string> names;
+    std::vector<HaSensorConfig> sensors;
+    std::vector<HaSwitchConfig> switches;
+    std::vector<HaBinarySensorConfig> binarySensors;
+};
+
+enum class Kind : uint8_t { Sensor, Switch, BinarySensor };
+
+static Kind kindOf(size_t entity) {
+    // Half sensors, a quarter each switches and binary sensors.
+    switch (entity % 4) {
+        case 2: return Kind::Switch;
+        case 3: return Kind::BinarySensor;
+        default: return Kind::Sensor;
+    }
+}
+
+struct SimDevice {
+    FleetTransport transport;
+    HaDiscovery ha;
+    std::string nodeId;
+    std::vector<HaEntityHandle> handles;
+
+    explicit SimDevice(JBLogger& log) : ha(transport, log) {}
+};
+
+struct PhaseResult {
+    const char* name;
+    BrokerCounters broker;
+    uint32_t cpuUs;
+    size_t ticks;
+    size_t peakHeap;
+    size_t liveHeap;
+};
+
+class Fleet {
+public:
+    Fleet(size_t devices, size_t entities, HaDiscoveryMode mode)
+      : _entities(entities), _mode(mode), _log("HaDiscovery", LOG_LEVEL_NONE) {
+        _kinds.ids.reserve(entities);
+        _kinds.names.reserve(entities);
+        for (size_t i = 0; i < entities; i++) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "entity_%u", (unsigned)i);
+            _kinds.ids.push_back(buf);
+            snprintf(buf, sizeof(buf), "Entity %u", (unsigned)i);
+            _kinds.names.push_back(buf);
+        }
+        for (size_t i = 0; i < entities; i++) {
+            const char* id = _kinds.ids[i].c_str();
+            const char* name = _kinds.names[i].c_str();
+            if (kindOf(i) == Kind::Sensor) {
+                HaSensorConfig cfg;
+                cfg.common.object_id = id;
+                cfg.common.name = name;
+                cfg.unit_of_measurement = "°C";
+                cfg.device_class = "temperature";
+                cfg.state_class = "measurement";
+                _kinds.sensors.push_back(cfg);
+            } else if (kindOf(i) == Kind::Switch) {
+                HaSwitchConfig cfg;
+                cfg.common.object_id = id;
+                cfg.common.name = name;
+                _kinds.switches.push_back(cfg);
+            } else {
+                HaBinarySensorConfig cfg;
+                cfg.common.object_id = id;
+                cfg.common.name = name;
+                cfg.device_class = "motion";
+                _kinds.binarySensors.push_back(cfg);
+            }
+        }
+        _devices.reserve(devices);
+        _deviceCount = devices;
+    }
+
+    ~Fleet() {
+        for (SimDevice* d : _devices) {
+            delete d;
+        }
+    }
+
+    void setup() {
+        for (size_t n = 0; n < _deviceCount; n++) {
+            SimDevice* d = new SimDevice(_log);
+            char node[24];
+            snprintf(node, sizeof(node), "node_%05u", (unsigned)n);
+            d->nodeId = node;
+            d->ha.setClock(&fleetMillis);
+            d->ha.setRepublishPace(setting("HA_FLEET_PACE", HA_FLEET_PACE));
+            d->ha.setDiscoveryMode(_mode);
+            HaDeviceInfo info;
+            info.node_id = d->nodeId.c_str();
+            info.name = d->nodeId.c_str();
+            info.manufacturer = "Fleet";
+            info.model = "Simulated";
+            d->ha.setDevice(info);
+
+            d->handles.reserve(_entities);
+            size_t s = 0, w = 0, b = 0;
+            for (size_t i = 0; i < _entities; i++) {
+                HaEntityHandle h;
+                if (kindOf(i) == Kind::Sensor) {
+                    h = d->ha.registerSensor(_kinds.sensors[s++]);
+                } else if (kindOf(i) == Kind::Switch) {
+                    h = d->ha.registerSwitch(_kinds.switches[w++]);
+                    d->ha.setCommandHandler(h, &onCommand);
+                } else {
+                    h = d->ha.registerBinarySensor(_kinds.binarySensors[b++]);
+                }
+                TEST_ASSERT_TRUE(h.valid());
+                d->handles.push_back(h);
+            }
+            _devices.push_back(d);
+        }
+    }
+
+    // Connect every device at once and tick the fleet until all re-publishes are done.
+    size_t connectAll() {
+        for (SimDevice* d : _devices) {
+            d->transport.connect();
+        }
+        return settle();
+    }
+
+    void disconnectAll() {
+        for (SimDevice* d : _devices) {
+            d->transport.isConnected = false;
+            d->ha.tick();
+        }
+    }
+
+    size_t publishStates(size_t round) {
+        for (SimDevice* d : _devices) {
+            for (size_t i = 0; i < _entities; i++) {
+                HaEntityHandle h = d->handles[i];
+                if (kindOf(i) == Kind::Sensor) {
+                    d->ha.publishState(h, 20.0f + static_cast<float>((round * 7 + i) % 100) * 0.1f, 1);
+                } else if (kindOf(i) == Kind::Switch) {
+                    d->ha.publishStateSwitch(h, ((round + i) & 1) != 0);
+                } else {
+                    d->ha.publishState(h, ((round + i) & 1) ? "ON" : "OFF");
+                }
+            }
+        }
+        return settle();
+    }
+
+    size_t deviceCount() const { return _deviceCount; }
+    size_t entityCount() const { return _entities; }
+
+private:
+    size_t settle() {
+        size_t ticks = 0;
+        bool busy = true;
+        while (busy) {
+            g_now += 10;
+            ticks++;
+            busy = false;
+            for (SimDevice* d : _devices) {
+                d->ha.tick();
+                busy = busy || d->ha.isRepublishing();
+            }
+            TEST_ASSERT_TRUE_MESSAGE(ticks < 100000, "fleet did not settle");
+        }
+        return ticks;
+    }
+
+    size_t _entities;
+    size_t _deviceCount = 0;
+    HaDiscoveryMode _mode;
+    JBLogger _log;
+    EntityKinds _kinds;
+    std::vector<SimDevice*> _devices;
+};
+
+// ---- Reporting ----
+
+class Phase {
+public:
+    explicit Phase(const char* name) : _name(name) {
+        g_broker = BrokerCounters();
+        g_heapPeak = g_heapCurrent;
+        _heapStart = g_heapCurrent;
+        _cpuStart = cpuMicros();
+    }
+
+    PhaseResult end(size_t ticks) {
+        PhaseResult r;
+        r.name = _name;
+        r.cpuUs = cpuMicros() - _cpuStart;
+        r.broker = g_broker;
+        r.ticks = ticks;
+        r.peakHeap = g_heapPeak - _heapStart;
+        r.liveHeap = g_heapCurrent;
+        return r;
+    }
+
+private:
+    const char* _name;
+    size_t _heapStart;
+    uint32_t _cpuStart;
+};
+
+static void report(const PhaseResult& r) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-8s %9u %11u %8u %8u %6u %6u %9.1f %6u %9u %9u",
+             r.name, (unsigned)r.broker.messages, (unsigned)r.broker.bytes, (unsigned)r.broker.configs,
+             (unsigned)r.broker.states, (unsigned)r.broker.availability, (unsigned)r.broker.subscribes,
+             r.cpuUs / 1000.0f, (unsigned)r.ticks, (unsigned)(r.peakHeap / 1024), (unsigned)(r.liveHeap / 1024));
+    TEST_MESSAGE(line);
+}
+
+static void runFleet(HaDiscoveryMode mode) {
+    size_t devices = setting("HA_FLEET_DEVICES", HA_FLEET_DEVICES);
+    size_t entities = setting("HA_FLEET_ENTITIES", HA_FLEET_ENTITIES);
+    size_t rounds = setting("HA_FLEET_STATE_ROUNDS", HA_FLEET_STATE_ROUNDS);
+    size_t storms = setting("HA_FLEET_STORMS", HA_FLEET_STORMS);
+    TEST_ASSERT_TRUE(devices > 0 && entities > 0);
+
+    char line[200];
+    snprintf(line, sizeof(line), "fleet: %u devices x %u entities, %s discovery, %u state rounds, %u storms",
+             (unsigned)devices, (unsigned)entities, mode == HaDiscoveryMode::Device ? "device" : "entity",
+             (unsigned)rounds, (unsigned)storms);
+    TEST_MESSAGE(line);
+    TEST_MESSAGE("phase     messages       bytes  configs   states  avail   subs    CPU ms  ticks  peak KiB  live KiB");
+
+    size_t heapBefore = g_heapCurrent;
+    {
+        Fleet fleet(devices, entities, mode);
+
+        Phase setup("setup");
+        fleet.setup();
+        PhaseResult setupResult = setup.end(0);
+        report(setupResult);
+        TEST_ASSERT_EQUAL(0, setupResult.broker.messages);
+
+        Phase connect("connect");
+        PhaseResult connectResult = connect.end(fleet.connectAll());
+        report(connectResult);
+        TEST_ASSERT_EQUAL(devices, connectResult.broker.availability);
+        if (mode == HaDiscoveryMode::Entity) {
+            TEST_ASSERT_EQUAL(devices * entities, connectResult.broker.configs);
+        } else {
+            TEST_ASSERT_TRUE(connectResult.broker.configs >= devices);
+        }
+
+        Phase states("states");
+        size_t ticks = 0;
+        for (size_t round = 0; round < rounds; round++) {
+            ticks += fleet.publishStates(round);
+        }
+        PhaseResult statesResult = states.end(ticks);
+        report(statesResult);
+        TEST_ASSERT_EQUAL(devices * entities * rounds, statesResult.broker.states);
+
+        Phase storm("storm");
+        ticks = 0;
+        for (size_t i = 0; i < storms; i++) {
+            fleet.disconnectAll();
+            ticks += fleet.connectAll();
+        }
+        PhaseResult stormResult = storm.end(ticks);
+        report(stormResult);
+        // Every restart costs what the first connect did.
+        TEST_ASSERT_EQUAL(storms * connectResult.broker.configs, stormResult.broker.configs);
+        TEST_ASSERT_EQUAL(storms * connectResult.broker.availability, stormResult.broker.availability);
+        TEST_ASSERT_EQUAL(storms * connectResult.broker.subscribes, stormResult.broker.subscribes);
+        TEST_ASSERT_EQUAL(0, stormResult.broker.states);
+
+        snprintf(line, sizeof(line), "per device: %u B heap, %u configs and %u B per broker restart",
+                 (unsigned)((connectResult.liveHeap - heapBefore) / devices),
+                 (unsigned)(connectResult.broker.configs / devices),
+                 (unsigned)(connectResult.broker.bytes / devices));
+        TEST_MESSAGE(line);
+    }
+    TEST_ASSERT_EQUAL(heapBefore, g_heapCurrent);   // nothing leaked
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_fleet_entity_discovery(void) {
+    runFleet(HaDiscoveryMode::Entity);
+}
+
+void test_fleet_device_discovery(void) {
+    runFleet(HaDiscoveryMode::Device);
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_fleet_entity_discovery);
+    RUN_TEST(test_fleet_device_discovery);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fleet_entity_discovery);
+    RUN_TEST(test_fleet_device_discovery);
+    return UNITY_END();
+}
+#endif
@@ -2,10 +2,20 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <stdio.h>
 #include "HaDiscovery.h"
+#include "HaEntityTable.h"
+#include "HaJsonWriter.h"
+#include "HaStaticEntity.h"
+#include "HaManifestStorage.h"
 #include "transport/MqttTransport.h"
 #include <ArduinoJson.h>
 
+static uint32_t fakeNow = 0;
+static uint32_t fakeMillis() {
+    return fakeNow;
+}
+
 // Mock MQTT Transport
 class MockTransport : public MqttTransport {
 public:
@@ -23,7 +33,15 @@ public:
 
     bool connected() const override { return isConnected; }
 
+    bool failPublish = false;
+    std::string failTopic;        // non-empty payloads to this topic are rejected (not reset by clear())
+    uint32_t publishCostMs = 0;   // advances fakeNow, like a blocking socket write
+
     bool publish(const char* topic, const uint8_t* payload, size_t len, bool retained, uint8_t qos) override {
+        fakeNow += publishCostMs;
+        if (failPublish || (len > 0 && failTopic == topic)) {
+            return false;
+        }
         Message msg;
         msg.topic = topic;
         if (payload && len > 0) {
@@ -35,6 +53,15 @@ public:
         return true;
     }
 
+    size_t streamWrites = 0;
+    size_t largestWrite = 0;
+
+    size_t write(const uint8_t* data, size_t len) override {
+        streamWrites++;
+        if (len > largestWrite) largestWrite = len;
+        return MqttTransport::write(data, len);
+    }
+
     void setOnConnect(void (*cb)(void*), void* ctx) override {
         onConnectCb = cb;
         onConnectCtx = ctx;
@@ -42,9 +69,71 @@ public:
 
     void setServer(const char* host, uint16_t port, const char* user = nullptr, const char* pass = nullptr) override {}
     void setServer(const std::string& host, uint16_t port, const std::string& user = "", const std::string& pass = "") override {}
+    using MqttTransport::setServer;
+
+    Message will;
+    bool hasWill = false;
+
+    bool setWill(const MqttWill& w) override {
+        hasWill = w.topic != nullptr;
+        will.topic = w.topic ? w.topic : "";
+        will.payload = w.payload ? w.payload : "";
+        will.retained = w.retain;
+        will.qos = w.qos;
+        return true;
+    }
+
+    // Packet buffer as PubSubClient keeps it: grown on demand, up to bufferLimit.
+    size_t bufferSize = 256;
+    size_t bufferLimit = SIZE_MAX;
+    size_t bufferAllocations = 0;
+
+    bool reservePublishSize(size_t topic_len, size_t payload_len) override {
+        size_t need = 7 + topic_len + payload_len;
+        if (need <= bufferSize) {
+            return true;
+        }
+        if (need > bufferLimit) {
+            return false;
+        }
+        bufferSize = need;
+        bufferAllocations++;
+        return true;
+    }
+
+    std::vector<std::string> subscriptions;
+    MessageFn onMessageCb = nullptr;
+    void* onMessageCtx = nullptr;
+
+    bool subscribe(const char* topic, uint8_t qos) override {
+        subscriptions.push_back(topic);
+        return true;
+    }
+
+    void setOnMessage(MessageFn cb, void* ctx) override {
+        onMessageCb = cb;
+        onMessageCtx = ctx;
+    }
+
+    void deliver(const char* topic, const char* payload) {
+        onMessageCb(onMessageCtx, topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+    }
+
+    // Simulated acknowledgement tracking
+    size_t window = SIZE_MAX;
+    size_t pending = 0;
+    size_t publishWindow() const override { return window; }
+    size_t pendingPublishes() const override { return pending; }
 
     void clear() {
+        failPublish = false;
+        publishCostMs = 0;
+        window = SIZE_MAX;
+        pending = 0;
+        subscriptions.clear();
         messages.clear();
+        streamWrites = 0;
+        largestWrite = 0;
     }
 };
 
@@ -53,6 +142,10 @@ HaDiscovery* discovery;
 
 void setUp(void) {
     transport.clear();
+    transport.failTopic.clear();
+    transport.bufferSize = 256;
+    transport.bufferLimit = SIZE_MAX;
+    transport.bufferAllocations = 0;
     discovery = new HaDiscovery(transport, "homeassistant", "devices");
     discovery->setLogLevel(LOG_LEVEL_NONE);
 
@@ -204,7 +297,1290 @@ void test_press_button(void) {
     TEST_ASSERT_EQUAL_STRING("CUSTOM", transport.messages[0].payload.c_str());
 }
 
+void test_reconnect_republishes_registered_configs(void) {
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    HaButtonConfig restart;
+    restart.common.object_id = "restart";
+    discovery->publishSensorDiscovery(temp);
+    discovery->publishSwitchDiscovery(relay);
+    discovery->publishButtonDiscovery(restart);
+    discovery->removeEntity("button", "restart");
+    TEST_ASSERT_EQUAL(2, discovery->entityCount());
+
+    transport.clear();
+    transport.onConnectCb(transport.onConnectCtx);
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+    TEST_ASSERT_TRUE(discovery->isRepublishing());
+
+    // Paced: one message per tick by default, availability once the configs are in place
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/temp/config", transport.messages[0].topic.c_str());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/switch/test_node/relay/config", transport.messages[1].topic.c_str());
+    TEST_ASSERT_TRUE(discovery->isRepublishing());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", transport.messages[2].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("online", transport.messages[2].payload.c_str());
+    TEST_ASSERT_FALSE(discovery->isRepublishing());
+
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+}
+
+void test_republish_pace_and_replace(void) {
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    temp.common.name = "Old";
+    discovery->publishSensorDiscovery(temp);
+    temp.common.name = "New";
+    discovery->publishSensorDiscovery(temp);
+    HaBinarySensorConfig motion;
+    motion.common.object_id = "motion";
+    discovery->publishBinarySensorDiscovery(motion);
+    TEST_ASSERT_EQUAL(2, discovery->entityCount());
+
+    transport.clear();
+    discovery->setRepublishPace(5);
+    discovery->republishDiscovery();
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_FALSE(discovery->isRepublishing());
+
+    JsonDocument doc;
+    deserializeJson(doc, transport.messages[0].payload);
+    TEST_ASSERT_EQUAL_STRING("New", doc["name"]);
+}
+
+void test_publish_state_by_handle(void) {
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaEntityHandle h = discovery->registerSensor(temp);
+    TEST_ASSERT_TRUE(h.valid());
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/temp/state", discovery->stateTopic(h));
+    TEST_ASSERT_NULL(discovery->commandTopic(h));
+
+    TEST_ASSERT_TRUE(discovery->publishState(h, "21.0"));
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/temp/state", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("21.0", transport.messages[0].payload.c_str());
+
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    relay.common.state_topic_override = "custom/relay";
+    discovery->publishSwitchDiscovery(relay);
+    HaEntityHandle r = discovery->entityHandle("relay");
+    TEST_ASSERT_TRUE(r.valid());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/relay/set", discovery->commandTopic(r));
+
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->publishStateSwitch(r, true));
+    TEST_ASSERT_EQUAL_STRING("custom/relay", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("ON", transport.messages[0].payload.c_str());
+
+    discovery->removeEntity("sensor", "temp");
+    transport.clear();
+    TEST_ASSERT_FALSE(discovery->publishState(h, "1"));
+    TEST_ASSERT_FALSE(discovery->publishState(HaEntityHandle{}, "1"));
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+}
+
+void test_republish_fills_transport_window(void) {
+    for (int i = 0; i < 5; i++) {
+        static char ids[5][8];
+        snprintf(ids[i], sizeof(ids[i]), "s%d", i);
+        HaSensorConfig cfg;
+        cfg.common.object_id = ids[i];
+        discovery->registerSensor(cfg);
+    }
+
+    transport.onConnectCb(transport.onConnectCtx);
+    transport.clear();
+    transport.window = 3;
+    transport.pending = 3;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.messages.size());   // window, not the default pace of 1
+
+    transport.window = 0;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+
+    transport.window = 2;
+    transport.pending = 2;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    TEST_ASSERT_TRUE(discovery->isRepublishing());   // availability still to go
+
+    transport.window = 1;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(6, transport.messages.size());
+    TEST_ASSERT_FALSE(discovery->isRepublishing());
+    TEST_ASSERT_FALSE(discovery->isDiscoveryDelivered());
+
+    transport.pending = 0;
+    TEST_ASSERT_TRUE(discovery->isDiscoveryDelivered());
+}
+
+static int discoveryCompletions = 0;
+
+void test_republish_time_and_byte_budget(void) {
+    static char ids[6][8];
+    for (int i = 0; i < 6; i++) {
+        snprintf(ids[i], sizeof(ids[i]), "s%d", i);
+        HaSensorConfig cfg;
+        cfg.common.object_id = ids[i];
+        discovery->registerSensor(cfg);
+    }
+    discoveryCompletions = 0;
+    discovery->setOnDiscoveryComplete([](void*) { discoveryCompletions++; });
+    discovery->setClock(&fakeMillis);
+    discovery->setRepublishPace(SIZE_MAX);
+
+    // 5 ms per tick with 2 ms per publish: the third publish crosses the budget.
+    discovery->setRepublishBudget(5, 0);
+    transport.onConnectCb(transport.onConnectCtx);
+    transport.clear();
+    transport.publishCostMs = 2;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+    HaDiscoveryProgress p = discovery->discoveryProgress();
+    TEST_ASSERT_TRUE(p.active);
+    TEST_ASSERT_EQUAL(3, p.done);
+    TEST_ASSERT_EQUAL(6, p.total);
+    TEST_ASSERT_EQUAL(1, p.ticks);
+
+    // A one-byte budget still makes progress: one message per tick.
+    discovery->setRepublishBudget(0, 1);
+    discovery->tick();
+    TEST_ASSERT_EQUAL(4, transport.messages.size());
+    TEST_ASSERT_EQUAL(0, discoveryCompletions);
+
+    // Without limits the rest goes out, availability last, then completion is reported.
+    discovery->setRepublishBudget(0, 0);
+    discovery->tick();
+    TEST_ASSERT_EQUAL(7, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/s5/config", transport.messages[5].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", transport.messages[6].topic.c_str());
+    TEST_ASSERT_EQUAL(1, discoveryCompletions);
+    p = discovery->discoveryProgress();
+    TEST_ASSERT_FALSE(p.active);
+    TEST_ASSERT_EQUAL(6, p.done);
+    TEST_ASSERT_EQUAL(3, p.ticks);
+    size_t bytes = 0;
+    for (const MockTransport::Message& m : transport.messages) {
+        bytes += m.payload.size();
+    }
+    TEST_ASSERT_EQUAL(bytes, p.bytes);
+
+    discovery->tick();
+    TEST_ASSERT_EQUAL(7, transport.messages.size());
+    TEST_ASSERT_EQUAL(1, discoveryCompletions);
+}
+
+class MemoryManifestStorage : public HaManifestStorage {
+public:
+    std::string blob;
+    int saves = 0;
+    bool load(std::string& data) override {
+        data = blob;
+        return !blob.empty();
+    }
+    bool save(const std::string& data) override {
+        blob = data;
+        saves++;
+        return true;
+    }
+};
+
+static void bootWithManifest(HaDiscovery& ha, MemoryManifestStorage& storage, const char* node, bool includeOld,
+                             const char* relayName, bool tempRetained = true) {
+    ha.setLogLevel(LOG_LEVEL_NONE);
+    ha.setRepublishPace(10);
+    HaDeviceInfo dev;
+    dev.node_id = node;
+    ha.setDevice(dev);
+    ha.setManifestStorage(&storage);
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    ha.registerSensor(temp, tempRetained);
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    relay.common.name = relayName;
+    ha.registerSwitch(relay);
+    if (includeOld) {
+        HaBinarySensorConfig old;
+        old.common.object_id = "old";
+        ha.registerBinarySensor(old);
+    }
+
+    transport.clear();
+    transport.onConnectCb(transport.onConnectCtx);
+    ha.tick();
+}
+
+void test_manifest_skips_unchanged_and_removes_stale(void) {
+    MemoryManifestStorage storage;
+    {
+        HaDiscovery boot1(transport, "homeassistant", "devices");
+        bootWithManifest(boot1, storage, "node", true, "Relay");
+        TEST_ASSERT_EQUAL(4, transport.messages.size());   // availability + 3 configs
+        TEST_ASSERT_EQUAL(1, storage.saves);
+
+        // Reconnect in the same session: the broker may have restarted without its retained
+        // store, so everything is sent again; the unchanged manifest is not saved.
+        transport.clear();
+        transport.onConnectCb(transport.onConnectCtx);
+        boot1.tick();
+        TEST_ASSERT_EQUAL(4, transport.messages.size());
+        TEST_ASSERT_EQUAL(1, storage.saves);
+    }
+    {
+        // The renamed relay config is rejected (e.g. too large for the client): the entity is
+        // still registered, so its retained config must not be deleted, and it is retried later.
+        transport.failTopic = "homeassistant/switch/node/relay/config";
+        HaDiscovery failed(transport, "homeassistant", "devices");
+        bootWithManifest(failed, storage, "node", true, "Lamp");
+        transport.failTopic.clear();
+        TEST_ASSERT_EQUAL(1, transport.messages.size());
+        TEST_ASSERT_EQUAL_STRING("devices/node/status", transport.messages[0].topic.c_str());
+        TEST_ASSERT_EQUAL(1, storage.saves);
+    }
+    {
+        // New firmware: relay renamed, "old" dropped.
+        HaDiscovery boot2(transport, "homeassistant", "devices");
+        bootWithManifest(boot2, storage, "node", false, "Light");
+        TEST_ASSERT_EQUAL(3, transport.messages.size());
+        TEST_ASSERT_EQUAL_STRING("homeassistant/switch/node/relay/config", transport.messages[0].topic.c_str());
+        TEST_ASSERT_EQUAL_STRING("homeassistant/binary_sensor/node/old/config", transport.messages[1].topic.c_str());
+        TEST_ASSERT_EQUAL(0, transport.messages[1].payload.size());
+        TEST_ASSERT_TRUE(transport.messages[1].retained);
+        TEST_ASSERT_EQUAL_STRING("devices/node/status", transport.messages[2].topic.c_str());
+        TEST_ASSERT_EQUAL(2, storage.saves);
+    }
+    {
+        // Unchanged boot: only availability.
+        HaDiscovery boot3(transport, "homeassistant", "devices");
+        bootWithManifest(boot3, storage, "node", false, "Light");
+        TEST_ASSERT_EQUAL(1, transport.messages.size());
+
+        boot3.clearManifest();
+        transport.clear();
+        transport.onConnectCb(transport.onConnectCtx);
+        boot3.tick();
+        TEST_ASSERT_EQUAL(3, transport.messages.size());
+    }
+    {
+        // A config that is not retained is not on the broker, so it is sent on every boot.
+        HaDiscovery boot4(transport, "homeassistant", "devices");
+        bootWithManifest(boot4, storage, "node", false, "Light", false);
+        TEST_ASSERT_EQUAL(2, transport.messages.size());
+        TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/node/temp/config", transport.messages[0].topic.c_str());
+        TEST_ASSERT_FALSE(transport.messages[0].retained);
+    }
+    {
+        // A manifest for another node is ignored.
+        HaDiscovery other(transport, "homeassistant", "devices");
+        bootWithManifest(other, storage, "other_node", false, "Light");
+        TEST_ASSERT_EQUAL(3, transport.messages.size());
+    }
+}
+
+void test_json_writer_escaping_and_overflow(void) {
+    char buf[64];
+    HaJsonWriter w(buf, sizeof(buf));
+    w.beginObject();
+    w.member("name", "Say \"hi\"\n");
+    w.key("ids");
+    w.beginArray();
+    w.value("a");
+    w.value("b");
+    w.endArray();
+    w.endObject();
+    TEST_ASSERT_TRUE(w.ok());
+    TEST_ASSERT_EQUAL_STRING("{\"name\":\"Say \\\"hi\\\"\\n\",\"ids\":[\"a\",\"b\"]}", buf);
+
+    char small[8];
+    HaJsonWriter s(small, sizeof(small));
+    s.beginObject();
+    s.member("key", "value");
+    s.endObject();
+    TEST_ASSERT_FALSE(s.ok());
+    TEST_ASSERT_EQUAL(15, s.length());
+    TEST_ASSERT_EQUAL(7, strlen(small));
+}
+
+void test_discovery_escapes_names(void) {
+    HaSensorConfig cfg;
+    cfg.common.object_id = "temp";
+    cfg.common.name = "Living \"Room\"";
+    TEST_ASSERT_TRUE(discovery->publishSensorDiscovery(cfg));
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("Living \"Room\"", doc["name"]);
+}
+
+void test_device_discovery_single_message(void) {
+    discovery->setDiscoveryMode(HaDiscoveryMode::Device);
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    temp.unit_of_measurement = "°C";
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    TEST_ASSERT_TRUE(discovery->publishSensorDiscovery(temp));
+    TEST_ASSERT_TRUE(discovery->publishSwitchDiscovery(relay));
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    const auto& msg = transport.messages[0];
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/test_node/config", msg.topic.c_str());
+    TEST_ASSERT_TRUE(msg.retained);
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, msg.payload));
+    TEST_ASSERT_EQUAL_STRING("test_mac", doc["dev"]["ids"][0]);
+    TEST_ASSERT_EQUAL_STRING("JBHaMqttDiscovery", doc["o"]["name"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", doc["avty_t"]);
+    TEST_ASSERT_EQUAL_STRING("sensor", doc["cmps"]["temp"]["p"]);
+    TEST_ASSERT_EQUAL_STRING("°C", doc["cmps"]["temp"]["unit_of_meas"]);
+    TEST_ASSERT_TRUE(doc["cmps"]["temp"]["dev"].isNull());
+    TEST_ASSERT_TRUE(doc["cmps"]["temp"]["avty_t"].isNull());
+    TEST_ASSERT_EQUAL_STRING("switch", doc["cmps"]["relay"]["p"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/relay/set", doc["cmps"]["relay"]["cmd_t"]);
+
+    // Removal lists the component with only its platform key, once
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->removeEntity("sensor", "temp"));
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    deserializeJson(doc, transport.messages[0].payload);
+    TEST_ASSERT_EQUAL(1, doc["cmps"]["temp"].size());
+    TEST_ASSERT_EQUAL_STRING("sensor", doc["cmps"]["temp"]["p"]);
+
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->publishDeviceDiscovery());
+    deserializeJson(doc, transport.messages[0].payload);
+    TEST_ASSERT_TRUE(doc["cmps"]["temp"].isNull());
+    TEST_ASSERT_EQUAL(1, doc["cmps"].size());
+}
+
+void test_device_discovery_chunked(void) {
+    discovery->setDiscoveryMode(HaDiscoveryMode::Device);
+    discovery->setDeviceChunkSize(600);
+    static char ids[10][8];
+    for (int i = 0; i < 10; i++) {
+        snprintf(ids[i], sizeof(ids[i]), "s%d", i);
+        HaSensorConfig cfg;
+        cfg.common.object_id = ids[i];
+        discovery->registerSensor(cfg);
+    }
+    TEST_ASSERT_TRUE(discovery->publishDeviceDiscovery());
+    TEST_ASSERT_GREATER_THAN(1, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/test_node/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/test_node_1/config", transport.messages[1].topic.c_str());
+
+    size_t components = 0;
+    for (const auto& msg : transport.messages) {
+        TEST_ASSERT_LESS_OR_EQUAL(600, msg.payload.size());
+        JsonDocument doc;
+        TEST_ASSERT_FALSE(deserializeJson(doc, msg.payload));
+        components += doc["cmps"].size();
+    }
+    TEST_ASSERT_EQUAL(10, components);
+
+    // Fewer chunks later clears the stale ones
+    size_t chunks = transport.messages.size();
+    transport.clear();
+    discovery->setDeviceChunkSize(0);
+    TEST_ASSERT_TRUE(discovery->publishDeviceDiscovery());
+    TEST_ASSERT_EQUAL(chunks, transport.messages.size());
+    TEST_ASSERT_TRUE(transport.messages[chunks - 1].payload.empty());
+}
+
+constexpr HaSwitchConfig kCompactFanCfg{{"fan", "Fan"}, nullptr, "1", "OFF"};
+HA_STATIC_ENTITY(kCompactFan, kCompactFanCfg);
+
+void test_compact_config_format(void) {
+    discovery->setConfigFormat(HaConfigFormat::Compact);
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    relay.command_topic_override = "devices/test_node/relay/cmd";  // below the base: abbreviated
+    relay.payload_on = "1";                                         // not the default: kept
+    char json[512];
+    TEST_ASSERT_TRUE(discovery->buildSwitchConfigJson(json, sizeof(json), relay));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"~\":\"devices/test_node\",\"name\":\"relay\",\"uniq_id\":\"test_node_relay\","
+        "\"stat_t\":\"~/relay/state\",\"cmd_t\":\"~/relay/cmd\",\"pl_on\":\"1\",\"avty_t\":\"~/status\","
+        "\"dev\":{\"ids\":[\"test_mac\"],\"name\":\"Test Device\",\"mf\":\"Manufacturer\",\"mdl\":\"Model X\","
+        "\"sw\":\"1.0.0\"}}",
+        json);
+
+    HaButtonConfig button;
+    button.common.object_id = "restart";
+    button.command_topic_override = "other/restart";  // outside the base: verbatim
+    TEST_ASSERT_TRUE(discovery->buildButtonConfigJson(json, sizeof(json), button));
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, json));
+    TEST_ASSERT_EQUAL_STRING("other/restart", doc["cmd_t"]);
+    TEST_ASSERT_TRUE(doc["pl_prs"].isNull());
+    TEST_ASSERT_TRUE(doc["pl_avail"].isNull());
+
+    // Compile-time entities store only the payloads that differ from the default
+    TEST_ASSERT_EQUAL_STRING("\"name\":\"Fan\",\"pl_on\":\"1\"", kCompactFan.json);
+    TEST_ASSERT_TRUE(discovery->publishStaticDiscovery(kCompactFan));
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("1", doc["pl_on"]);
+    TEST_ASSERT_TRUE(doc["pl_off"].isNull());
+    TEST_ASSERT_EQUAL_STRING("~/fan/set", doc["cmd_t"]);
+    discovery->setConfigFormat(HaConfigFormat::Full);
+    transport.clear();
+    discovery->republishDiscovery();
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("1", doc["pl_on"]);
+    TEST_ASSERT_EQUAL_STRING("OFF", doc["pl_off"]);
+    TEST_ASSERT_EQUAL_STRING("online", doc["pl_avail"]);
+    TEST_ASSERT_TRUE(discovery->removeEntity("switch", "fan"));
+    discovery->setConfigFormat(HaConfigFormat::Compact);
+    transport.clear();
+
+    // Device configs leave out the defaults but keep topics spelled out
+    discovery->setDiscoveryMode(HaDiscoveryMode::Device);
+    TEST_ASSERT_TRUE(discovery->publishSwitchDiscovery(relay));
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_TRUE(doc["~"].isNull());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", doc["avty_t"]);
+    TEST_ASSERT_TRUE(doc["pl_avail"].isNull());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/relay/state", doc["cmps"]["relay"]["stat_t"]);
+    TEST_ASSERT_TRUE(doc["cmps"]["relay"]["pl_off"].isNull());
+}
+
+void test_additional_components(void) {
+    HaNumberConfig number;
+    number.common.object_id = "interval";
+    number.min = 0.5f;
+    number.max = 60;
+    number.unit_of_measurement = "s";
+    HaEntityHandle interval = discovery->registerNumber(number);
+    static const char* const kOptions[] = { "low", "high", nullptr };
+    HaSelectConfig select;
+    select.common.object_id = "fan";
+    select.options = kOptions;
+    static const char* const kColorModes[] = { "brightness", nullptr };
+    HaLightConfig light;
+    light.common.object_id = "lamp";
+    light.supported_color_modes = kColorModes;
+    HaCoverConfig cover;
+    cover.common.object_id = "garage";
+    cover.device_class = "garage";
+    static const char* const kModes[] = { "off", "heat", nullptr };
+    HaClimateConfig climate;
+    climate.common.object_id = "thermostat";
+    climate.modes = kModes;
+    climate.temperature_command_topic = "devices/test_node/thermostat/target/set";
+    climate.temp_step = 0.5f;
+
+    TEST_ASSERT_TRUE(discovery->publishNumberDiscovery(number));
+    TEST_ASSERT_TRUE(discovery->publishSelectDiscovery(select));
+    TEST_ASSERT_TRUE(discovery->publishLightDiscovery(light));
+    TEST_ASSERT_TRUE(discovery->publishCoverDiscovery(cover));
+    TEST_ASSERT_TRUE(discovery->publishClimateDiscovery(climate));
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/number/test_node/interval/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/select/test_node/fan/config", transport.messages[1].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/light/test_node/lamp/config", transport.messages[2].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/cover/test_node/garage/config", transport.messages[3].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/climate/test_node/thermostat/config", transport.messages[4].topic.c_str());
+
+    char json[512];
+    TEST_ASSERT_TRUE(discovery->buildNumberConfigJson(json, sizeof(json), number));
+    TEST_ASSERT_EQUAL_STRING(transport.messages[0].payload.c_str(), json);
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"cmd_t\":\"devices/test_node/interval/set\""));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"min\":0.5,\"max\":60,\"step\":1,"));
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[1].payload));
+    TEST_ASSERT_EQUAL_STRING("high", doc["ops"][1]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/fan/state", doc["stat_t"]);
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[2].payload));
+    TEST_ASSERT_EQUAL_STRING("json", doc["schema"]);
+    TEST_ASSERT_EQUAL_STRING("brightness", doc["sup_clrm"][0]);
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[3].payload));
+    TEST_ASSERT_EQUAL_STRING("CLOSE", doc["pl_cls"]);
+    TEST_ASSERT_EQUAL_STRING("garage", doc["dev_cla"]);
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[4].payload));
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/thermostat/set", doc["mode_cmd_t"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/thermostat/state", doc["mode_stat_t"]);
+    TEST_ASSERT_EQUAL_STRING("heat", doc["modes"][1]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/thermostat/target/set", doc["temp_cmd_t"]);
+    TEST_ASSERT_TRUE(doc["curr_temp_t"].isNull());
+
+    // Compact: numbers equal to the Home Assistant defaults are left out, extra topics abbreviated
+    discovery->setConfigFormat(HaConfigFormat::Compact);
+    TEST_ASSERT_TRUE(discovery->buildNumberConfigJson(json, sizeof(json), number));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"min\":0.5,\"max\":60,\"unit_of_meas\""));
+    TEST_ASSERT_TRUE(discovery->buildClimateConfigJson(json, sizeof(json), climate));
+    TEST_ASSERT_FALSE(deserializeJson(doc, json));
+    TEST_ASSERT_EQUAL_STRING("~/thermostat/target/set", doc["temp_cmd_t"]);
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"temp_step\":0.5"));
+    TEST_ASSERT_TRUE(doc["min_temp"].isNull());
+
+    // The temperature defaults are in °C, so explicit values in °F are always sent
+    climate.temperature_unit = "F";
+    TEST_ASSERT_TRUE(discovery->buildClimateConfigJson(json, sizeof(json), climate));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"min_temp\":7,\"max_temp\":35,"));
+    climate.temperature_unit = "C";
+    TEST_ASSERT_TRUE(discovery->buildClimateConfigJson(json, sizeof(json), climate));
+    TEST_ASSERT_NULL(strstr(json, "min_temp"));
+
+    // Commands reach the handler like those of switches and buttons
+    static std::string received;
+    TEST_ASSERT_TRUE(discovery->setCommandHandler(interval, [](void*, HaEntityHandle, const char* payload, size_t len) {
+        received.assign(payload, len);
+    }));
+    transport.deliver("devices/test_node/interval/set", "12.5");
+    discovery->tick();
+    TEST_ASSERT_EQUAL_STRING("12.5", received.c_str());
+    TEST_ASSERT_TRUE(discovery->removeEntity("climate", "thermostat"));
+    TEST_ASSERT_EQUAL_STRING("homeassistant/climate/test_node/thermostat/config", transport.messages.back().topic.c_str());
+}
+
+void test_last_will_uses_availability_topic(void) {
+    // setDevice() in setUp() set the will; nothing is published for it.
+    TEST_ASSERT_TRUE(transport.hasWill);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", transport.will.topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("offline", transport.will.payload.c_str());
+    TEST_ASSERT_TRUE(transport.will.retained);
+    TEST_ASSERT_EQUAL(1, transport.will.qos);
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+
+    // A will passed to setServer() afterwards replaces it
+    MqttWill custom;
+    custom.topic = "custom/lwt";
+    custom.payload = "gone";
+    custom.retain = false;
+    custom.qos = 0;
+    transport.setServer("broker", 1883, nullptr, nullptr, custom);
+    TEST_ASSERT_EQUAL_STRING("custom/lwt", transport.will.topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("gone", transport.will.payload.c_str());
+    TEST_ASSERT_FALSE(transport.will.retained);
+
+    // Added devices do not touch the will, a primary device without node_id clears it
+    HaDeviceInfo sub;
+    sub.node_id = "sub_node";
+    discovery->addDevice(sub);
+    TEST_ASSERT_EQUAL_STRING("custom/lwt", transport.will.topic.c_str());
+    discovery->setDevice(HaDeviceInfo());
+    TEST_ASSERT_FALSE(transport.hasWill);
+}
+
+void test_transport_buffer_sized_to_largest_config(void) {
+    transport.isConnected = false;   // registered before the broker is reached
+    HaSensorConfig small;
+    small.common.object_id = "small";
+    discovery->registerSensor(small);
+    std::string longName(400, 'n');
+    HaSensorConfig large;
+    large.common.object_id = "large";
+    large.common.name = longName.c_str();
+    discovery->registerSensor(large);
+    std::string hugeName(1000, 'h');
+    HaSensorConfig huge;   // streamed, so only its topic counts
+    huge.common.object_id = "huge";
+    huge.common.name = hugeName.c_str();
+    discovery->registerSensor(huge);
+
+    size_t topic_len = 0;
+    size_t payload_len = 0;
+    size_t largest = discovery->largestConfigMessage(topic_len, payload_len);
+    TEST_ASSERT_EQUAL(strlen("homeassistant/sensor/test_node/large/config"), topic_len);
+    TEST_ASSERT_EQUAL(topic_len + payload_len, largest);
+
+    // One allocation on the first connect, of exactly the largest config published.
+    transport.isConnected = true;
+    transport.clear();
+    transport.onConnectCb(transport.onConnectCtx);
+    while (discovery->isRepublishing()) {
+        discovery->tick();
+    }
+    TEST_ASSERT_EQUAL(1, transport.bufferAllocations);
+    TEST_ASSERT_EQUAL(7 + largest, transport.bufferSize);
+    size_t published = 0;
+    for (const auto& m : transport.messages) {
+        if (m.payload.size() < 768 && m.topic.size() + m.payload.size() > published) {
+            published = m.topic.size() + m.payload.size();
+        }
+    }
+    TEST_ASSERT_EQUAL(largest, published);
+
+    // A reconnect replays into the same buffer.
+    transport.onConnectCb(transport.onConnectCtx);
+    while (discovery->isRepublishing()) {
+        discovery->tick();
+    }
+    TEST_ASSERT_EQUAL(1, transport.bufferAllocations);
+
+    // An entity registered while connected is measured before the next replay sends anything.
+    std::string widerName(450, 'w');
+    HaSensorConfig wider;
+    wider.common.object_id = "wider";
+    wider.common.name = widerName.c_str();
+    discovery->registerSensor(wider);
+    largest = discovery->largestConfigMessage(topic_len, payload_len);
+    transport.clear();
+    discovery->republishDiscovery();
+    TEST_ASSERT_EQUAL(2, transport.bufferAllocations);
+    TEST_ASSERT_EQUAL(7 + largest, transport.bufferSize);
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+    while (discovery->isRepublishing()) {
+        discovery->tick();
+    }
+    TEST_ASSERT_EQUAL(2, transport.bufferAllocations);
+
+    // A config that cannot fit is refused before anything is sent.
+    transport.clear();
+    transport.bufferLimit = transport.bufferSize;
+    std::string longerName(500, 'l');
+    HaSensorConfig longer;
+    longer.common.object_id = "longer";
+    longer.common.name = longerName.c_str();
+    TEST_ASSERT_FALSE(discovery->publishSensorDiscovery(longer));
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+    TEST_ASSERT_EQUAL(1, discovery->metrics()[HaMetricCategory::Config].failures);
+
+    // A failed reservation is not remembered: the next replay tries again.
+    TEST_ASSERT_FALSE(discovery->reserveTransportBuffer());
+    transport.bufferLimit = SIZE_MAX;
+    largest = discovery->largestConfigMessage(topic_len, payload_len);
+    transport.onConnectCb(transport.onConnectCtx);
+    TEST_ASSERT_EQUAL(2, transport.bufferAllocations);   // the callback leaves the work to tick()
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, transport.bufferAllocations);
+    TEST_ASSERT_EQUAL(7 + largest, transport.bufferSize);
+}
+
+void test_entity_table_capacity(void) {
+    static HaEntityTable<3, 2> table;
+    TEST_ASSERT_EQUAL(3, table.capacity());
+    TEST_ASSERT_TRUE(discovery->setEntityTable(table));
+
+    HaSensorConfig a, b, c, d;
+    a.common.object_id = "a";
+    b.common.object_id = "b";
+    c.common.object_id = "c";
+    d.common.object_id = "d";
+    TEST_ASSERT_TRUE(discovery->registerSensor(a).valid());
+    HaEntityHandle hb = discovery->registerSensor(b);
+    HaSwitchConfig sw;
+    sw.common.object_id = "relay";
+    HaEntityHandle hs = discovery->registerSwitch(sw);
+    TEST_ASSERT_TRUE(hs.valid());
+    TEST_ASSERT_FALSE(discovery->registerSensor(c).valid());   // full
+    TEST_ASSERT_EQUAL(3, discovery->entityCount());
+    TEST_ASSERT_FALSE(discovery->setEntityTable(table));      // entities already registered
+
+    TEST_ASSERT_EQUAL(hb.index, discovery->entityHandle("b").index);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/b/state", discovery->stateTopic(hb));
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/relay/set", discovery->commandTopic(hs));
+    static int commands = 0;
+    discovery->setCommandHandler(hs, [](void*, HaEntityHandle, const char*, size_t) { commands++; });
+    transport.deliver("devices/test_node/relay/set", "ON");
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, commands);
+
+    // A removed entity frees its slot.
+    TEST_ASSERT_TRUE(discovery->removeEntity("sensor", "a"));
+    HaEntityHandle hc = discovery->registerSensor(c);
+    TEST_ASSERT_TRUE(hc.valid());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/c/state", discovery->stateTopic(hc));
+    TEST_ASSERT_FALSE(discovery->registerSensor(d).valid());
+
+    // Reconnect replays the table.
+    transport.clear();
+    transport.onConnectCb(transport.onConnectCtx);
+    while (discovery->isRepublishing()) {
+        discovery->tick();
+    }
+    TEST_ASSERT_EQUAL(4, transport.messages.size());   // three configs and availability
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/c/config", transport.messages[2].topic.c_str());
+
+    // Room for one more device only.
+    HaDeviceInfo sub;
+    sub.node_id = "sub";
+    TEST_ASSERT_TRUE(discovery->addDevice(sub).valid());
+    sub.node_id = "sub2";
+    TEST_ASSERT_FALSE(discovery->addDevice(sub).valid());
+}
+
+void test_entity_table_topic_pool(void) {
+    static HaEntityTable<4, 1, 64> table;   // room for two 26-byte default topics
+    TEST_ASSERT_TRUE(discovery->setEntityTable(table));
+    HaSensorConfig a, b, c;
+    a.common.object_id = "a";
+    b.common.object_id = "b";
+    c.common.object_id = "c";
+    HaEntityHandle ha = discovery->registerSensor(a);
+    TEST_ASSERT_TRUE(discovery->registerSensor(b).valid());
+    TEST_ASSERT_FALSE(discovery->registerSensor(c).valid());
+    TEST_ASSERT_EQUAL(2, discovery->entityCount());
+
+    // Re-registering rewrites topics in place; a changed topic moves after compaction.
+    TEST_ASSERT_EQUAL(ha.index, discovery->registerSensor(a).index);
+    a.common.state_topic_override = "x/a";
+    TEST_ASSERT_EQUAL(ha.index, discovery->registerSensor(a).index);
+    TEST_ASSERT_EQUAL_STRING("x/a", discovery->stateTopic(ha));
+    a.common.state_topic_override = "x/a/longer/than/before";
+    TEST_ASSERT_TRUE(discovery->registerSensor(a).valid());
+    TEST_ASSERT_EQUAL_STRING("x/a/longer/than/before", discovery->stateTopic(ha));
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/b/state", discovery->stateTopic(discovery->entityHandle("b")));
+}
+
+void test_large_config_is_streamed(void) {
+    std::string longName(1000, 'x');
+    HaSensorConfig cfg;
+    cfg.common.object_id = "big";
+    cfg.common.name = longName.c_str();
+
+    TEST_ASSERT_TRUE(discovery->publishSensorDiscovery(cfg));
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_GREATER_THAN(1, transport.streamWrites);
+    TEST_ASSERT_LESS_OR_EQUAL(64, transport.largestWrite);
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING(longName.c_str(), doc["name"]);
+
+    // Small configs still go through a single publish
+    transport.clear();
+    HaSensorConfig small;
+    small.common.object_id = "small";
+    TEST_ASSERT_TRUE(discovery->publishSensorDiscovery(small));
+    TEST_ASSERT_EQUAL(0, transport.streamWrites);
+}
+
+constexpr HaSensorConfig kStaticTempCfg{
+    {"temp", "Temperature", "mdi:thermometer"}, "°C", "temperature", "measurement"
+};
+HA_STATIC_ENTITY(kStaticTemp, kStaticTempCfg);
+
+constexpr HaSwitchConfig kStaticRelayCfg{{"relay", "Relay \"1\""}};
+HA_STATIC_ENTITY(kStaticRelay, kStaticRelayCfg);
+
+static_assert(sizeof(kStaticRelay.json) == sizeof("\"name\":\"Relay \\\"1\\\"\""),
+              "static entity JSON is sized exactly");
+
+void test_static_entity_discovery(void) {
+    TEST_ASSERT_EQUAL_STRING("\"name\":\"Temperature\",\"icon\":\"mdi:thermometer\",\"unit_of_meas\":\"°C\","
+                             "\"dev_cla\":\"temperature\",\"stat_cla\":\"measurement\"", kStaticTemp.json);
+
+    TEST_ASSERT_TRUE(discovery->publishStaticDiscovery(kStaticTemp));
+    TEST_ASSERT_TRUE(discovery->publishStaticDiscovery(kStaticRelay));
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/temp/config", transport.messages[0].topic.c_str());
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("Temperature", doc["name"]);
+    TEST_ASSERT_EQUAL_STRING("test_node_temp", doc["uniq_id"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/temp/state", doc["stat_t"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", doc["avty_t"]);
+    TEST_ASSERT_EQUAL_STRING("°C", doc["unit_of_meas"]);
+    TEST_ASSERT_EQUAL_STRING("Test Device", doc["dev"]["name"]);
+
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[1].payload));
+    TEST_ASSERT_EQUAL_STRING("Relay \"1\"", doc["name"]);
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/relay/set", doc["cmd_t"]);
+    TEST_ASSERT_EQUAL_STRING("ON", doc["pl_on"]);   // defaults are added when publishing
+    TEST_ASSERT_EQUAL_STRING("OFF", doc["pl_off"]);
+
+    // Replayed from the registry like any other entity
+    transport.clear();
+    discovery->setRepublishPace(10);
+    discovery->republishDiscovery();
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("measurement", doc["stat_cla"]);
+}
+
+constexpr const char* kStaticFanModes[] = { "low", "high", nullptr };
+constexpr const char* kStaticColorModes[] = { "brightness", nullptr };
+constexpr const char* kStaticHvacModes[] = { "off", "heat", nullptr };
+
+constexpr HaNumberConfig kStaticIntervalCfg{{"interval", "Interval"}, nullptr, "s", nullptr, "box", 0.5f, 60.0f, 1.0f};
+HA_STATIC_ENTITY(kStaticInterval, kStaticIntervalCfg);
+constexpr HaSelectConfig kStaticFanCfg{{"fan"}, nullptr, kStaticFanModes};
+HA_STATIC_ENTITY(kStaticFan, kStaticFanCfg);
+constexpr HaLightConfig kStaticLampCfg{{"lamp"}, nullptr, kStaticColorModes, 255};
+HA_STATIC_ENTITY(kStaticLamp, kStaticLampCfg);
+constexpr HaCoverConfig kStaticGarageCfg{{"garage"}, nullptr, "garage", "UP", nullptr, nullptr, nullptr, nullptr};
+HA_STATIC_ENTITY(kStaticGarage, kStaticGarageCfg);
+constexpr HaClimateConfig kStaticThermostatCfg{
+    {"thermostat"}, nullptr, kStaticHvacModes, "devices/test_node/thermostat/target/set", nullptr, nullptr, "F",
+    7.0f, 35.0f, 0.5f
+};
+HA_STATIC_ENTITY(kStaticThermostat, kStaticThermostatCfg);
+
+// A compile-time entity publishes the same members as a runtime one built from its config.
+template <typename Entity, typename Build>
+static void checkStaticMatchesRuntime(const char* component, const Entity& entity, Build build) {
+    char json[768];
+    TEST_ASSERT_TRUE((discovery->*build)(json, sizeof(json), entity.config));
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->publishStaticDiscovery(entity));
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_EQUAL(strlen(json), transport.messages[0].payload.size());
+    TEST_ASSERT_TRUE(discovery->removeEntity(component, entity.config.common.object_id));
+}
+
+void test_static_entity_all_components(void) {
+    TEST_ASSERT_EQUAL_STRING("\"name\":\"fan\",\"ops\":[\"low\",\"high\"]", kStaticFan.json);
+    TEST_ASSERT_EQUAL_STRING("\"name\":\"lamp\",\"schema\":\"json\",\"sup_clrm\":[\"brightness\"]", kStaticLamp.json);
+    TEST_ASSERT_EQUAL_STRING("\"name\":\"garage\",\"pl_open\":\"UP\",\"dev_cla\":\"garage\"", kStaticGarage.json);
+
+    for (HaConfigFormat format : { HaConfigFormat::Full, HaConfigFormat::Compact }) {
+        discovery->setConfigFormat(format);
+        checkStaticMatchesRuntime("sensor", kStaticTemp, &HaDiscovery::buildSensorConfigJson);
+        checkStaticMatchesRuntime("switch", kStaticRelay, &HaDiscovery::buildSwitchConfigJson);
+        checkStaticMatchesRuntime("number", kStaticInterval, &HaDiscovery::buildNumberConfigJson);
+        checkStaticMatchesRuntime("select", kStaticFan, &HaDiscovery::buildSelectConfigJson);
+        checkStaticMatchesRuntime("light", kStaticLamp, &HaDiscovery::buildLightConfigJson);
+        checkStaticMatchesRuntime("cover", kStaticGarage, &HaDiscovery::buildCoverConfigJson);
+        checkStaticMatchesRuntime("climate", kStaticThermostat, &HaDiscovery::buildClimateConfigJson);
+    }
+
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->publishStaticDiscovery(kStaticThermostat));
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[0].payload));
+    TEST_ASSERT_EQUAL_STRING("homeassistant/climate/test_node/thermostat/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("~/thermostat/target/set", doc["temp_cmd_t"]);
+    TEST_ASSERT_EQUAL_STRING("heat", doc["modes"][1]);
+    TEST_ASSERT_TRUE(doc["temp_step"].as<float>() == 0.5f);
+    TEST_ASSERT_TRUE(doc["max_temp"].as<float>() == 35.0f);   // °F: not the °C default, kept in compact
+}
+
 // Support for native environment where setup/loop might not be enough for unity runner
+void test_publish_numeric_state(void) {
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaEntityHandle h = discovery->registerSensor(temp);
+
+    TEST_ASSERT_TRUE(discovery->publishState("temp", 21.456f));
+    TEST_ASSERT_TRUE(discovery->publishState("temp", 21.456f, 1));
+    TEST_ASSERT_TRUE(discovery->publishState(h, -3));
+    TEST_ASSERT_TRUE(discovery->publishState(h, static_cast<uint32_t>(4000000000u)));
+    TEST_ASSERT_TRUE(discovery->publishState(h, 0.5, 0));
+    TEST_ASSERT_TRUE(discovery->publishState("temp", static_cast<uint8_t>(7)));
+    TEST_ASSERT_EQUAL(6, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/temp/state", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("21.46", transport.messages[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("21.5", transport.messages[1].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("-3", transport.messages[2].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("4000000000", transport.messages[3].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("0", transport.messages[4].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("7", transport.messages[5].payload.c_str());
+}
+
+struct CommandLog {
+    std::vector<std::string> entries;
+};
+
+static void recordCommand(void* ctx, HaEntityHandle handle, const char* payload, size_t len) {
+    char line[64];
+    snprintf(line, sizeof(line), "%u:%s:%u", (unsigned)handle.index, payload, (unsigned)len);
+    static_cast<CommandLog*>(ctx)->entries.push_back(line);
+}
+
+static void recordUnhandled(void* ctx, const char* topic, const uint8_t*, size_t) {
+    static_cast<CommandLog*>(ctx)->entries.push_back(topic);
+}
+
+void test_command_dispatch(void) {
+    CommandLog log;
+    HaEntityHandle handles[40];
+    static char ids[40][12];
+    for (int i = 0; i < 40; i++) {
+        snprintf(ids[i], sizeof(ids[i]), "relay%d", i);
+        HaSwitchConfig cfg;
+        cfg.common.object_id = ids[i];
+        handles[i] = discovery->registerSwitch(cfg);
+        TEST_ASSERT_TRUE(discovery->setCommandHandler(handles[i], &recordCommand, &log));
+    }
+    HaButtonConfig restart;
+    restart.common.object_id = "restart";
+    restart.command_topic_override = "custom/restart";
+    HaEntityHandle b = discovery->registerButton(restart);
+    TEST_ASSERT_TRUE(discovery->setCommandHandler(b, &recordCommand, &log));
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    TEST_ASSERT_FALSE(discovery->setCommandHandler(discovery->registerSensor(temp), &recordCommand, &log));
+
+    // One wildcard for the node plus the override, renewed on reconnect.
+    TEST_ASSERT_EQUAL(2, transport.subscriptions.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/+/set", transport.subscriptions[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("custom/restart", transport.subscriptions[1].c_str());
+    transport.subscriptions.clear();
+    transport.onConnectCb(transport.onConnectCtx);
+    TEST_ASSERT_EQUAL(0, transport.subscriptions.size());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, transport.subscriptions.size());
+
+    discovery->setOnUnhandledMessage(&recordUnhandled, &log);
+    transport.deliver("devices/test_node/relay17/set", "ON");
+    transport.deliver("custom/restart", "PRESS");
+    transport.deliver("devices/test_node/unknown/set", "ON");
+    TEST_ASSERT_EQUAL(0, log.entries.size());   // queued by the transport's callback for tick()
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, log.entries.size());
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%u:ON:2", (unsigned)handles[17].index);
+    TEST_ASSERT_EQUAL_STRING(expected, log.entries[0].c_str());
+    snprintf(expected, sizeof(expected), "%u:PRESS:5", (unsigned)b.index);
+    TEST_ASSERT_EQUAL_STRING(expected, log.entries[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/unknown/set", log.entries[2].c_str());
+
+    // Removed entities and cleared handlers no longer receive commands.
+    discovery->removeEntity("switch", "relay17");
+    discovery->setCommandHandler(handles[3], nullptr);
+    log.entries.clear();
+    transport.deliver("devices/test_node/relay17/set", "OFF");
+    transport.deliver("devices/test_node/relay3/set", "OFF");
+    transport.deliver("devices/test_node/relay39/set", "OFF");
+    discovery->tick();
+    TEST_ASSERT_EQUAL(3, log.entries.size());
+    snprintf(expected, sizeof(expected), "%u:OFF:3", (unsigned)handles[39].index);
+    TEST_ASSERT_EQUAL_STRING(expected, log.entries[2].c_str());
+
+    // A handler set again is found; replacing one keeps a single index entry.
+    TEST_ASSERT_TRUE(discovery->setCommandHandler(handles[3], &recordCommand, &log));
+    TEST_ASSERT_TRUE(discovery->setCommandHandler(handles[39], &recordCommand, &log));
+    discovery->setOnUnhandledMessage(nullptr, nullptr);
+    log.entries.clear();
+    transport.deliver("devices/test_node/relay3/set", "ON");
+    transport.deliver("devices/test_node/relay39/set", "ON");
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, log.entries.size());
+    snprintf(expected, sizeof(expected), "%u:ON:2", (unsigned)handles[3].index);
+    TEST_ASSERT_EQUAL_STRING(expected, log.entries[0].c_str());
+
+    // Four messages wait for tick(); a fifth is dropped. Payloads too large for a command are
+    // passed on to the unhandled callback right away.
+    log.entries.clear();
+    for (int i = 0; i < 5; i++) {
+        transport.deliver("devices/test_node/relay3/set", "ON");
+    }
+    discovery->setOnUnhandledMessage(&recordUnhandled, &log);
+    std::string large(200, 'x');
+    transport.deliver("custom/large", large.c_str());
+    TEST_ASSERT_EQUAL(1, log.entries.size());
+    TEST_ASSERT_EQUAL_STRING("custom/large", log.entries[0].c_str());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, log.entries.size());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, log.entries.size());
+}
+
+void test_state_filter_deadband_and_heartbeat(void) {
+    fakeNow = 1000;
+    discovery->setClock(&fakeMillis);
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaEntityHandle h = discovery->registerSensor(temp);
+    HaStateFilter filter;
+    filter.abs_deadband = 0.5f;
+    filter.heartbeat_ms = 60000;
+    TEST_ASSERT_TRUE(discovery->setStateFilter(h, filter));
+
+    TEST_ASSERT_TRUE(discovery->publishState(h, "21.0"));
+    TEST_ASSERT_TRUE(discovery->publishState(h, "21.3"));   // within deadband
+    TEST_ASSERT_TRUE(discovery->publishState(h, "21.4"));   // still measured against 21.0
+    TEST_ASSERT_TRUE(discovery->publishState(h, "21.6"));
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("21.6", transport.messages[1].payload.c_str());
+
+    fakeNow += 60000;
+    TEST_ASSERT_TRUE(discovery->publishState("temp", "21.6"));  // heartbeat, via object_id
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+
+    HaStateStats stats = discovery->stateStats(h);
+    TEST_ASSERT_EQUAL(3, stats.sent);
+    TEST_ASSERT_EQUAL(2, stats.suppressed);
+
+    // Unchanged non-numeric payloads are suppressed; the first state after a reconnect is not.
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    HaEntityHandle r = discovery->registerSwitch(relay);
+    discovery->setStateFilter(r, HaStateFilter());
+    transport.clear();
+    discovery->publishStateSwitch(r, true);
+    discovery->publishStateSwitch(r, true);
+    discovery->publishStateSwitch(r, false);
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+
+    transport.onConnectCb(transport.onConnectCtx);
+    discovery->tick();
+    transport.clear();
+    discovery->publishStateSwitch(r, false);
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+
+    discovery->clearStateFilter(r);
+    discovery->publishStateSwitch(r, false);
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+
+    HaStateStats total = discovery->stateStats();
+    TEST_ASSERT_EQUAL(7, total.sent);
+    TEST_ASSERT_EQUAL(3, total.suppressed);
+}
+
+void test_metrics_counters_and_sensors(void) {
+    fakeNow = 1000;
+    discovery->setClock(&fakeMillis);
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaEntityHandle h = discovery->registerSensor(temp);
+    HaButtonConfig btn;
+    btn.common.object_id = "reboot";
+    HaEntityHandle b = discovery->registerButton(btn);
+    discovery->setCommandHandler(b, [](void*, HaEntityHandle, const char*, size_t) {});
+    discovery->publishAvailabilityOnline();
+    TEST_ASSERT_TRUE(discovery->publishSensorDiscovery(temp));
+    TEST_ASSERT_TRUE(discovery->publishState(h, 21.5f, 1));
+    TEST_ASSERT_TRUE(discovery->pressButton("reboot"));
+    transport.deliver("devices/test_node/reboot/set", "PRESS");
+    discovery->tick();
+    transport.failPublish = true;
+    TEST_ASSERT_FALSE(discovery->publishState(h, "22"));
+    transport.failPublish = false;
+
+    HaMetrics m = discovery->metrics();
+    TEST_ASSERT_EQUAL(1, m[HaMetricCategory::Availability].messages);
+    TEST_ASSERT_EQUAL(6, m[HaMetricCategory::Availability].bytes);
+    TEST_ASSERT_EQUAL(1, m[HaMetricCategory::Config].messages);
+    TEST_ASSERT_EQUAL(transport.messages[1].payload.size(), m[HaMetricCategory::Config].bytes);
+    TEST_ASSERT_EQUAL(1, m[HaMetricCategory::State].messages);
+    TEST_ASSERT_EQUAL(4, m[HaMetricCategory::State].bytes);
+    TEST_ASSERT_EQUAL(1, m[HaMetricCategory::State].failures);
+    TEST_ASSERT_EQUAL(1, m[HaMetricCategory::Command].messages);
+    TEST_ASSERT_EQUAL(1, m.commands_received);
+    TEST_ASSERT_EQUAL(5, m.command_bytes_received);
+    TEST_ASSERT_EQUAL(4, m.totalMessages());
+    TEST_ASSERT_EQUAL(1, m.totalFailures());
+    TEST_ASSERT_EQUAL(transport.messages[1].payload.size() + 4, m.formatted_bytes);
+    TEST_ASSERT_EQUAL(transport.messages[1].payload.size(), m.largest_config);
+    TEST_ASSERT_EQUAL(768, m.config_buffer);
+    TEST_ASSERT_EQUAL(0, m.streamed_configs);
+    uint32_t calls = 0;
+    for (uint32_t n : m.publish_time_histogram) {
+        calls += n;
+    }
+    TEST_ASSERT_EQUAL(5, calls);
+
+    discovery->resetMetrics();
+    TEST_ASSERT_EQUAL(0, discovery->metrics().totalMessages());
+
+    // Diagnostic sensors: configs right away, states from tick() at the interval.
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->enableMetricsSensors(60000));
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/ha_messages/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_TRUE(transport.messages[0].payload.find("\"ent_cat\":\"diagnostic\"") != std::string::npos);
+
+    transport.clear();
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/ha_messages/state", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("5", transport.messages[0].payload.c_str());
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    fakeNow += 60000;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(10, transport.messages.size());
+
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->enableMetricsSensors(0));
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+    TEST_ASSERT_EQUAL(0, transport.messages[0].payload.size());
+    fakeNow += 60000;
+    discovery->tick();
+    TEST_ASSERT_EQUAL(5, transport.messages.size());
+}
+
+void test_bridge_devices_share_one_transport(void) {
+    CommandLog log;
+    static char nodes[3][12];
+    HaDeviceHandle meters[3];
+    HaEntityHandle energy[3];
+    for (int i = 0; i < 3; i++) {
+        snprintf(nodes[i], sizeof(nodes[i]), "meter_%d", i);
+        HaDeviceInfo dev;
+        dev.node_id = nodes[i];
+        dev.model = "Modbus meter";
+        meters[i] = discovery->addDevice(dev);
+        TEST_ASSERT_TRUE(meters[i].valid());
+        HaSensorConfig cfg;
+        cfg.common.object_id = "energy";   // same object_id on every device
+        energy[i] = discovery->registerSensor(meters[i], cfg);
+        TEST_ASSERT_TRUE(energy[i].valid());
+    }
+    TEST_ASSERT_EQUAL(4, discovery->deviceCount());
+    TEST_ASSERT_EQUAL(meters[1].index, discovery->deviceHandle("meter_1").index);
+    TEST_ASSERT_EQUAL(energy[2].index, discovery->entityHandle(meters[2], "energy").index);
+    TEST_ASSERT_FALSE(discovery->entityHandle("energy").valid());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_1/energy/state", discovery->stateTopic(energy[1]));
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    discovery->registerSensor(temp);
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay";
+    HaEntityHandle r = discovery->registerSwitch(meters[1], relay);
+    TEST_ASSERT_TRUE(discovery->setCommandHandler(r, &recordCommand, &log));
+
+    // Connect: each device's configs, then its availability; the gateway's availability last.
+    transport.clear();
+    discovery->setRepublishPace(3);
+    transport.onConnectCb(transport.onConnectCtx);
+    TEST_ASSERT_EQUAL(0, transport.messages.size());
+    for (int i = 0; i < 10 && discovery->isRepublishing(); i++) {
+        discovery->tick();
+    }
+    TEST_ASSERT_FALSE(discovery->isRepublishing());
+    TEST_ASSERT_EQUAL(9, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/test_node/temp/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/meter_0/energy/config", transport.messages[1].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_0/status", transport.messages[2].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("online", transport.messages[2].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/switch/meter_1/relay/config", transport.messages[4].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_1/status", transport.messages[5].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", transport.messages[8].topic.c_str());
+
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[1].payload));
+    TEST_ASSERT_EQUAL_STRING("meter_0_energy", doc["uniq_id"]);
+    TEST_ASSERT_EQUAL_STRING("devices/meter_0/energy/state", doc["stat_t"]);
+    TEST_ASSERT_TRUE(doc["avty_t"].isNull());
+    TEST_ASSERT_EQUAL_STRING("devices/test_node/status", doc["avty"][0]["t"]);
+    TEST_ASSERT_EQUAL_STRING("devices/meter_0/status", doc["avty"][1]["t"]);
+    TEST_ASSERT_EQUAL_STRING("all", doc["avty_mode"]);
+    TEST_ASSERT_EQUAL_STRING("meter_0", doc["dev"]["ids"][0]);
+    TEST_ASSERT_EQUAL_STRING("Modbus meter", doc["dev"]["mdl"]);
+    TEST_ASSERT_EQUAL_STRING("test_mac", doc["dev"]["via_device"]);
+
+    // Commands: one wildcard per device with handlers, dispatched through the shared index.
+    TEST_ASSERT_EQUAL(1, transport.subscriptions.size());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_1/+/set", transport.subscriptions[0].c_str());
+    transport.deliver("devices/meter_1/relay/set", "ON");
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, log.entries.size());
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%u:ON:2", (unsigned)r.index);
+    TEST_ASSERT_EQUAL_STRING(expected, log.entries[0].c_str());
+
+    // Per-device state, availability and removal.
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->publishState(energy[2], 1234.5f, 1));
+    discovery->publishAvailabilityOffline(meters[2]);
+    TEST_ASSERT_TRUE(discovery->removeEntity(meters[1], "sensor", "energy"));
+    TEST_ASSERT_EQUAL(3, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_2/energy/state", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("devices/meter_2/status", transport.messages[1].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("offline", transport.messages[1].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/meter_1/energy/config", transport.messages[2].topic.c_str());
+    TEST_ASSERT_FALSE(discovery->entityHandle(meters[1], "energy").valid());
+    TEST_ASSERT_TRUE(discovery->entityHandle(meters[0], "energy").valid());
+    TEST_ASSERT_FALSE(discovery->registerSensor(HaDeviceHandle(99), temp).valid());
+}
+
+void test_bridge_device_mode_publishes_changed_devices(void) {
+    discovery->setDiscoveryMode(HaDiscoveryMode::Device);
+    HaDeviceInfo a;
+    a.node_id = "meter_a";
+    HaDeviceInfo b;
+    b.node_id = "meter_b";
+    HaDeviceHandle da = discovery->addDevice(a);
+    HaDeviceHandle db = discovery->addDevice(b);
+    TEST_ASSERT_EQUAL(2, transport.messages.size());   // availability, as the transport is connected
+    TEST_ASSERT_EQUAL_STRING("devices/meter_b/status", transport.messages[1].topic.c_str());
+    transport.clear();
+    HaSensorConfig power;
+    power.common.object_id = "power";
+    discovery->publishSensorDiscovery(da, power);
+    discovery->publishSensorDiscovery(db, power);
+    discovery->setRepublishPace(10);
+    discovery->tick();
+    TEST_ASSERT_EQUAL(2, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/meter_a/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/meter_b/config", transport.messages[1].topic.c_str());
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, transport.messages[1].payload));
+    TEST_ASSERT_EQUAL_STRING("devices/meter_b/status", doc["avty"][1]["t"]);
+    TEST_ASSERT_EQUAL_STRING("devices/meter_b/power/state", doc["cmps"]["power"]["stat_t"]);
+
+    // Only the device that changed is published again.
+    transport.clear();
+    HaSensorConfig voltage;
+    voltage.common.object_id = "voltage";
+    discovery->publishSensorDiscovery(db, voltage);
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    TEST_ASSERT_EQUAL_STRING("homeassistant/device/meter_b/config", transport.messages[0].topic.c_str());
+    TEST_ASSERT_TRUE(discovery->isDiscoveryDelivered());
+
+    transport.clear();
+    TEST_ASSERT_TRUE(discovery->removeEntity(da, "sensor", "power"));
+    discovery->tick();
+    TEST_ASSERT_EQUAL(1, transport.messages.size());
+    deserializeJson(doc, transport.messages[0].payload);
+    TEST_ASSERT_EQUAL(1, doc["cmps"]["power"].size());
+}
+
+void test_bridge_scales_to_many_entities(void) {
+    // 200 devices x 10 entities; lookups go through the hash index and the replay covers every device once.
+    static char nodes[200][12];
+    static const char* ids[10] = { "e0", "e1", "e2", "e3", "e4", "e5", "e6", "e7", "e8", "e9" };
+    for (int d = 0; d < 200; d++) {
+        snprintf(nodes[d], sizeof(nodes[d]), "m%d", d);
+        HaDeviceInfo dev;
+        dev.node_id = nodes[d];
+        HaDeviceHandle h = discovery->addDevice(dev);
+        for (int e = 0; e < 10; e++) {
+            HaSensorConfig cfg;
+            cfg.common.object_id = ids[e];
+            TEST_ASSERT_TRUE(discovery->registerSensor(h, cfg).valid());
+        }
+    }
+    TEST_ASSERT_EQUAL(2000, discovery->entityCount());
+    HaEntityHandle h = discovery->entityHandle(discovery->deviceHandle("m137"), "e7");
+    TEST_ASSERT_EQUAL_STRING("devices/m137/e7/state", discovery->stateTopic(h));
+
+    transport.clear();
+    discovery->setRepublishPace(50);
+    transport.onConnectCb(transport.onConnectCtx);
+    int ticks = 0;
+    while (discovery->isRepublishing() && ticks < 1000) {
+        discovery->tick();
+        ticks++;
+    }
+    TEST_ASSERT_EQUAL(1 + 200 + 2000, transport.messages.size());
+    TEST_ASSERT_EQUAL((1 + 200 + 2000 + 49) / 50, ticks);
+}
+
 #if defined(ARDUINO)
 void setup() {
     delay(2000);
@@ -218,6 +1594,32 @@ void setup() {
     RUN_TEST(test_remove_entity);
     RUN_TEST(test_availability);
     RUN_TEST(test_press_button);
+    RUN_TEST(test_reconnect_republishes_registered_configs);
+    RUN_TEST(test_republish_pace_and_replace);
+    RUN_TEST(test_republish_fills_transport_window);
+    RUN_TEST(test_republish_time_and_byte_budget);
+    RUN_TEST(test_manifest_skips_unchanged_and_removes_stale);
+    RUN_TEST(test_metrics_counters_and_sensors);
+    RUN_TEST(test_bridge_devices_share_one_transport);
+    RUN_TEST(test_bridge_device_mode_publishes_changed_devices);
+    RUN_TEST(test_bridge_scales_to_many_entities);
+    RUN_TEST(test_publish_state_by_handle);
+    RUN_TEST(test_publish_numeric_state);
+    RUN_TEST(test_command_dispatch);
+    RUN_TEST(test_json_writer_escaping_and_overflow);
+    RUN_TEST(test_discovery_escapes_names);
+    RUN_TEST(test_device_discovery_single_message);
+    RUN_TEST(test_device_discovery_chunked);
+    RUN_TEST(test_compact_config_format);
+    RUN_TEST(test_additional_components);
+    RUN_TEST(test_last_will_uses_availability_topic);
+    RUN_TEST(test_transport_buffer_sized_to_largest_config);
+    RUN_TEST(test_entity_table_capacity);
+    RUN_TEST(test_entity_table_topic_pool);
+    RUN_TEST(test_large_config_is_streamed);
+    RUN_TEST(test_static_entity_discovery);
+    RUN_TEST(test_static_entity_all_components);
+    RUN_TEST(test_state_filter_deadband_and_heartbeat);
     UNITY_END();
 }
 
@@ -234,6 +1636,32 @@ int main(int argc, char **argv) {
     RUN_TEST(test_remove_entity);
     RUN_TEST(test_availability);
     RUN_TEST(test_press_button);
+    RUN_TEST(test_reconnect_republishes_registered_configs);
+    RUN_TEST(test_republish_pace_and_replace);
+    RUN_TEST(test_republish_fills_transport_window);
+    RUN_TEST(test_republish_time_and_byte_budget);
+    RUN_TEST(test_manifest_skips_unchanged_and_removes_stale);
+    RUN_TEST(test_metrics_counters_and_sensors);
+    RUN_TEST(test_bridge_devices_share_one_transport);
+    RUN_TEST(test_bridge_device_mode_publishes_changed_devices);
+    RUN_TEST(test_bridge_scales_to_many_entities);
+    RUN_TEST(test_publish_state_by_handle);
+    RUN_TEST(test_publish_numeric_state);
+    RUN_TEST(test_command_dispatch);
+    RUN_TEST(test_json_writer_escaping_and_overflow);
+    RUN_TEST(test_discovery_escapes_names);
+    RUN_TEST(test_device_discovery_single_message);
+    RUN_TEST(test_device_discovery_chunked);
+    RUN_TEST(test_compact_config_format);
+    RUN_TEST(test_additional_components);
+    RUN_TEST(test_last_will_uses_availability_topic);
+    RUN_TEST(test_transport_buffer_sized_to_largest_config);
+    RUN_TEST(test_entity_table_capacity);
+    RUN_TEST(test_entity_table_topic_pool);
+    RUN_TEST(test_large_config_is_streamed);
+    RUN_TEST(test_static_entity_discovery);
+    RUN_TEST(test_static_entity_all_components);
+    RUN_TEST(test_state_filter_deadband_and_heartbeat);
     return UNITY_END();
 }
 #endif
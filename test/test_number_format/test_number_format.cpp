@@ -0,0 +1,132 @@
+// Numeric state formatting: haFormat*() correctness against snprintf, and a speed comparison.
+#include <unity.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "HaNumberFormat.h"
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+static uint32_t nowMicros() { return micros(); }
+#else
+#include <chrono>
+static uint32_t nowMicros() {
+    using namespace std::chrono;
+    return static_cast<uint32_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+#endif
+
+#if defined(ARDUINO)
+static const uint32_t kBenchIterations = 20000;
+#else
+static const uint32_t kBenchIterations = 1000000;
+#endif
+
+// Deterministic pseudo-random floats in a typical sensor range, both signs.
+static uint32_t g_seed = 12345;
+static float nextSample() {
+    g_seed = g_seed * 1664525u + 1013904223u;
+    return (static_cast<int32_t>(g_seed >> 8) % 2000000) / 1000.0f - 1000.0f;
+}
+
+static void assertMatchesSnprintf(float v, uint8_t precision) {
+    char expected[64];
+    char actual[HA_NUMBER_BUF];
+    snprintf(expected, sizeof(expected), "%.*f", precision, static_cast<double>(v));
+    size_t n = haFormatFloat(actual, sizeof(actual), v, precision);
+    TEST_ASSERT_EQUAL_STRING(expected, actual);
+    TEST_ASSERT_EQUAL(strlen(expected), n);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_format_integers(void) {
+    char buf[HA_NUMBER_BUF];
+    TEST_ASSERT_EQUAL(1, haFormatInt(buf, sizeof(buf), 0));
+    TEST_ASSERT_EQUAL_STRING("0", buf);
+    haFormatInt(buf, sizeof(buf), -42);
+    TEST_ASSERT_EQUAL_STRING("-42", buf);
+    haFormatInt(buf, sizeof(buf), INT32_MIN);
+    TEST_ASSERT_EQUAL_STRING("-2147483648", buf);
+    haFormatUint(buf, sizeof(buf), UINT32_MAX);
+    TEST_ASSERT_EQUAL_STRING("4294967295", buf);
+
+    char small[4];
+    TEST_ASSERT_EQUAL(0, haFormatInt(small, sizeof(small), 1234));
+    TEST_ASSERT_EQUAL_STRING("", small);
+    TEST_ASSERT_EQUAL(3, haFormatInt(small, sizeof(small), 123));
+}
+
+void test_format_float_matches_snprintf(void) {
+    const float fixed[] = { 0.0f, -0.0f, 0.125f, 0.375f, 2.5f, -2.5f, 21.35f, 99.995f, -0.001f,
+                            1e-7f, 123456.789f, 4294967296.0f, 1e12f, -3.4e9f };
+    for (float v : fixed) {
+        for (uint8_t p = 0; p <= 6; p++) {
+            assertMatchesSnprintf(v, p);
+        }
+    }
+    for (int i = 0; i < 100000; i++) {
+        assertMatchesSnprintf(nextSample(), static_cast<uint8_t>(i % 4));
+    }
+
+    char buf[HA_NUMBER_BUF];
+    haFormatFloat(buf, sizeof(buf), 0.0f / 0.0f, 2);
+    TEST_ASSERT_EQUAL_STRING("nan", buf);
+    haFormatFloat(buf, sizeof(buf), -1.0f / 0.0f, 2);
+    TEST_ASSERT_EQUAL_STRING("-inf", buf);
+    TEST_ASSERT_EQUAL(0, haFormatFloat(buf, sizeof(buf), 1e30f, 2));
+    haFormatFloat(buf, sizeof(buf), 1.5f, 200);
+    TEST_ASSERT_EQUAL_STRING("1.500000000", buf);
+}
+
+void test_format_float_benchmark(void) {
+    static float samples[256];
+    for (float& s : samples) {
+        s = nextSample();
+    }
+    char buf[32];
+    volatile size_t sink = 0;
+
+    uint32_t start = nowMicros();
+    for (uint32_t i = 0; i < kBenchIterations; i++) {
+        sink += snprintf(buf, sizeof(buf), "%.2f", static_cast<double>(samples[i & 255]));
+    }
+    uint32_t snprintfUs = nowMicros() - start;
+
+    start = nowMicros();
+    for (uint32_t i = 0; i < kBenchIterations; i++) {
+        sink += haFormatFloat(buf, sizeof(buf), samples[i & 255], 2);
+    }
+    uint32_t fastUs = nowMicros() - start;
+
+    char line[160];
+    snprintf(line, sizeof(line), "float %%.2f x%u: snprintf %.1f ns/op | haFormatFloat %.1f ns/op (%.1fx)",
+             (unsigned)kBenchIterations,
+             snprintfUs * 1000.0 / kBenchIterations,
+             fastUs * 1000.0 / kBenchIterations,
+             fastUs ? static_cast<double>(snprintfUs) / fastUs : 0.0);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(sink > 0);
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_format_integers);
+    RUN_TEST(test_format_float_matches_snprintf);
+    RUN_TEST(test_format_float_benchmark);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_format_integers);
+    RUN_TEST(test_format_float_matches_snprintf);
+    RUN_TEST(test_format_float_benchmark);
+    return UNITY_END();
+}
+#endif
@@ -0,0 +1,395 @@
+// Peak memory per Discovery payload: HaJsonWriter (current) vs. the former ArduinoJson path,
+// and the bytes saved per component by the compact config format.
+//
+// Heap use is measured by replacing the global operator new/delete. The ArduinoJson
+// reference builders below are the implementations HaDiscovery used before switching
+// to HaJsonWriter; both paths must produce byte-identical payloads.
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <cstring>
+#include "HaDiscovery.h"
+#include "transport/MqttTransport.h"
+#include <ArduinoJson.h>
+#include "../heap_counter.h"
+
+static void resetHeapCounters() {
+    g_heapPeak = g_heapCurrent;
+    g_allocCount = 0;
+}
+
+// Transport that records the last message into static storage, so publishing allocates nothing.
+class CaptureTransport : public MqttTransport {
+public:
+    char topic[256];
+    char payload[1024];
+    size_t len = 0;
+
+    bool connected() const override { return true; }
+
+    bool publish(const char* t, const uint8_t* p, size_t l, bool, uint8_t) override {
+        strncpy(topic, t, sizeof(topic) - 1);
+        topic[sizeof(topic) - 1] = '\0';
+        len = (p && l < sizeof(payload)) ? l : 0;
+        if (len) {
+            memcpy(payload, p, len);
+        }
+        payload[len] = '\0';
+        return true;
+    }
+
+    void setOnConnect(void (*)(void*), void*) override {}
+    void setServer(const char*, uint16_t, const char* = nullptr, const char* = nullptr) override {}
+    void setServer(const std::string&, uint16_t, const std::string& = "", const std::string& = "") override {}
+};
+
+static HaDeviceInfo makeDevice() {
+    HaDeviceInfo dev;
+    dev.node_id = "esp32_kitchen_01";
+    dev.name = "Kitchen Node";
+    dev.identifiers = "a4cf12345678";
+    dev.manufacturer = "YourBrand";
+    dev.model = "ESP32";
+    dev.sw_version = "1.0.0";
+    return dev;
+}
+
+// ---- Former ArduinoJson implementation, kept here as the comparison baseline ----
+
+static const char* kBase = "devices";
+
+static void legacyDevice(JsonDocument& doc, const HaDeviceInfo& d) {
+    JsonObject dev = doc["dev"].to<JsonObject>();
+    JsonArray ids = dev["ids"].to<JsonArray>();
+    ids.add(d.identifiers ? d.identifiers : d.node_id);
+    if (d.name) dev["name"] = d.name;
+    if (d.manufacturer) dev["mf"] = d.manufacturer;
+    if (d.model) dev["mdl"] = d.model;
+    if (d.sw_version) dev["sw"] = d.sw_version;
+}
+
+static std::string legacyTopic(const HaDeviceInfo& d, const char* object_id, const char* suffix) {
+    return std::string(kBase) + "/" + d.node_id + "/" + object_id + "/" + suffix;
+}
+
+static void legacyHeader(JsonDocument& doc, const HaDeviceInfo& d, const HaEntityCommon& c) {
+    doc["name"] = c.name ? c.name : c.object_id;
+    std::string uniq = std::string(d.node_id) + "_" + c.object_id;
+    doc["uniq_id"] = uniq;
+}
+
+static void legacyAvailability(JsonDocument& doc, const std::string& availTopic) {
+    doc["avty_t"] = availTopic;
+    doc["pl_avail"] = "online";
+    doc["pl_not_avail"] = "offline";
+}
+
+static size_t legacySensor(char* out, size_t outLen, const HaDeviceInfo& d, const HaSensorConfig& cfg) {
+    std::string stateTopic = legacyTopic(d, cfg.common.object_id, "state");
+    std::string availTopic = std::string(kBase) + "/" + d.node_id + "/status";
+    JsonDocument doc;
+    legacyHeader(doc, d, cfg.common);
+    doc["stat_t"] = stateTopic;
+    legacyAvailability(doc, availTopic);
+    if (cfg.common.icon) doc["icon"] = cfg.common.icon;
+    if (cfg.unit_of_measurement) doc["unit_of_meas"] = cfg.unit_of_measurement;
+    if (cfg.device_class) doc["dev_cla"] = cfg.device_class;
+    if (cfg.state_class) doc["stat_cla"] = cfg.state_class;
+    legacyDevice(doc, d);
+    return serializeJson(doc, out, outLen);
+}
+
+static size_t legacySwitch(char* out, size_t outLen, const HaDeviceInfo& d, const HaSwitchConfig& cfg) {
+    std::string stateTopic = legacyTopic(d, cfg.common.object_id, "state");
+    std::string cmdTopic = legacyTopic(d, cfg.common.object_id, "set");
+    std::string availTopic = std::string(kBase) + "/" + d.node_id + "/status";
+    JsonDocument doc;
+    legacyHeader(doc, d, cfg.common);
+    doc["stat_t"] = stateTopic;
+    doc["cmd_t"] = cmdTopic;
+    doc["pl_on"] = "ON";
+    doc["pl_off"] = "OFF";
+    legacyAvailability(doc, availTopic);
+    if (cfg.common.icon) doc["icon"] = cfg.common.icon;
+    legacyDevice(doc, d);
+    return serializeJson(doc, out, outLen);
+}
+
+static size_t legacyBinarySensor(char* out, size_t outLen, const HaDeviceInfo& d, const HaBinarySensorConfig& cfg) {
+    std::string stateTopic = legacyTopic(d, cfg.common.object_id, "state");
+    std::string availTopic = std::string(kBase) + "/" + d.node_id + "/status";
+    JsonDocument doc;
+    legacyHeader(doc, d, cfg.common);
+    doc["stat_t"] = stateTopic;
+    legacyAvailability(doc, availTopic);
+    doc["pl_on"] = "ON";
+    doc["pl_off"] = "OFF";
+    if (cfg.common.icon) doc["icon"] = cfg.common.icon;
+    if (cfg.device_class) doc["dev_cla"] = cfg.device_class;
+    legacyDevice(doc, d);
+    return serializeJson(doc, out, outLen);
+}
+
+static size_t legacyButton(char* out, size_t outLen, const HaDeviceInfo& d, const HaButtonConfig& cfg) {
+    std::string cmdTopic = legacyTopic(d, cfg.common.object_id, "set");
+    std::string availTopic = std::string(kBase) + "/" + d.node_id + "/status";
+    JsonDocument doc;
+    legacyHeader(doc, d, cfg.common);
+    doc["cmd_t"] = cmdTopic;
+    doc["pl_prs"] = "PRESS";
+    legacyAvailability(doc, availTopic);
+    if (cfg.common.icon) doc["icon"] = cfg.common.icon;
+    legacyDevice(doc, d);
+    return serializeJson(doc, out, outLen);
+}
+
+// ---- Measurement ----
+
+static const size_t kLegacyStackBuf = 768;
+
+struct Measurement {
+    size_t payloadBytes;
+    size_t heapPeak;
+    size_t allocs;
+};
+
+static Measurement measureWriter(HaDiscovery& ha, CaptureTransport& transport) {
+    resetHeapCounters();
+    size_t base = g_heapCurrent;
+    ha.republishDiscovery();
+    ha.tick();
+    return Measurement{transport.len, g_heapPeak - base, g_allocCount};
+}
+
+template <typename Fn>
+static Measurement measureLegacy(Fn fn, std::string& out) {
+    char json[kLegacyStackBuf];
+    resetHeapCounters();
+    size_t base = g_heapCurrent;
+    size_t n = fn(json, sizeof(json));
+    Measurement m{n, g_heapPeak - base, g_allocCount};
+    out.assign(json, n);
+    return m;
+}
+
+static void report(const char* component, const Measurement& writer, const Measurement& legacy) {
+    char line[200];
+    snprintf(line, sizeof(line),
+             "%-14s payload=%4u B | HaJsonWriter heap peak=%5u B allocs=%3u | ArduinoJson heap peak=%5u B allocs=%3u (+%u B stack)",
+             component, (unsigned)writer.payloadBytes,
+             (unsigned)writer.heapPeak, (unsigned)writer.allocs,
+             (unsigned)legacy.heapPeak, (unsigned)legacy.allocs, (unsigned)kLegacyStackBuf);
+    TEST_MESSAGE(line);
+}
+
+static CaptureTransport transport;
+static HaDiscovery* ha;
+static HaDeviceInfo device;
+
+void setUp(void) {
+    device = makeDevice();
+    ha = new HaDiscovery(transport, "homeassistant", kBase);
+    ha->setLogLevel(LOG_LEVEL_NONE);
+    ha->setDevice(device);
+}
+
+void tearDown(void) {
+    delete ha;
+}
+
+void test_sensor_payload_memory(void) {
+    HaSensorConfig cfg;
+    cfg.common.object_id = "temperature";
+    cfg.common.name = "Kitchen Temperature";
+    cfg.common.icon = "mdi:thermometer";
+    cfg.unit_of_measurement = "°C";
+    cfg.device_class = "temperature";
+    cfg.state_class = "measurement";
+    ha->registerSensor(cfg);
+
+    Measurement w = measureWriter(*ha, transport);
+    std::string legacyJson;
+    Measurement l = measureLegacy([&](char* o, size_t n) { return legacySensor(o, n, device, cfg); }, legacyJson);
+    report("sensor", w, l);
+
+    TEST_ASSERT_EQUAL(0, w.allocs);
+    TEST_ASSERT_EQUAL_STRING(legacyJson.c_str(), transport.payload);
+}
+
+void test_switch_payload_memory(void) {
+    HaSwitchConfig cfg;
+    cfg.common.object_id = "relay1";
+    cfg.common.name = "Kitchen Light";
+    cfg.common.icon = "mdi:lightbulb";
+    ha->registerSwitch(cfg);
+
+    Measurement w = measureWriter(*ha, transport);
+    std::string legacyJson;
+    Measurement l = measureLegacy([&](char* o, size_t n) { return legacySwitch(o, n, device, cfg); }, legacyJson);
+    report("switch", w, l);
+
+    TEST_ASSERT_EQUAL(0, w.allocs);
+    TEST_ASSERT_EQUAL_STRING(legacyJson.c_str(), transport.payload);
+}
+
+void test_binary_sensor_payload_memory(void) {
+    HaBinarySensorConfig cfg;
+    cfg.common.object_id = "motion";
+    cfg.common.name = "Hallway Motion";
+    cfg.device_class = "motion";
+    ha->registerBinarySensor(cfg);
+
+    Measurement w = measureWriter(*ha, transport);
+    std::string legacyJson;
+    Measurement l = measureLegacy([&](char* o, size_t n) { return legacyBinarySensor(o, n, device, cfg); }, legacyJson);
+    report("binary_sensor", w, l);
+
+    TEST_ASSERT_EQUAL(0, w.allocs);
+    TEST_ASSERT_EQUAL_STRING(legacyJson.c_str(), transport.payload);
+}
+
+void test_button_payload_memory(void) {
+    HaButtonConfig cfg;
+    cfg.common.object_id = "restart";
+    cfg.common.name = "Restart Device";
+    cfg.common.icon = "mdi:restart";
+    ha->registerButton(cfg);
+
+    Measurement w = measureWriter(*ha, transport);
+    std::string legacyJson;
+    Measurement l = measureLegacy([&](char* o, size_t n) { return legacyButton(o, n, device, cfg); }, legacyJson);
+    report("button", w, l);
+
+    TEST_ASSERT_EQUAL(0, w.allocs);
+    TEST_ASSERT_EQUAL_STRING(legacyJson.c_str(), transport.payload);
+}
+
+// ---- Compact config format ----
+
+// Value Home Assistant sees for a key of a compact config: `~` expanded, defaults filled in.
+static std::string expandedValue(JsonDocument& compact, const char* component, const char* key) {
+    static const char* const kDefaults[][3] = {
+        { nullptr, "pl_avail", "online" }, { nullptr, "pl_not_avail", "offline" },
+        { "switch", "pl_on", "ON" }, { "switch", "pl_off", "OFF" },
+        { "binary_sensor", "pl_on", "ON" }, { "binary_sensor", "pl_off", "OFF" },
+        { "button", "pl_prs", "PRESS" },
+    };
+    if (compact[key].isNull()) {
+        for (const auto& d : kDefaults) {
+            if ((!d[0] || strcmp(d[0], component) == 0) && strcmp(d[1], key) == 0) {
+                return d[2];
+            }
+        }
+        return "";
+    }
+    const char* raw = compact[key];
+    std::string value = raw;
+    size_t keyLen = strlen(key);
+    if (keyLen > 2 && strcmp(key + keyLen - 2, "_t") == 0 && !value.empty() && value[0] == '~') {
+        const char* base = compact["~"];
+        value = std::string(base) + value.substr(1);
+    }
+    return value;
+}
+
+template <typename Fn>
+static void checkCompact(const char* component, Fn build, size_t& fullTotal, size_t& compactTotal) {
+    char full[kLegacyStackBuf];
+    char compact[kLegacyStackBuf];
+    ha->setConfigFormat(HaConfigFormat::Full);
+    TEST_ASSERT_TRUE(build(full, sizeof(full)));
+    ha->setConfigFormat(HaConfigFormat::Compact);
+    TEST_ASSERT_TRUE(build(compact, sizeof(compact)));
+
+    size_t fullLen = strlen(full);
+    size_t compactLen = strlen(compact);
+    char line[200];
+    snprintf(line, sizeof(line), "%-14s full=%4u B compact=%4u B saved=%4u B (%2u%%)",
+             component, (unsigned)fullLen, (unsigned)compactLen, (unsigned)(fullLen - compactLen),
+             (unsigned)((fullLen - compactLen) * 100 / fullLen));
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(compactLen < fullLen);
+    fullTotal += fullLen;
+    compactTotal += compactLen;
+
+    // Home Assistant sees the same config either way
+    JsonDocument expected;
+    JsonDocument actual;
+    TEST_ASSERT_FALSE(deserializeJson(expected, full));
+    TEST_ASSERT_FALSE(deserializeJson(actual, compact));
+    static const char* const kKeys[] = {
+        "name", "uniq_id", "stat_t", "cmd_t", "avty_t", "pl_avail", "pl_not_avail",
+        "pl_on", "pl_off", "pl_prs", "icon", "unit_of_meas", "dev_cla", "stat_cla",
+    };
+    for (const char* key : kKeys) {
+        const char* want = expected[key];
+        std::string got = expandedValue(actual, component, key);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(want ? want : "", got.c_str(), key);
+    }
+    TEST_ASSERT_EQUAL_STRING(device.identifiers, actual["dev"]["ids"][0]);
+}
+
+void test_compact_payload_size(void) {
+    HaSensorConfig sensor;
+    sensor.common.object_id = "temperature";
+    sensor.common.name = "Kitchen Temperature";
+    sensor.common.icon = "mdi:thermometer";
+    sensor.unit_of_measurement = "°C";
+    sensor.device_class = "temperature";
+    sensor.state_class = "measurement";
+    HaSwitchConfig sw;
+    sw.common.object_id = "relay1";
+    sw.common.name = "Kitchen Light";
+    sw.common.icon = "mdi:lightbulb";
+    HaBinarySensorConfig binary;
+    binary.common.object_id = "motion";
+    binary.common.name = "Hallway Motion";
+    binary.device_class = "motion";
+    HaButtonConfig button;
+    button.common.object_id = "restart";
+    button.common.name = "Restart Device";
+    button.common.icon = "mdi:restart";
+
+    size_t fullTotal = 0;
+    size_t compactTotal = 0;
+    checkCompact("sensor", [&](char* o, size_t n) { return ha->buildSensorConfigJson(o, n, sensor); },
+                 fullTotal, compactTotal);
+    checkCompact("switch", [&](char* o, size_t n) { return ha->buildSwitchConfigJson(o, n, sw); },
+                 fullTotal, compactTotal);
+    checkCompact("binary_sensor", [&](char* o, size_t n) { return ha->buildBinarySensorConfigJson(o, n, binary); },
+                 fullTotal, compactTotal);
+    checkCompact("button", [&](char* o, size_t n) { return ha->buildButtonConfigJson(o, n, button); },
+                 fullTotal, compactTotal);
+
+    char line[200];
+    snprintf(line, sizeof(line), "%-14s full=%4u B compact=%4u B saved=%4u B (%2u%%)",
+             "total", (unsigned)fullTotal, (unsigned)compactTotal, (unsigned)(fullTotal - compactTotal),
+             (unsigned)((fullTotal - compactTotal) * 100 / fullTotal));
+    TEST_MESSAGE(line);
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_sensor_payload_memory);
+    RUN_TEST(test_switch_payload_memory);
+    RUN_TEST(test_binary_sensor_payload_memory);
+    RUN_TEST(test_button_payload_memory);
+    RUN_TEST(test_compact_payload_size);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sensor_payload_memory);
+    RUN_TEST(test_switch_payload_memory);
+    RUN_TEST(test_binary_sensor_payload_memory);
+    RUN_TEST(test_button_payload_memory);
+    RUN_TEST(test_compact_payload_size);
+    return UNITY_END();
+}
+#endif
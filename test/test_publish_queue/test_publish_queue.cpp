@@ -0,0 +1,130 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <cstring>
+#include "transport/MqttPublishQueue.h"
+
+static MqttPublishQueue* queue;
+
+static bool pushText(const char* topic, const char* payload, bool retained = false, uint8_t qos = 0) {
+    return queue->push(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained, qos);
+}
+
+static void assertPop(const char* expected) {
+    MqttPublishQueue::Entry e;
+    TEST_ASSERT_TRUE(queue->front(e));
+    std::string payload(reinterpret_cast<const char*>(e.payload), e.len);
+    TEST_ASSERT_EQUAL_STRING(expected, payload.c_str());
+    queue->pop();
+}
+
+void setUp(void) {
+    queue = new MqttPublishQueue();
+}
+
+void tearDown(void) {
+    delete queue;
+}
+
+void test_disabled_queue_rejects(void) {
+    TEST_ASSERT_FALSE(queue->enabled());
+    TEST_ASSERT_FALSE(pushText("t", "x"));
+    TEST_ASSERT_EQUAL(1, queue->dropped());
+}
+
+void test_fifo_and_entry_fields(void) {
+    queue->setLimits(256, 0, MqttQueueDropPolicy::DropNewest);
+    TEST_ASSERT_TRUE(queue->push("a/state", reinterpret_cast<const uint8_t*>("1"), 1, true, 1, 42));
+    TEST_ASSERT_TRUE(queue->push("b/config", nullptr, 0, true, 1));
+    TEST_ASSERT_EQUAL(2, queue->size());
+
+    MqttPublishQueue::Entry e;
+    TEST_ASSERT_TRUE(queue->front(e));
+    TEST_ASSERT_EQUAL_STRING("a/state", e.topic);
+    TEST_ASSERT_EQUAL(1, e.len);
+    TEST_ASSERT_TRUE(e.retained);
+    TEST_ASSERT_EQUAL(1, e.qos);
+    TEST_ASSERT_EQUAL(42, e.tag);
+    queue->pop();
+
+    TEST_ASSERT_TRUE(queue->front(e));
+    TEST_ASSERT_EQUAL_STRING("b/config", e.topic);
+    TEST_ASSERT_EQUAL(0, e.len);
+    queue->pop();
+    TEST_ASSERT_FALSE(queue->front(e));
+    TEST_ASSERT_EQUAL(0, queue->bytes());
+}
+
+void test_drop_newest_and_entry_limit(void) {
+    queue->setLimits(1024, 2, MqttQueueDropPolicy::DropNewest);
+    TEST_ASSERT_TRUE(pushText("t", "1"));
+    TEST_ASSERT_TRUE(pushText("t", "2"));
+    TEST_ASSERT_FALSE(pushText("t", "3"));
+    TEST_ASSERT_EQUAL(1, queue->dropped());
+    assertPop("1");
+    assertPop("2");
+}
+
+void test_drop_oldest_evicts_until_fit(void) {
+    queue->setLimits(64, 0, MqttQueueDropPolicy::DropOldest);
+    static uint32_t evicted = 0;
+    queue->setEvictCallback([](void*, uint32_t tag) { evicted = tag; }, nullptr);
+    // Each entry is 16 bytes of header + "t\0" + 10 bytes, rounded to 28.
+    TEST_ASSERT_TRUE(queue->push("t", reinterpret_cast<const uint8_t*>("0123456789"), 10, false, 0, 7));
+    TEST_ASSERT_TRUE(pushText("t", "abcdefghij"));
+    TEST_ASSERT_TRUE(pushText("t", "ABCDEFGHIJ"));
+    TEST_ASSERT_EQUAL(1, queue->dropped());
+    TEST_ASSERT_EQUAL(7, evicted);
+    TEST_ASSERT_EQUAL(2, queue->size());
+    assertPop("abcdefghij");
+    assertPop("ABCDEFGHIJ");
+
+    // Larger than the whole buffer: rejected without evicting anything.
+    TEST_ASSERT_TRUE(pushText("t", "keep"));
+    std::string big(100, 'x');
+    TEST_ASSERT_FALSE(pushText("t", big.c_str()));
+    TEST_ASSERT_EQUAL(1, queue->size());
+}
+
+void test_wraps_around_buffer_end(void) {
+    // Entries of varying size with one always queued, so writes keep wrapping past the end.
+    queue->setLimits(128, 0, MqttQueueDropPolicy::DropNewest);
+    const char* digits = "0123456789abcdef";
+    std::string prev(1, 'x');
+    TEST_ASSERT_TRUE(pushText("topic", prev.c_str()));
+    for (int i = 1; i < 200; i++) {
+        std::string next(digits, 1 + i % 13);
+        TEST_ASSERT_TRUE(pushText("topic", next.c_str()));
+        assertPop(prev.c_str());
+        prev = next;
+    }
+    assertPop(prev.c_str());
+    TEST_ASSERT_EQUAL(0, queue->size());
+    TEST_ASSERT_EQUAL(0, queue->bytes());
+    TEST_ASSERT_EQUAL(0, queue->dropped());
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_disabled_queue_rejects);
+    RUN_TEST(test_fifo_and_entry_fields);
+    RUN_TEST(test_drop_newest_and_entry_limit);
+    RUN_TEST(test_drop_oldest_evicts_until_fit);
+    RUN_TEST(test_wraps_around_buffer_end);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_disabled_queue_rejects);
+    RUN_TEST(test_fifo_and_entry_fields);
+    RUN_TEST(test_drop_newest_and_entry_limit);
+    RUN_TEST(test_drop_oldest_evicts_until_fit);
+    RUN_TEST(test_wraps_around_buffer_end);
+    return UNITY_END();
+}
+#endif
@@ -0,0 +1,208 @@
+#include <unity.h>
+#include <string>
+#include <vector>
+#include <cstring>
+#include "HaDiscovery.h"
+#include "transport/RateLimitedTransport.h"
+
+static uint32_t fakeNow = 0;
+static uint32_t fakeMillis() {
+    return fakeNow;
+}
+
+// Transport that records what the rate limiter lets through.
+class RecordingTransport : public MqttTransport {
+public:
+    std::vector<std::string> topics;
+    bool isConnected = true;
+    void (*onConnectCb)(void*) = nullptr;
+    void* onConnectCtx = nullptr;
+
+    bool connected() const override { return isConnected; }
+
+    bool publish(const char* topic, const uint8_t*, size_t, bool, uint8_t) override {
+        topics.push_back(topic);
+        return true;
+    }
+
+    void setOnConnect(void (*cb)(void*), void* ctx) override {
+        onConnectCb = cb;
+        onConnectCtx = ctx;
+    }
+
+    void setServer(const char*, uint16_t, const char* = nullptr, const char* = nullptr) override {}
+    void setServer(const std::string&, uint16_t, const std::string& = "", const std::string& = "") override {}
+};
+
+static RecordingTransport* inner;
+static RateLimitedTransport* limiter;
+
+static bool send(const char* topic, MqttPriority priority = MqttPriority::Normal) {
+    limiter->setPublishPriority(priority);
+    return limiter->publish(topic, reinterpret_cast<const uint8_t*>("x"), 1, false, 0);
+}
+
+void setUp(void) {
+    fakeNow = 1000;
+    inner = new RecordingTransport();
+    limiter = new RateLimitedTransport(*inner, 10, 2);
+    limiter->setClock(&fakeMillis);
+}
+
+void tearDown(void) {
+    delete limiter;
+    delete inner;
+}
+
+void test_burst_then_refill(void) {
+    TEST_ASSERT_TRUE(send("a"));
+    TEST_ASSERT_TRUE(send("b"));
+    TEST_ASSERT_TRUE(send("c"));   // no token left: deferred, still accepted
+    TEST_ASSERT_EQUAL(2, inner->topics.size());
+    TEST_ASSERT_EQUAL(1, limiter->queueDepth());
+    TEST_ASSERT_EQUAL(0, limiter->publishWindow());
+    TEST_ASSERT_EQUAL(1, limiter->pendingPublishes());
+
+    fakeNow += 50;                  // half a token at 10 messages/s
+    limiter->tick();
+    TEST_ASSERT_EQUAL(2, inner->topics.size());
+
+    fakeNow += 50;
+    limiter->tick();
+    TEST_ASSERT_EQUAL(3, inner->topics.size());
+    TEST_ASSERT_EQUAL_STRING("c", inner->topics[2].c_str());
+
+    MqttRateStats s = limiter->rateStats();
+    TEST_ASSERT_EQUAL(3, s[MqttPriority::Normal].sent);
+    TEST_ASSERT_EQUAL(1, s[MqttPriority::Normal].deferred);
+    TEST_ASSERT_EQUAL(100, s[MqttPriority::Normal].maxWaitMs);
+    TEST_ASSERT_EQUAL(100, s[MqttPriority::Normal].avgWaitMs);
+
+    // The bucket never holds more than the burst.
+    fakeNow += 10000;
+    TEST_ASSERT_EQUAL(2, limiter->publishWindow());
+}
+
+void test_higher_priority_goes_first(void) {
+    send("config1", MqttPriority::Low);
+    send("config2", MqttPriority::Low);
+    send("config3", MqttPriority::Low);
+    send("state", MqttPriority::Normal);
+    send("status", MqttPriority::High);
+    TEST_ASSERT_EQUAL(2, inner->topics.size());
+
+    // One token per 100 ms: availability, then the state, then the waiting config.
+    const char* expected[] = { "status", "state", "config3" };
+    for (const char* topic : expected) {
+        fakeNow += 100;
+        limiter->tick();
+        TEST_ASSERT_EQUAL_STRING(topic, inner->topics.back().c_str());
+    }
+
+    // A message does not overtake one of its own priority that is still waiting.
+    send("s1");
+    send("s2");
+    send("s3");
+    TEST_ASSERT_EQUAL(5, inner->topics.size());
+    fakeNow += 200;                 // two tokens: s1 and s2 go, s4 waits behind s3
+    TEST_ASSERT_TRUE(send("s4"));
+    TEST_ASSERT_EQUAL(7, inner->topics.size());
+    TEST_ASSERT_EQUAL_STRING("s1", inner->topics[5].c_str());
+    TEST_ASSERT_EQUAL_STRING("s2", inner->topics[6].c_str());
+
+    MqttRateStats s = limiter->rateStats();
+    TEST_ASSERT_EQUAL(1, s[MqttPriority::High].deferred);
+    TEST_ASSERT_EQUAL(100, s[MqttPriority::High].maxWaitMs);
+    TEST_ASSERT_EQUAL(300, s[MqttPriority::Low].maxWaitMs);
+    TEST_ASSERT_EQUAL(2, s[MqttPriority::Normal].queued);
+}
+
+void test_bounded_queues_drop(void) {
+    limiter->setQueueLimits(MqttPriority::Normal, 1024, 2, MqttQueueDropPolicy::DropOldest);
+    limiter->setQueueLimits(MqttPriority::Low, 0, 0, MqttQueueDropPolicy::DropNewest);
+    send("a");
+    send("b");
+    send("c");
+    send("d");
+    send("e");   // evicts "c"
+    TEST_ASSERT_FALSE(send("config", MqttPriority::Low));   // no token and no queue
+    TEST_ASSERT_EQUAL(2, limiter->queueDepth());
+
+    fakeNow += 1000;
+    limiter->tick();
+    TEST_ASSERT_EQUAL(4, inner->topics.size());
+    TEST_ASSERT_EQUAL_STRING("d", inner->topics[2].c_str());
+    TEST_ASSERT_EQUAL_STRING("e", inner->topics[3].c_str());
+
+    MqttRateStats s = limiter->rateStats();
+    TEST_ASSERT_EQUAL(1, s[MqttPriority::Normal].dropped);
+    TEST_ASSERT_EQUAL(1, s[MqttPriority::Low].dropped);
+}
+
+void test_queue_waits_for_connection(void) {
+    send("a");
+    send("b");
+    send("c");
+    inner->isConnected = false;
+    fakeNow += 1000;
+    limiter->tick();
+    TEST_ASSERT_EQUAL(2, inner->topics.size());
+    inner->isConnected = true;
+    limiter->tick();
+    TEST_ASSERT_EQUAL(3, inner->topics.size());
+}
+
+void test_discovery_traffic_is_prioritized(void) {
+    limiter->setRate(1, 1);
+    HaDiscovery ha(*limiter, "homeassistant", "devices");
+    ha.setLogLevel(LOG_LEVEL_NONE);
+    HaDeviceInfo dev;
+    dev.node_id = "node";
+    ha.setDevice(dev);
+    HaSensorConfig temp;
+    temp.common.object_id = "temp";
+    HaEntityHandle h = ha.registerSensor(temp);
+    inner->topics.clear();
+
+    TEST_ASSERT_TRUE(ha.publishState(h, "20"));            // uses the only token
+    TEST_ASSERT_TRUE(ha.publishState(h, "21"));            // deferred as a state
+    TEST_ASSERT_TRUE(ha.publishSensorDiscovery(temp));     // deferred as a config
+    ha.publishAvailabilityOnline();                        // deferred, but first in line
+    TEST_ASSERT_EQUAL(1, inner->topics.size());
+
+    fakeNow += 1000;
+    ha.tick();
+    TEST_ASSERT_EQUAL_STRING("devices/node/status", inner->topics.back().c_str());
+    fakeNow += 1000;
+    ha.tick();
+    TEST_ASSERT_EQUAL_STRING("devices/node/temp/state", inner->topics.back().c_str());
+    fakeNow += 1000;
+    ha.tick();
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/node/temp/config", inner->topics.back().c_str());
+    TEST_ASSERT_TRUE(ha.isDiscoveryDelivered());
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_then_refill);
+    RUN_TEST(test_higher_priority_goes_first);
+    RUN_TEST(test_bounded_queues_drop);
+    RUN_TEST(test_queue_waits_for_connection);
+    RUN_TEST(test_discovery_traffic_is_prioritized);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_then_refill);
+    RUN_TEST(test_higher_priority_goes_first);
+    RUN_TEST(test_bounded_queues_drop);
+    RUN_TEST(test_queue_waits_for_connection);
+    RUN_TEST(test_discovery_traffic_is_prioritized);
+    return UNITY_END();
+}
+#endif
@@ -0,0 +1,293 @@
+// Static allocation: once setup is done, HaDiscovery and the transport base must not touch the heap.
+//
+// The global operator new/delete are replaced to count allocations. Everything that may allocate
+// (logger, registry, topics, stream and queue buffers) is set up first; the counter is then reset
+// and the runtime paths are exercised: reconnect and discovery replay, streamed configs, states,
+// commands, availability and removal. With an HaEntityTable, registration is checked as well.
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "HaDiscovery.h"
+#include "HaEntityTable.h"
+#include "transport/MqttTransport.h"
+#include "transport/MqttPublishQueue.h"
+
+static size_t g_allocCount = 0;
+static bool g_trace = false;
+
+void* operator new(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        abort();
+    }
+    g_allocCount++;
+    if (g_trace) {
+        printf("unexpected allocation of %u bytes\n", (unsigned)size);
+    }
+    return p;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// Transport that only counts messages and relies on the default streaming implementation.
+class CountingTransport : public MqttTransport {
+public:
+    size_t messages = 0;
+    size_t bytes = 0;
+    size_t largest = 0;
+    void (*onConnectCb)(void*) = nullptr;
+    void* onConnectCtx = nullptr;
+    MessageFn onMessageCb = nullptr;
+    void* onMessageCtx = nullptr;
+
+    bool connected() const override { return true; }
+
+    bool publish(const char*, const uint8_t*, size_t len, bool, uint8_t) override {
+        messages++;
+        bytes += len;
+        if (len > largest) {
+            largest = len;
+        }
+        return true;
+    }
+
+    bool subscribe(const char*, uint8_t) override { return true; }
+
+    void setOnConnect(void (*cb)(void*), void* ctx) override {
+        onConnectCb = cb;
+        onConnectCtx = ctx;
+    }
+
+    void setOnMessage(MessageFn cb, void* ctx) override {
+        onMessageCb = cb;
+        onMessageCtx = ctx;
+    }
+
+    void setServer(const char*, uint16_t, const char* = nullptr, const char* = nullptr) override {}
+    void setServer(const std::string&, uint16_t, const std::string& = "", const std::string& = "") override {}
+
+    void connect() {
+        onConnectCb(onConnectCtx);
+    }
+
+    void deliver(const char* topic, const char* payload) {
+        onMessageCb(onMessageCtx, topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+    }
+};
+
+static uint8_t g_streamBuf[2048];
+static uint32_t g_commands = 0;
+
+static void onCommand(void*, HaEntityHandle, const char*, size_t) {
+    g_commands++;
+}
+
+// A name long enough to push the config past the 768-byte stack buffer, so it is streamed.
+static const char* kLongName =
+    "A deliberately long entity name that makes this discovery config larger than the stack buffer, "
+    "so HaDiscovery has to stream it to the transport in pieces instead of building it in one go. "
+    "The default streaming implementation of MqttTransport collects those pieces, and with a stream "
+    "buffer supplied by the caller it does so without allocating anything on the heap at all. "
+    "Home Assistant itself does not mind a name of this length; it simply shows it truncated "
+    "in the dashboard, which is exactly what a test of the streaming path needs.";
+
+void setUp(void) {
+    g_allocCount = 0;
+    g_trace = false;
+}
+
+void tearDown(void) {
+    g_trace = false;
+}
+
+static void runEntityLifecycle(HaDiscovery& ha, CountingTransport& transport,
+                               HaEntityHandle temp, HaEntityHandle relay) {
+    transport.connect();
+    for (int i = 0; i < 10 && ha.isRepublishing(); i++) {
+        ha.tick();
+    }
+    TEST_ASSERT_FALSE(ha.isRepublishing());
+
+    for (int i = 0; i < 100; i++) {
+        ha.publishState(temp, 20.0f + i * 0.1f, 1);
+        ha.publishState(temp, "21.5");
+        ha.publishState("temperature", static_cast<int32_t>(i));
+        ha.publishStateSwitch(relay, (i & 1) != 0);
+        ha.publishStateSwitch("relay1", (i & 1) == 0);
+        ha.tick();
+    }
+    transport.deliver("devices/esp32_kitchen_01/relay1/set", "ON");
+    transport.deliver("devices/esp32_kitchen_01/restart/set", "PRESS");
+    transport.deliver("devices/esp32_kitchen_01/unknown/set", "PRESS");
+    ha.pressButton("restart");
+    HaMetrics m = ha.metrics();
+    TEST_ASSERT_EQUAL(0, m.totalFailures());
+    ha.republishDiscovery();
+    for (int i = 0; i < 10 && ha.isRepublishing(); i++) {
+        ha.tick();
+    }
+    ha.removeEntity("sensor", "temperature");
+    ha.publishAvailabilityOffline();
+}
+
+void test_no_heap_use_after_setup(void) {
+    // ---- Setup: everything here may allocate ----
+    static JBLogger logger("HaDiscovery", LOG_LEVEL_NONE);
+    static CountingTransport transport;
+    transport.setStreamBuffer(g_streamBuf, sizeof(g_streamBuf));
+    static HaDiscovery ha(transport, logger);
+    ha.setRepublishPace(4);
+
+    HaDeviceInfo dev;
+    dev.node_id = "esp32_kitchen_01";
+    dev.name = "Kitchen Node";
+    dev.manufacturer = "YourBrand";
+    dev.model = "ESP32";
+    ha.setDevice(dev);
+
+    HaSensorConfig temp;
+    temp.common.object_id = "temperature";
+    temp.common.name = "Kitchen Temperature";
+    temp.unit_of_measurement = "°C";
+    HaEntityHandle tempHandle = ha.registerSensor(temp);
+    HaStateFilter filter;
+    filter.abs_deadband = 0.25f;
+    ha.setStateFilter(tempHandle, filter);
+
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay1";
+    relay.common.name = "Kitchen Light";
+    HaEntityHandle relayHandle = ha.registerSwitch(relay);
+    ha.setCommandHandler(relayHandle, &onCommand);
+
+    HaButtonConfig restart;
+    restart.common.object_id = "restart";
+    restart.common.name = kLongName;
+    ha.setCommandHandler(ha.registerButton(restart), &onCommand);
+
+    // ---- Runtime: no allocations from here on ----
+    g_allocCount = 0;
+    g_trace = true;
+    runEntityLifecycle(ha, transport, tempHandle, relayHandle);
+    g_trace = false;
+
+    TEST_ASSERT_EQUAL(0, g_allocCount);
+    TEST_ASSERT_EQUAL(2, g_commands);
+    TEST_ASSERT_TRUE(ha.metrics().streamed_configs > 0);
+    TEST_ASSERT_TRUE(transport.largest > 768);
+}
+
+void test_device_mode_no_heap_use_after_setup(void) {
+    static JBLogger logger("HaDiscovery", LOG_LEVEL_NONE);
+    static CountingTransport transport;
+    transport.setStreamBuffer(g_streamBuf, sizeof(g_streamBuf));
+    static HaDiscovery ha(transport, logger);
+    ha.setDiscoveryMode(HaDiscoveryMode::Device);
+
+    HaDeviceInfo dev;
+    dev.node_id = "esp32_kitchen_01";
+    ha.setDevice(dev);
+    HaSensorConfig temp;
+    temp.common.object_id = "temperature";
+    HaEntityHandle tempHandle = ha.registerSensor(temp);
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay1";
+    HaEntityHandle relayHandle = ha.registerSwitch(relay);
+    HaButtonConfig restart;
+    restart.common.object_id = "restart";
+    ha.registerButton(restart);
+
+    g_allocCount = 0;
+    g_trace = true;
+    runEntityLifecycle(ha, transport, tempHandle, relayHandle);
+    ha.tick();  // device config without the removed entity
+    g_trace = false;
+
+    TEST_ASSERT_EQUAL(0, g_allocCount);
+}
+
+void test_entity_table_registration_without_heap(void) {
+    static JBLogger logger("HaDiscovery", LOG_LEVEL_NONE);
+    static CountingTransport transport;
+    transport.setStreamBuffer(g_streamBuf, sizeof(g_streamBuf));
+    static HaDiscovery ha(transport, logger);
+    static HaEntityTable<4> table;
+    TEST_ASSERT_TRUE(ha.setEntityTable(table));
+    HaDeviceInfo dev;
+    dev.node_id = "esp32_kitchen_01";
+    ha.setDevice(dev);
+
+    // With a table, registration itself is heap-free too.
+    g_commands = 0;
+    g_allocCount = 0;
+    g_trace = true;
+    HaSensorConfig temp;
+    temp.common.object_id = "temperature";
+    HaEntityHandle tempHandle = ha.registerSensor(temp);
+    HaStateFilter filter;
+    filter.abs_deadband = 0.25f;
+    ha.setStateFilter(tempHandle, filter);
+    HaSwitchConfig relay;
+    relay.common.object_id = "relay1";
+    HaEntityHandle relayHandle = ha.registerSwitch(relay);
+    ha.setCommandHandler(relayHandle, &onCommand);
+    HaButtonConfig restart;
+    restart.common.object_id = "restart";
+    restart.common.name = kLongName;
+    ha.setCommandHandler(ha.registerButton(restart), &onCommand);
+    TEST_ASSERT_EQUAL(relayHandle.index, ha.entityHandle("relay1").index);
+
+    runEntityLifecycle(ha, transport, tempHandle, relayHandle);
+    TEST_ASSERT_TRUE(ha.registerSensor(temp).valid());   // takes the freed slot
+    g_trace = false;
+
+    TEST_ASSERT_EQUAL(0, g_allocCount);
+    TEST_ASSERT_EQUAL(2, g_commands);
+}
+
+void test_queue_with_caller_buffer(void) {
+    alignas(4) static uint8_t buf[512];
+    static MqttPublishQueue queue;
+    queue.setBuffer(buf, sizeof(buf), 0, MqttQueueDropPolicy::DropOldest);
+
+    g_allocCount = 0;
+    const uint8_t payload[] = { '2', '1', '.', '5' };
+    for (int i = 0; i < 1000; i++) {
+        queue.push("devices/esp32_kitchen_01/temperature/state", payload, sizeof(payload), false, 0);
+        if (i % 3 == 0) {
+            queue.pop();
+        }
+    }
+    TEST_ASSERT_EQUAL(0, g_allocCount);
+    TEST_ASSERT_TRUE(queue.size() > 0);
+    TEST_ASSERT_TRUE(queue.dropped() > 0);
+}
+
+#if defined(ARDUINO)
+void setup() {
+    delay(2000);
+    UNITY_BEGIN();
+    RUN_TEST(test_no_heap_use_after_setup);
+    RUN_TEST(test_device_mode_no_heap_use_after_setup);
+    RUN_TEST(test_entity_table_registration_without_heap);
+    RUN_TEST(test_queue_with_caller_buffer);
+    UNITY_END();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_heap_use_after_setup);
+    RUN_TEST(test_device_mode_no_heap_use_after_setup);
+    RUN_TEST(test_entity_table_registration_without_heap);
+    RUN_TEST(test_queue_with_caller_buffer);
+    return UNITY_END();
+}
+#endif